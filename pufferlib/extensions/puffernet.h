@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
@@ -328,7 +329,17 @@ void _argmax_multidiscrete(float* input, int* output, int batch_size, int logit_
     }
 }
 
-void _softmax_multidiscrete(float* input, int* output, int batch_size, int logit_sizes[], int num_actions) {
+// SplitMix64 step returning a uniform float in [0, 1). Sampling layers keep
+// their own state so nets in different threads draw independent streams.
+static inline float _rand_uniform(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (z >> 40) * (1.0f / 16777216.0f);
+}
+
+void _softmax_multidiscrete(float* input, int* output, int batch_size, int logit_sizes[], int num_actions, uint64_t* rng_state) {
     int in_adr = 0;
     for (int b = 0; b < batch_size; b++) {
         for (int a = 0; a < num_actions; a++) {
@@ -338,7 +349,7 @@ void _softmax_multidiscrete(float* input, int* output, int batch_size, int logit
             for (int i = 0; i < num_action_types; i++) {
                 logit_exp_sum += expf(input[in_adr + i]);
             }
-            float prob = rand() / (float)RAND_MAX;
+            float prob = _rand_uniform(rng_state);
             float logit_prob = 0;
             output[out_adr] = 0;
             for (int i = 0; i < num_action_types; i++) {
@@ -700,6 +711,7 @@ struct Multidiscrete {
     int batch_size;
     int logit_sizes[32];
     int num_actions;
+    uint64_t rng_state;
 };
 
 Multidiscrete* make_multidiscrete(int batch_size, int logit_sizes[], int num_actions) {
@@ -710,12 +722,16 @@ Multidiscrete* make_multidiscrete(int batch_size, int logit_sizes[], int num_act
     return layer;
 }
 
+void seed_multidiscrete(Multidiscrete* layer, uint64_t seed) {
+    layer->rng_state = seed;
+}
+
 void argmax_multidiscrete(Multidiscrete* layer, float* input, int* output) {
     _argmax_multidiscrete(input, output, layer->batch_size, layer->logit_sizes, layer->num_actions);
 }
 
 void softmax_multidiscrete(Multidiscrete* layer, float* input, int* output) {
-    _softmax_multidiscrete(input, output, layer->batch_size, layer->logit_sizes, layer->num_actions);
+    _softmax_multidiscrete(input, output, layer->batch_size, layer->logit_sizes, layer->num_actions, &layer->rng_state);
 }
 
 // Default models
@@ -2,8 +2,595 @@
 #define Env Drive
 #define MY_SHARED
 #define MY_PUT
+#define MY_SEED
+#define MY_REBASE
+#define MY_COST
+#include <Python.h>
+static PyObject* env_events(PyObject* self, PyObject* args);
+static PyObject* env_expert_actions(PyObject* self, PyObject* args);
+static PyObject* env_obs_scales(PyObject* self, PyObject* args);
+static PyObject* env_snapshot(PyObject* self, PyObject* args);
+static PyObject* env_restore(PyObject* self, PyObject* args);
+static PyObject* env_clone(PyObject* self, PyObject* args, PyObject* kwargs);
+static PyObject* vec_build(PyObject* self, PyObject* args, PyObject* kwargs);
+static PyObject* vec_reload(PyObject* self, PyObject* args);
+static int parse_config(Env* env, PyObject* kwargs);
+#define MY_METHODS \
+    {"env_events", env_events, METH_VARARGS, "Zero-copy view of the collision/offroad event ring buffer"}, \
+    {"env_expert_actions", env_expert_actions, METH_VARARGS, "Actions reproducing the logged trajectories"}, \
+    {"env_obs_scales", env_obs_scales, METH_VARARGS, "Per-feature factors that decode stored observations to float"}, \
+    {"env_snapshot", env_snapshot, METH_VARARGS, "Mutable episode state of an env as bytes"}, \
+    {"env_restore", env_restore, METH_VARARGS, "Restore an env from env_snapshot bytes"}, \
+    {"env_clone", (PyCFunction)env_clone, METH_VARARGS | METH_KEYWORDS, "Fork envs n ways into a vec sharing their map data"}, \
+    {"vec_build", (PyCFunction)vec_build, METH_VARARGS | METH_KEYWORDS, "Build the vec from map ids and agent offsets, loading maps in parallel"}, \
+    {"vec_reload", vec_reload, METH_VARARGS, "Swap the vector to new maps in place, keeping its buffers"}
 #include "../env_binding.h"
 
+// env_events(handle[, scenario]): returns (events, count), a structured array
+// view over the env's event ring buffer and the total number of events written
+// so far. Once count exceeds the buffer length, the oldest entries have been
+// overwritten; the newest event is at index (count - 1) % len(events). Packed
+// hosts keep one buffer per scenario.
+static PyObject* env_events(PyObject* self, PyObject* args) {
+    Py_ssize_t nargs = PyTuple_Size(args);
+    if (nargs != 1 && nargs != 2) {
+        PyErr_SetString(PyExc_TypeError, "env_events requires 1 or 2 arguments");
+        return NULL;
+    }
+    Env* env = unpack_env(args);
+    if (!env) {
+        return NULL;
+    }
+    int scenario = 0;
+    if (nargs == 2) {
+        scenario = PyLong_AsLong(PyTuple_GetItem(args, 1));
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+    if (env->num_scenarios > 0) {
+        if (scenario < 0 || scenario >= env->num_scenarios) {
+            PyErr_SetString(PyExc_IndexError, "scenario index out of range");
+            return NULL;
+        }
+        env = &env->scenarios[scenario];
+    } else if (scenario != 0) {
+        PyErr_SetString(PyExc_IndexError, "scenario index out of range");
+        return NULL;
+    }
+    if (env->event_capacity <= 0 || env->events == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Event recording is disabled (set event_buffer_size > 0)");
+        return NULL;
+    }
+
+    PyObject* fields = Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)(ss)]",
+        "timestep", "i4", "agent", "i4", "other", "i4", "type", "i4", "x", "f4", "y", "f4");
+    PyArray_Descr* descr = NULL;
+    int ok = PyArray_DescrConverter(fields, &descr);
+    Py_DECREF(fields);
+    if (!ok) {
+        return NULL;
+    }
+
+    npy_intp dims[1] = {env->event_capacity};
+    PyObject* events = PyArray_NewFromDescr(&PyArray_Type, descr, 1, dims, NULL, env->events, NPY_ARRAY_CARRAY, NULL);
+    if (!events) {
+        return NULL;
+    }
+    if (PyArray_ITEMSIZE((PyArrayObject*)events) != sizeof(DriveEvent)) {
+        Py_DECREF(events);
+        PyErr_SetString(PyExc_RuntimeError, "DriveEvent layout does not match the event dtype");
+        return NULL;
+    }
+    return Py_BuildValue("(NL)", events, (long long)env->event_count);
+}
+
+// Returns a float32 array with one factor per observation feature: stored value
+// times factor gives the float observation. All ones unless obs_dtype is int8.
+static PyObject* env_obs_scales(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 1) {
+        PyErr_SetString(PyExc_TypeError, "env_obs_scales requires 1 argument");
+        return NULL;
+    }
+    Env* env = unpack_env(args);
+    if (!env) {
+        return NULL;
+    }
+    if (env->num_scenarios > 0) {
+        env = &env->scenarios[0];  // scenarios share the obs layout
+    }
+    npy_intp dims[1] = {obs_size(env)};
+    PyObject* scales = PyArray_SimpleNew(1, dims, NPY_FLOAT32);
+    if (!scales) {
+        return NULL;
+    }
+    float* data = PyArray_DATA((PyArrayObject*)scales);
+    for (int k = 0; k < dims[0]; k++) {
+        data[k] = env->obs_inv_scale ? 1.0f / env->obs_inv_scale[k] : 1.0f;
+    }
+    return scales;
+}
+
+// env_snapshot(handle): returns the env's mutable episode state as bytes (see
+// write_snapshot). Packed hosts include every scenario.
+static PyObject* env_snapshot(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 1) {
+        PyErr_SetString(PyExc_TypeError, "env_snapshot requires 1 argument");
+        return NULL;
+    }
+    Env* env = unpack_env(args);
+    if (!env) {
+        return NULL;
+    }
+    PyObject* snapshot = PyBytes_FromStringAndSize(NULL, snapshot_size(env));
+    if (!snapshot) {
+        return NULL;
+    }
+    write_snapshot(env, PyBytes_AS_STRING(snapshot));
+    return snapshot;
+}
+
+// env_restore(handle, snapshot): restores state taken with env_snapshot from this
+// env or one built on the same maps and agents. Observations are recomputed by
+// the next step; the buffers keep what the last step wrote.
+static PyObject* env_restore(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 2) {
+        PyErr_SetString(PyExc_TypeError, "env_restore requires 2 arguments");
+        return NULL;
+    }
+    Env* env = unpack_env(args);
+    if (!env) {
+        return NULL;
+    }
+    Py_buffer view;
+    if (PyObject_GetBuffer(PyTuple_GetItem(args, 1), &view, PyBUF_SIMPLE) != 0) {
+        return NULL;
+    }
+    int ok = read_snapshot(env, view.buf, view.len) == 0;
+    PyBuffer_Release(&view);
+    if (!ok) {
+        PyErr_SetString(PyExc_ValueError, "Snapshot does not match this env's maps and agents");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// env_expert_actions(handle, timestep, actions, valid): fills actions (same layout
+// as the env's action buffer) and valid (uint8, one per agent) with the inverse
+// dynamics of the logged step timestep -> timestep + 1. A negative timestep uses
+// the env's current timestep (each scenario's own when packed).
+static PyObject* env_expert_actions(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 4) {
+        PyErr_SetString(PyExc_TypeError, "env_expert_actions requires 4 arguments");
+        return NULL;
+    }
+    Env* env = unpack_env(args);
+    if (!env) {
+        return NULL;
+    }
+    int timestep = PyLong_AsLong(PyTuple_GetItem(args, 1));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    PyObject* act = PyTuple_GetItem(args, 2);
+    PyObject* val = PyTuple_GetItem(args, 3);
+    if (!PyObject_TypeCheck(act, &PyArray_Type) || !PyObject_TypeCheck(val, &PyArray_Type)) {
+        PyErr_SetString(PyExc_TypeError, "actions and valid must be NumPy arrays");
+        return NULL;
+    }
+    PyArrayObject* actions = (PyArrayObject*)act;
+    PyArrayObject* valid = (PyArrayObject*)val;
+    if (!PyArray_ISCONTIGUOUS(actions) || !PyArray_ISCONTIGUOUS(valid)) {
+        PyErr_SetString(PyExc_ValueError, "actions and valid must be contiguous");
+        return NULL;
+    }
+    int dim = action_dim(env);
+    if (PyArray_ITEMSIZE(actions) != 4 || PyArray_SIZE(actions) < (npy_intp)env->active_agent_count * dim) {
+        PyErr_SetString(PyExc_ValueError, "actions must hold one 4-byte action row per agent");
+        return NULL;
+    }
+    if (PyArray_ITEMSIZE(valid) != 1 || PyArray_SIZE(valid) < env->active_agent_count) {
+        PyErr_SetString(PyExc_ValueError, "valid must be a uint8/bool array with one entry per agent");
+        return NULL;
+    }
+    void* actions_data = PyArray_DATA(actions);
+    unsigned char* valid_data = PyArray_DATA(valid);
+    Py_BEGIN_ALLOW_THREADS
+    compute_expert_actions(env, timestep, actions_data, valid_data);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// Scenarios for vec_load_task: map file, agent budget and seed of each, and
+// the first scenario of each pack (num_envs + 1 entries). Envs below
+// reuse_envs already hold maps and are reloaded, the others are initialized.
+typedef struct {
+    char** map_names;
+    int* max_agents;
+    int* seeds;
+    int* pack_first;
+    int per_env;
+    int reuse_envs;
+} VecLoad;
+
+static void vec_load_task(Env* env, int p, void* ctx) {
+    VecLoad* load = ctx;
+    int first = load->pack_first[p];
+    int n = load->pack_first[p + 1] - first;
+    if (load->per_env > 1) {
+        if (p < load->reuse_envs) {
+            reload_scenarios(env, load->map_names + first, load->max_agents + first, load->seeds + first, n);
+        } else {
+            init_scenarios(env, load->map_names + first, load->max_agents + first, load->seeds + first, n);
+        }
+    } else if (p < load->reuse_envs) {
+        free(env->map_name);
+        reload(env, strdup(load->map_names[first]), load->max_agents[first]);
+    } else {
+        env->map_name = strdup(load->map_names[first]);
+        env->num_agents = load->max_agents[first];
+        init(env);
+        init_obs_codec(env);
+    }
+}
+
+// Reads the observations, actions, rewards, terminals and masks arrays starting
+// at args[start]. masks may be None. rows is the observation row count.
+static int unpack_buffers(PyObject* args, int start, char** base, npy_intp* stride, npy_intp* rows) {
+    for (int k = 0; k < VEC_BUFFERS; k++) {
+        PyObject* obj = PyTuple_GetItem(args, start + k);
+        base[k] = NULL;
+        stride[k] = 0;
+        if (obj == Py_None && k == VEC_BUFFERS - 1) {
+            continue;
+        }
+        if (!PyObject_TypeCheck(obj, &PyArray_Type) || !PyArray_ISCONTIGUOUS((PyArrayObject*)obj)
+                || PyArray_NDIM((PyArrayObject*)obj) < 1) {
+            PyErr_SetString(PyExc_TypeError, "Buffers must be contiguous NumPy arrays");
+            return -1;
+        }
+        PyArrayObject* array = (PyArrayObject*)obj;
+        base[k] = PyArray_DATA(array);
+        stride[k] = PyArray_STRIDE(array, 0);
+        if (k == 0) *rows = PyArray_DIM(array, 0);
+    }
+    return 0;
+}
+
+// Reads map_ids and agent_offsets (one entry longer) into new int arrays.
+// Returns the scenario count, or -1 with an exception set.
+static int unpack_maps(PyObject* map_ids, PyObject* offsets, npy_intp rows, int** ids, int** agent_offsets) {
+    if (!PyList_Check(map_ids) || !PyList_Check(offsets) || PyList_Size(map_ids) < 1
+            || PyList_Size(offsets) != PyList_Size(map_ids) + 1) {
+        PyErr_SetString(PyExc_ValueError, "map_ids must be a non-empty list and agent_offsets one entry longer");
+        return -1;
+    }
+    int n = (int)PyList_Size(map_ids);
+    *ids = calloc(n, sizeof(int));
+    *agent_offsets = calloc(n + 1, sizeof(int));
+    for (int i = 0; i < n; i++) {
+        (*ids)[i] = (int)PyLong_AsLong(PyList_GetItem(map_ids, i));
+    }
+    for (int i = 0; i <= n; i++) {
+        (*agent_offsets)[i] = (int)PyLong_AsLong(PyList_GetItem(offsets, i));
+    }
+    if (!PyErr_Occurred() && ((*agent_offsets)[0] != 0 || (*agent_offsets)[n] > rows)) {
+        PyErr_SetString(PyExc_ValueError, "agent_offsets must start at 0 and fit in the buffers");
+    }
+    if (PyErr_Occurred()) {
+        free(*ids);
+        free(*agent_offsets);
+        return -1;
+    }
+    return n;
+}
+
+// Sizes env_rows for the vec's envs and records the row size of each buffer
+static void vec_set_rows(VecEnv* vec, const npy_intp* stride) {
+    vec->env_rows = (int*)realloc(vec->env_rows, (vec->num_envs + 1)*sizeof(int));
+    memcpy(vec->row_bytes, stride, sizeof(vec->row_bytes));
+}
+
+// Points the vec's envs (one per pack of per_env scenarios) at their rows of
+// the buffers, seeds them like env_init and loads their maps on the thread pool
+static void vec_load_maps(VecEnv* vec, const int* ids, const int* agent_offsets, int n, int per_env,
+        int seed, char** base, const npy_intp* stride, int reuse_envs) {
+    VecLoad load = {0};
+    load.map_names = calloc(n, sizeof(char*));
+    load.max_agents = calloc(n, sizeof(int));
+    load.seeds = calloc(n, sizeof(int));
+    load.pack_first = calloc(vec->num_envs + 1, sizeof(int));
+    load.per_env = per_env;
+    load.reuse_envs = reuse_envs;
+    for (int s = 0; s < n; s++) {
+        char map_file[100];
+        sprintf(map_file, "resources/drive/binaries/map_%03d.bin", ids[s]);
+        load.map_names[s] = strdup(map_file);
+        load.max_agents[s] = agent_offsets[s + 1] - agent_offsets[s];
+        load.seeds[s] = seed + s;
+    }
+    for (int p = 0; p < vec->num_envs; p++) {
+        Env* env = vec->envs[p];
+        int first = p*per_env;
+        load.pack_first[p] = first;
+        int row = agent_offsets[first];
+        char* obs = base[0] + row*stride[0];
+        if (env->obs_out) {
+            env->obs_out = obs;
+        } else {
+            env->observations = (float*)obs;
+        }
+        env->actions = (float*)(base[1] + row*stride[1]);
+        env->rewards = (float*)(base[2] + row*stride[2]);
+        env->terminals = (unsigned char*)(base[3] + row*stride[3]);
+        env->masks = base[4] ? (unsigned char*)(base[4] + row*stride[4]) : NULL;
+        my_seed(env, seed + first);
+    }
+    load.pack_first[vec->num_envs] = n;
+    // The costs belong to the old maps (and maybe fewer envs): split the loads
+    // evenly until vec_update_costs has the new ones
+    free(vec->cost_prefix);
+    vec->cost_prefix = NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    vec_parallel_for(vec, vec_load_task, &load);
+    Py_END_ALLOW_THREADS
+    for (int s = 0; s < n; s++) {
+        free(load.map_names[s]);
+    }
+    free(load.map_names);
+    free(load.max_agents);
+    free(load.seeds);
+    free(load.pack_first);
+    vec_update_costs(vec);
+    vec_set_rows(vec, stride);
+    for (int p = 0; p <= vec->num_envs; p++) {
+        vec->env_rows[p] = agent_offsets[p < vec->num_envs ? p*per_env : n];
+    }
+    vec_bind_numa(vec, base);
+    // Registered slots (base is slot 0's set) follow the new rows and queue split
+    for (int slot = 0; slot < VEC_SLOTS; slot++) {
+        if (vec->slot_registered[slot] && vec->slot_base[slot][0] != base[0]) {
+            vec_bind_numa(vec, vec->slot_base[slot]);
+        }
+    }
+}
+
+static PyObject* vec_handles(VecEnv* vec) {
+    PyObject* handles = PyList_New(vec->num_envs);
+    for (int p = 0; p < vec->num_envs; p++) {
+        PyList_SetItem(handles, p, PyLong_FromVoidPtr(vec->envs[p]));
+    }
+    return handles;
+}
+
+// env_clone(handles, n, observations, actions, rewards, terminals, masks,
+// num_threads=1, pin_threads=False, numa_bind=False): forks envs n ways at their current step
+// (see clone_drive) into a new vec, so vec_step advances all branches on the
+// thread pool. handles is one env handle or a list of them, taking R rows in
+// total; branch b of the env starting at row r writes row b*R + r of the
+// buffers, which need n*R rows. Each branch starts with the env's current
+// observations and masks. masks may be None. Returns (vec handle, env handles).
+static PyObject* env_clone(PyObject* self, PyObject* args, PyObject* kwargs) {
+    if (PyTuple_Size(args) != 2 + VEC_BUFFERS) {
+        PyErr_SetString(PyExc_TypeError, "env_clone requires 7 arguments");
+        return NULL;
+    }
+    PyObject* handles = PyTuple_GetItem(args, 0);
+    int num_sources = PyList_Check(handles) ? (int)PyList_Size(handles) : 1;
+    int n = PyLong_AsLong(PyTuple_GetItem(args, 1));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    if (n < 1 || num_sources < 1) {
+        PyErr_SetString(PyExc_ValueError, "env_clone needs at least one env and n >= 1");
+        return NULL;
+    }
+    char* base[VEC_BUFFERS];
+    npy_intp stride[VEC_BUFFERS];
+    npy_intp rows = 0;
+    if (unpack_buffers(args, 2, base, stride, &rows) != 0) {
+        return NULL;
+    }
+    Env* sources[num_sources];
+    int first_row[num_sources];
+    int total_rows = 0;
+    for (int i = 0; i < num_sources; i++) {
+        PyObject* handle = PyList_Check(handles) ? PyList_GetItem(handles, i) : handles;
+        PyObject* handle_args = PyTuple_Pack(1, handle);
+        sources[i] = unpack_env(handle_args);
+        Py_DECREF(handle_args);
+        if (!sources[i]) {
+            return NULL;
+        }
+        first_row[i] = total_rows;
+        total_rows += sources[i]->active_agent_count;
+    }
+    if ((npy_intp)n*total_rows > rows) {
+        PyErr_SetString(PyExc_ValueError, "Buffers must hold n rows per agent of the cloned envs");
+        return NULL;
+    }
+
+    VecEnv* vec = (VecEnv*)calloc(1, sizeof(VecEnv));
+    vec->num_envs = n*num_sources;
+    vec->envs = (Env**)calloc(vec->num_envs, sizeof(Env*));
+    for (int b = 0; b < n; b++) {
+        for (int i = 0; i < num_sources; i++) {
+            Env* src = sources[i];
+            Env* env = (Env*)calloc(1, sizeof(Env));
+            clone_drive(env, src);
+            int row = b*total_rows + first_row[i];
+            char* obs = base[0] + row*stride[0];
+            void* src_obs = src->obs_out ? src->obs_out : (void*)src->observations;
+            memcpy(obs, src_obs, (size_t)src->active_agent_count*obs_size(src)*obs_elem_size(src));
+            if (env->obs_out) {
+                env->obs_out = obs;
+            } else {
+                env->observations = (float*)obs;
+            }
+            env->actions = (float*)(base[1] + row*stride[1]);
+            env->rewards = (float*)(base[2] + row*stride[2]);
+            env->terminals = (unsigned char*)(base[3] + row*stride[3]);
+            env->masks = base[4] ? (unsigned char*)(base[4] + row*stride[4]) : NULL;
+            if (env->masks && src->masks) {
+                memcpy(env->masks, src->masks, src->active_agent_count);
+            } else if (env->masks) {
+                memset(env->masks, 1, src->active_agent_count);
+            }
+            if (env->num_scenarios > 0) {
+                set_scenario_buffers(env);
+            }
+            vec->envs[b*num_sources + i] = env;
+        }
+    }
+    if (vec_configure_threads(vec, kwargs) != 0) {
+        for (int i = 0; i < vec->num_envs; i++) {
+            c_close(vec->envs[i]);
+            free(vec->envs[i]);
+        }
+        free(vec->envs);
+        free(vec);
+        return NULL;
+    }
+    vec_update_costs(vec);
+    vec_set_rows(vec, stride);
+    for (int b = 0; b < n; b++) {
+        for (int i = 0; i < num_sources; i++) {
+            vec->env_rows[b*num_sources + i] = b*total_rows + first_row[i];
+        }
+    }
+    vec->env_rows[vec->num_envs] = n*total_rows;
+    vec_bind_numa(vec, base);
+    return Py_BuildValue("(NN)", PyLong_FromVoidPtr(vec), vec_handles(vec));
+}
+
+// vec_build(map_ids, agent_offsets, scenarios_per_env, seed, observations,
+// actions, rewards, terminals, masks, **kwargs): builds the vec the way drive.py
+// would with one env_init per pack and vectorize, but loads the maps in parallel
+// on the thread pool. kwargs are env_init's configuration plus num_threads,
+// pin_threads and numa_bind (see vec_bind_numa). masks may be None. Returns (vec handle, env handles).
+static PyObject* vec_build(PyObject* self, PyObject* args, PyObject* kwargs) {
+    if (PyTuple_Size(args) != 4 + VEC_BUFFERS || kwargs == NULL) {
+        PyErr_SetString(PyExc_TypeError, "vec_build requires 9 arguments and the env config as kwargs");
+        return NULL;
+    }
+    int per_env = PyLong_AsLong(PyTuple_GetItem(args, 2));
+    int seed = PyLong_AsLong(PyTuple_GetItem(args, 3));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    if (per_env < 1) {
+        PyErr_SetString(PyExc_ValueError, "scenarios_per_env must be >= 1");
+        return NULL;
+    }
+    char* base[VEC_BUFFERS];
+    npy_intp stride[VEC_BUFFERS];
+    npy_intp rows = 0;
+    if (unpack_buffers(args, 4, base, stride, &rows) != 0) {
+        return NULL;
+    }
+    int* ids = NULL;
+    int* agent_offsets = NULL;
+    int n = unpack_maps(PyTuple_GetItem(args, 0), PyTuple_GetItem(args, 1), rows, &ids, &agent_offsets);
+    if (n < 0) {
+        return NULL;
+    }
+    Env config = {0};
+    if (parse_config(&config, kwargs) != 0) {
+        free(config.ini_file);
+        free(ids);
+        free(agent_offsets);
+        return NULL;
+    }
+
+    VecEnv* vec = (VecEnv*)calloc(1, sizeof(VecEnv));
+    vec->num_envs = (n + per_env - 1) / per_env;
+    vec->envs = (Env**)calloc(vec->num_envs, sizeof(Env*));
+    for (int p = 0; p < vec->num_envs; p++) {
+        Env* env = (Env*)calloc(1, sizeof(Env));
+        copy_drive_config(env, &config);
+        env->human_agent_idx = config.human_agent_idx;
+        env->ini_file = strdup(config.ini_file);
+        vec->envs[p] = env;
+    }
+    free(config.ini_file);
+    if (vec_configure_threads(vec, kwargs) != 0) {
+        for (int p = 0; p < vec->num_envs; p++) {
+            free(vec->envs[p]->ini_file);
+            free(vec->envs[p]);
+        }
+        free(vec->envs);
+        free(vec);
+        free(ids);
+        free(agent_offsets);
+        return NULL;
+    }
+    vec_load_maps(vec, ids, agent_offsets, n, per_env, seed, base, stride, 0);
+    free(ids);
+    free(agent_offsets);
+    return Py_BuildValue("(NN)", PyLong_FromVoidPtr(vec), vec_handles(vec));
+}
+
+// vec_reload(vec, map_ids, agent_offsets, scenarios_per_env, seed, observations,
+// actions, rewards, terminals, masks): loads new maps into the vec in place, the
+// way vec_build would build it, and returns the new env handles. Existing
+// Drives are reloaded (see reload), surplus ones closed and missing ones created
+// from the first env's configuration. The buffers are the slot 0 set the vec
+// was built on; masks may be None. Call vec_reset afterwards.
+static PyObject* vec_reload(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 5 + VEC_BUFFERS) {
+        PyErr_SetString(PyExc_TypeError, "vec_reload requires 10 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    int per_env = PyLong_AsLong(PyTuple_GetItem(args, 3));
+    int seed = PyLong_AsLong(PyTuple_GetItem(args, 4));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    if (per_env < 1) {
+        PyErr_SetString(PyExc_ValueError, "scenarios_per_env must be >= 1");
+        return NULL;
+    }
+    char* base[VEC_BUFFERS];
+    npy_intp stride[VEC_BUFFERS];
+    npy_intp rows = 0;
+    if (unpack_buffers(args, 5, base, stride, &rows) != 0) {
+        return NULL;
+    }
+    int* ids = NULL;
+    int* agent_offsets = NULL;
+    int n = unpack_maps(PyTuple_GetItem(args, 1), PyTuple_GetItem(args, 2), rows, &ids, &agent_offsets);
+    if (n < 0) {
+        return NULL;
+    }
+    vec_join_async(vec);
+
+    int num_packs = (n + per_env - 1) / per_env;
+    for (int p = num_packs; p < vec->num_envs; p++) {
+        c_close(vec->envs[p]);
+        free(vec->envs[p]);
+    }
+    Env* config = vec->envs[0];
+    if (num_packs != vec->num_envs) {
+        vec->envs = (Env**)realloc(vec->envs, num_packs*sizeof(Env*));
+    }
+    for (int p = vec->num_envs; p < num_packs; p++) {
+        vec->envs[p] = (Env*)calloc(1, sizeof(Env));
+        copy_drive_config(vec->envs[p], config);
+    }
+    int old_envs = vec->num_envs < num_packs ? vec->num_envs : num_packs;
+    vec->num_envs = num_packs;
+    vec->slot = 0;
+    vec_load_maps(vec, ids, agent_offsets, n, per_env, seed, base, stride, old_envs);
+    free(ids);
+    free(agent_offsets);
+    return vec_handles(vec);
+}
+
 static int my_put(Env* env, PyObject* args, PyObject* kwargs) {
     PyObject* obs = PyDict_GetItemString(kwargs, "observations");
     if (!PyObject_TypeCheck(obs, &PyArray_Type)) {
@@ -15,7 +602,12 @@ static int my_put(Env* env, PyObject* args, PyObject* kwargs) {
         PyErr_SetString(PyExc_ValueError, "Observations must be contiguous");
         return 1;
     }
-    env->observations = PyArray_DATA(observations);
+    if (env->obs_out) {
+        env->obs_out = PyArray_DATA(observations);
+    } else {
+        env->observations = PyArray_DATA(observations);
+    }
+    invalidate_obs_counts(env);
 
     PyObject* act = PyDict_GetItemString(kwargs, "actions");
     if (!PyObject_TypeCheck(act, &PyArray_Type)) {
@@ -64,24 +656,133 @@ static int my_put(Env* env, PyObject* args, PyObject* kwargs) {
         return 1;
     }
     env->terminals = PyArray_DATA(terminals);
+    if (env->num_scenarios > 0) {
+        set_scenario_buffers(env);
+    }
     return 0;
 }
 
+// Reduced obs dtypes encode into obs_out, and packed hosts re-slice their
+// scenarios. The new slot's rows hold older observations, so they are cleared in full.
+static void my_rebase(Env* env, const ptrdiff_t* delta) {
+    if (env->obs_out) {
+        env->obs_out = (char*)env->obs_out + delta[0];
+    } else {
+        env->observations = (float*)((char*)env->observations + delta[0]);
+    }
+    env->actions = (float*)((char*)env->actions + delta[1]);
+    env->rewards = (float*)((char*)env->rewards + delta[2]);
+    env->terminals = (unsigned char*)((char*)env->terminals + delta[3]);
+    if (env->masks) {
+        env->masks = (unsigned char*)((char*)env->masks + delta[4]);
+    }
+    if (env->num_scenarios > 0) {
+        set_scenario_buffers(env);
+    }
+    if (delta[0] != 0) {
+        invalidate_obs_counts(env);
+    }
+}
+
+static float my_cost(Env* env) {
+    return drive_step_cost(env);
+}
+
+static void my_seed(Env* env, int seed) {
+    rng_seed(&env->rng, (uint64_t)(uint32_t)seed, 0);
+}
+
+// Orders n scenarios so that each consecutive pack of per_env has about the
+// same predicted cost: longest processing time first, each scenario going to the
+// cheapest pack with room. Packs have the sizes drive.py slices them into. The
+// sampled order is kept unless this lowers the cost of the heaviest pack.
+static void balance_packs(const float* cost, int n, int per_env, int* order) {
+    int num_packs = (n + per_env - 1) / per_env;
+    int* by_cost = calloc(n, sizeof(int));
+    int* pack_of = calloc(n, sizeof(int));
+    int* size = calloc(num_packs, sizeof(int));
+    float* load = calloc(num_packs, sizeof(float));
+    for (int i = 0; i < n; i++) {
+        // Insertion sort, descending and stable: scenario counts are small
+        int j = i;
+        while (j > 0 && cost[by_cost[j - 1]] < cost[i]) {
+            by_cost[j] = by_cost[j - 1];
+            j--;
+        }
+        by_cost[j] = i;
+    }
+    for (int k = 0; k < n; k++) {
+        int s = by_cost[k];
+        int best = -1;
+        for (int p = 0; p < num_packs; p++) {
+            int capacity = p < num_packs - 1 ? per_env : n - (num_packs - 1)*per_env;
+            if (size[p] < capacity && (best < 0 || load[p] < load[best])) best = p;
+        }
+        pack_of[s] = best;
+        size[best]++;
+        load[best] += cost[s];
+    }
+    float sampled_max = 0.0f, balanced_max = 0.0f;
+    for (int p = 0; p < num_packs; p++) {
+        float sampled = 0.0f;
+        for (int s = p*per_env; s < n && s < (p + 1)*per_env; s++) sampled += cost[s];
+        if (sampled > sampled_max) sampled_max = sampled;
+        if (load[p] > balanced_max) balanced_max = load[p];
+    }
+    int next = 0;
+    for (int p = 0; p < num_packs; p++) {
+        for (int s = 0; s < n; s++) {
+            if (balanced_max < sampled_max ? pack_of[s] == p : s / per_env == p) order[next++] = s;
+        }
+    }
+    free(by_cost);
+    free(pack_of);
+    free(size);
+    free(load);
+}
+
 static PyObject* my_shared(PyObject* self, PyObject* args, PyObject* kwargs) {
     int num_agents = unpack(kwargs, "num_agents");
     int num_maps = unpack(kwargs, "num_maps");
-    clock_gettime(CLOCK_REALTIME, &ts);
-    srand(ts.tv_nsec);
+    // Scenarios are packed into envs of scenarios_per_env (see init_scenarios)
+    int per_env = 1;
+    PyObject* per_env_obj = PyDict_GetItemString(kwargs, "scenarios_per_env");
+    if (per_env_obj) {
+        per_env = (int)PyLong_AsLong(per_env_obj);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        if (per_env < 1) {
+            PyErr_SetString(PyExc_ValueError, "scenarios_per_env must be >= 1");
+            return NULL;
+        }
+    }
+    // Map sampling is reproducible when a seed is passed, wall-clock otherwise
+    DriveRNG rng;
+    PyObject* seed_obj = kwargs ? PyDict_GetItemString(kwargs, "seed") : NULL;
+    if (seed_obj && seed_obj != Py_None) {
+        unsigned long long seed = PyLong_AsUnsignedLongLongMask(seed_obj);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        rng_seed(&rng, (uint64_t)seed, 0);
+    } else {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        rng_seed(&rng, (uint64_t)ts.tv_nsec, 0);
+    }
     int total_agent_count = 0;
     int env_count = 0;
     int max_envs = num_agents;
-    PyObject* agent_offsets = PyList_New(max_envs+1);
-    PyObject* map_ids = PyList_New(max_envs);
+    int* sampled_maps = calloc(max_envs, sizeof(int));
+    int* agent_counts = calloc(max_envs, sizeof(int));
+    int* object_counts = calloc(max_envs, sizeof(int));
+    int* road_points = calloc(max_envs, sizeof(int));
     // getting env count
     while(total_agent_count < num_agents && env_count < max_envs){
         char map_file[100];
-        int map_id = rand() % num_maps;
+        int map_id = rng_int(&rng, num_maps);
         Drive* env = calloc(1, sizeof(Drive));
+        rng_seed(&env->rng, rng_next(&rng), env_count);
         sprintf(map_file, "resources/drive/binaries/map_%03d.bin", map_id);
         env->entities = load_map_binary(map_file, env);
         PyObject* obj = NULL;
@@ -104,12 +805,10 @@ static PyObject* my_shared(PyObject* self, PyObject* args, PyObject* kwargs) {
             env->deterministic_agent_selection = 0;
         }
         set_active_agents(env);
-        // Store map_id
-        PyObject* map_id_obj = PyLong_FromLong(map_id);
-        PyList_SetItem(map_ids, env_count, map_id_obj);
-        // Store agent offset
-        PyObject* offset = PyLong_FromLong(total_agent_count);
-        PyList_SetItem(agent_offsets, env_count, offset);
+        sampled_maps[env_count] = map_id;
+        agent_counts[env_count] = env->active_agent_count;
+        object_counts[env_count] = env->num_objects;
+        road_points[env_count] = road_point_count(env);
         total_agent_count += env->active_agent_count;
         env_count++;
         for(int j=0;j<env->num_entities;j++) {
@@ -122,40 +821,96 @@ static PyObject* my_shared(PyObject* self, PyObject* args, PyObject* kwargs) {
         free(env);
     }
     if(total_agent_count >= num_agents){
+        // The last map only gets the agents left in the budget
+        agent_counts[env_count - 1] -= total_agent_count - num_agents;
         total_agent_count = num_agents;
     }
-    PyObject* final_total_agent_count = PyLong_FromLong(total_agent_count);
-    PyList_SetItem(agent_offsets, env_count, final_total_agent_count);
-    PyObject* final_env_count = PyLong_FromLong(env_count);
-    // resize lists
-    PyObject* resized_agent_offsets = PyList_GetSlice(agent_offsets, 0, env_count + 1);
-    PyObject* resized_map_ids = PyList_GetSlice(map_ids, 0, env_count);
-    //
-    //Py_DECREF(agent_offsets);
-    //Py_DECREF(map_ids);
-    // create a tuple
+
+    // Packs of scenarios_per_env are balanced by predicted step cost. One
+    // scenario per env keeps the sampled order.
+    int* order = calloc(env_count > 0 ? env_count : 1, sizeof(int));
+    if (per_env > 1) {
+        float* cost = calloc(env_count, sizeof(float));
+        for (int i = 0; i < env_count; i++) {
+            cost[i] = predicted_step_cost(agent_counts[i], object_counts[i], road_points[i]);
+        }
+        balance_packs(cost, env_count, per_env, order);
+        free(cost);
+    } else {
+        for (int i = 0; i < env_count; i++) order[i] = i;
+    }
+    PyObject* agent_offsets = PyList_New(env_count + 1);
+    PyObject* map_ids = PyList_New(env_count);
+    int offset = 0;
+    for (int i = 0; i < env_count; i++) {
+        PyList_SetItem(map_ids, i, PyLong_FromLong(sampled_maps[order[i]]));
+        PyList_SetItem(agent_offsets, i, PyLong_FromLong(offset));
+        offset += agent_counts[order[i]];
+    }
+    PyList_SetItem(agent_offsets, env_count, PyLong_FromLong(total_agent_count));
+    free(order);
+    free(sampled_maps);
+    free(agent_counts);
+    free(object_counts);
+    free(road_points);
+
     PyObject* tuple = PyTuple_New(3);
-    PyTuple_SetItem(tuple, 0, resized_agent_offsets);
-    PyTuple_SetItem(tuple, 1, resized_map_ids);
-    PyTuple_SetItem(tuple, 2, final_env_count);
+    PyTuple_SetItem(tuple, 0, agent_offsets);
+    PyTuple_SetItem(tuple, 1, map_ids);
+    PyTuple_SetItem(tuple, 2, PyLong_FromLong(env_count));
     return tuple;
+}
+
+// Reads the int at index i of a list kwarg, -1 with an exception set on failure
+static int list_int(PyObject* kwargs, const char* key, Py_ssize_t i, Py_ssize_t n) {
+    PyObject* list = PyDict_GetItemString(kwargs, key);
+    if (!list || !PyList_Check(list) || PyList_Size(list) != n) {
+        PyErr_Format(PyExc_ValueError, "%s must be a list with one entry per scenario", key);
+        return -1;
+    }
+    int value = (int)PyLong_AsLong(PyList_GetItem(list, i));
+    return PyErr_Occurred() ? -1 : value;
+}
 
-    //Py_DECREF(num);
-    /*
-    for(int i = 0;i<num_envs; i++) {
-        for(int j=0;j<temp_envs[i].num_entities;j++) {
-            free_entity(&temp_envs[i].entities[j]);
+// Packs one scenario per entry of map_ids into env. scenario_agents and
+// scenario_seeds give each scenario's agent budget and selection seed.
+static int init_packed(Env* env, PyObject* kwargs, PyObject* map_ids) {
+    if (!PyList_Check(map_ids) || PyList_Size(map_ids) < 1) {
+        PyErr_SetString(PyExc_ValueError, "map_ids must be a non-empty list");
+        return -1;
+    }
+    Py_ssize_t n = PyList_Size(map_ids);
+    char** map_names = calloc(n, sizeof(char*));
+    int* max_agents = calloc(n, sizeof(int));
+    int* seeds = calloc(n, sizeof(int));
+    int ok = 1;
+    for (Py_ssize_t s = 0; s < n && ok; s++) {
+        int map_id = (int)PyLong_AsLong(PyList_GetItem(map_ids, s));
+        max_agents[s] = list_int(kwargs, "scenario_agents", s, n);
+        seeds[s] = list_int(kwargs, "scenario_seeds", s, n);
+        if (PyErr_Occurred()) {
+            ok = 0;
+            break;
         }
-        free(temp_envs[i].entities);
-        free(temp_envs[i].active_agent_indices);
-        free(temp_envs[i].static_car_indices);
+        char map_file[100];
+        sprintf(map_file, "resources/drive/binaries/map_%03d.bin", map_id);
+        map_names[s] = strdup(map_file);
     }
-    free(temp_envs);
-    */
-    // return agent_offsets;
+    if (ok) {
+        init_scenarios(env, map_names, max_agents, seeds, (int)n);
+    }
+    for (Py_ssize_t s = 0; s < n; s++) {
+        free(map_names[s]);
+    }
+    free(map_names);
+    free(max_agents);
+    free(seeds);
+    return ok ? 0 : -1;
 }
 
-static int my_init(Env* env, PyObject* args, PyObject* kwargs) {
+// Reads the map-independent configuration (ini file, kwarg overrides, agent
+// selection) into env. Shared by my_init and vec_build.
+static int parse_config(Env* env, PyObject* kwargs) {
     env->human_agent_idx = unpack(kwargs, "human_agent_idx");
     env->ini_file = unpack_str(kwargs, "ini_file");
     env_init_config conf = {0};
@@ -165,11 +920,108 @@ static int my_init(Env* env, PyObject* args, PyObject* kwargs) {
     if (kwargs && PyDict_GetItemString(kwargs, "scenario_length")) {
         conf.scenario_length = (int)unpack(kwargs, "scenario_length");
     }
+    if (kwargs && PyDict_GetItemString(kwargs, "event_buffer_size")) {
+        conf.event_buffer_size = (int)unpack(kwargs, "event_buffer_size");
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "action_type")) {
+        conf.action_type = (int)unpack(kwargs, "action_type");
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "dynamics_model")) {
+        conf.dynamics_model = (int)unpack(kwargs, "dynamics_model");
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "action_repeat")) {
+        conf.action_repeat = (int)unpack(kwargs, "action_repeat");
+    }
+    if (conf.action_repeat == 0) {
+        conf.action_repeat = 1;
+    }
+    if (conf.action_repeat < 1) {
+        PyErr_SetString(PyExc_ValueError, "action_repeat must be >= 1");
+        return -1;
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "async_episodes")) {
+        conf.async_episodes = (int)unpack(kwargs, "async_episodes");
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "reset_cache")) {
+        conf.reset_cache = (int)unpack(kwargs, "reset_cache");
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "obs_header")) {
+        conf.obs_header = (int)unpack(kwargs, "obs_header");
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "obs_dtype")) {
+        conf.obs_dtype = (int)unpack(kwargs, "obs_dtype");
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "obs_layout")) {
+        conf.obs_layout = (int)unpack(kwargs, "obs_layout");
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "max_partners")) {
+        conf.max_partners = (int)unpack(kwargs, "max_partners");
+    }
+    if (conf.max_partners == 0) {
+        conf.max_partners = MAX_PARTNER_OBSERVATIONS;
+    }
+    if (conf.max_partners < 1 || conf.max_partners > MAX_PARTNER_OBSERVATIONS) {
+        PyErr_SetString(PyExc_ValueError, "max_partners must be between 1 and 63");
+        return -1;
+    }
+    if (kwargs && PyDict_GetItemString(kwargs, "max_roads")) {
+        conf.max_roads = (int)unpack(kwargs, "max_roads");
+    }
+    if (conf.max_roads == 0) {
+        conf.max_roads = MAX_ROAD_SEGMENT_OBSERVATIONS;
+    }
+    if (conf.max_roads < 1 || conf.max_roads > MAX_ROAD_SEGMENT_OBSERVATIONS) {
+        PyErr_SetString(PyExc_ValueError, "max_roads must be between 1 and 200");
+        return -1;
+    }
+    if (conf.obs_layout != OBS_LAYOUT_FLAT && conf.obs_layout != OBS_LAYOUT_STRUCTURED) {
+        PyErr_SetString(PyExc_ValueError, "obs_layout must be flat or structured");
+        return -1;
+    }
+    if (conf.obs_dtype < OBS_FLOAT32 || conf.obs_dtype > OBS_INT8) {
+        PyErr_SetString(PyExc_ValueError, "obs_dtype must be float32, float16, bfloat16 or int8");
+        return -1;
+    }
+    if (conf.obs_dtype == OBS_INT8 && conf.obs_header) {
+        PyErr_SetString(PyExc_ValueError, "obs_header counts do not fit in int8 observations");
+        return -1;
+    }
+    // Optional per-agent mask buffer, written on every step and reset
+    PyObject* mask_obj = kwargs ? PyDict_GetItemString(kwargs, "masks") : NULL;
+    if (mask_obj && mask_obj != Py_None) {
+        if (!PyObject_TypeCheck(mask_obj, &PyArray_Type)) {
+            PyErr_SetString(PyExc_TypeError, "Masks must be a NumPy array");
+            return -1;
+        }
+        PyArrayObject* masks = (PyArrayObject*)mask_obj;
+        if (!PyArray_ISCONTIGUOUS(masks) || PyArray_NDIM(masks) != 1 || PyArray_ITEMSIZE(masks) != 1) {
+            PyErr_SetString(PyExc_ValueError, "Masks must be a contiguous 1D bool array");
+            return -1;
+        }
+        env->masks = PyArray_DATA(masks);
+    }
+    if (conf.dynamics_model < CLASSIC || conf.dynamics_model > STATE_DYNAMICS) {
+        PyErr_SetString(PyExc_ValueError, "dynamics_model must be classic, invertible_bicycle, delta_local or state");
+        return -1;
+    }
+    if (conf.action_type == 0 && (conf.dynamics_model == DELTA_LOCAL || conf.dynamics_model == STATE_DYNAMICS)) {
+        PyErr_SetString(PyExc_ValueError, "delta_local and state dynamics require continuous actions");
+        return -1;
+    }
     if (conf.scenario_length <= 0) {
         PyErr_SetString(PyExc_ValueError, "scenario_length must be > 0 (set in INI or kwargs)");
         return -1;
     }
     env->action_type = conf.action_type;
+    env->dynamics_model = conf.dynamics_model;
+    env->action_repeat = conf.action_repeat;
+    env->async_episodes = conf.async_episodes;
+    env->reset_cache = conf.reset_cache;
+    env->obs_header = conf.obs_header;
+    env->obs_dtype = conf.obs_dtype;
+    env->obs_layout = conf.obs_layout;
+    env->max_partners = conf.max_partners;
+    env->max_roads = conf.max_roads;
     env->reward_vehicle_collision = conf.reward_vehicle_collision;
     env->reward_offroad_collision = conf.reward_offroad_collision;
     env->reward_goal = conf.reward_goal;
@@ -178,20 +1030,33 @@ static int my_init(Env* env, PyObject* args, PyObject* kwargs) {
     env->goal_radius = conf.goal_radius;
     env->scenario_length = conf.scenario_length;
     env->use_goal_generation = conf.use_goal_generation;
+    env->event_capacity = conf.event_buffer_size > 0 ? conf.event_buffer_size : 0;
     env->policy_agents_per_env = unpack(kwargs, "num_policy_controlled_agents");
     env->control_all_agents = unpack(kwargs, "control_all_agents");
     env->deterministic_agent_selection = unpack(kwargs, "deterministic_agent_selection");
     env->control_non_vehicles = (int)unpack(kwargs, "control_non_vehicles");
+    int init_steps = unpack(kwargs, "init_steps");
+    env->init_steps = init_steps;
+    env->timestep = init_steps;
+    return PyErr_Occurred() ? -1 : 0;
+}
+
+static int my_init(Env* env, PyObject* args, PyObject* kwargs) {
+    if (parse_config(env, kwargs) != 0) {
+        return -1;
+    }
+    PyObject* packed = PyDict_GetItemString(kwargs, "map_ids");
+    if (packed && packed != Py_None) {
+        return init_packed(env, kwargs, packed);
+    }
     int map_id = unpack(kwargs, "map_id");
     int max_agents = unpack(kwargs, "max_agents");
-    int init_steps = unpack(kwargs, "init_steps");
     char map_file[100];
     sprintf(map_file, "resources/drive/binaries/map_%03d.bin", map_id);
     env->num_agents = max_agents;
     env->map_name = strdup(map_file);
-    env->init_steps = init_steps;
-    env->timestep = init_steps;
     init(env);
+    init_obs_codec(env);
     return 0;
 }
 
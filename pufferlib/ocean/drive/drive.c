@@ -4,7 +4,7 @@
 // Use this test if the network changes to ensure that the forward pass
 // matches the torch implementation to the 3rd or ideally 4th decimal place
 void test_drivenet() {
-    int num_obs = 1848;
+    int num_obs = 7 + 7*MAX_PARTNER_OBSERVATIONS + 7*MAX_ROAD_SEGMENT_OBSERVATIONS;
     int num_actions = 2;
     int num_agents = 4;
 
@@ -17,7 +17,7 @@ void test_drivenet() {
 
     //Weights* weights = load_weights("resources/drive/puffer_drive_weights.bin");
     Weights* weights = load_weights("puffer_drive_weights.bin");
-    DriveNet* net = init_drivenet(weights, num_agents);
+    DriveNet* net = init_drivenet(weights, num_agents, OBS_LAYOUT_FLAT, 0, MAX_PARTNER_OBSERVATIONS, MAX_ROAD_SEGMENT_OBSERVATIONS);
 
     forward(net, observations, actions);
     for (int i = 0; i < num_agents*num_actions; i++) {
@@ -45,7 +45,7 @@ void demo() {
     c_reset(&env);
     c_render(&env);
     Weights* weights = load_weights("resources/drive/puffer_drive_weights.bin");
-    DriveNet* net = init_drivenet(weights, env.active_agent_count);
+    DriveNet* net = init_drivenet(weights, env.active_agent_count, env.obs_layout, env.obs_header, env.max_partners, env.max_roads);
     //Client* client = make_client(&env);
     int accel_delta = 2;
     int steer_delta = 4;
@@ -118,12 +118,14 @@ void performance_test() {
     long start = time(NULL);
     int i = 0;
     int (*actions)[2] = (int(*)[2])env.actions;
+    DriveRNG rng;
+    rng_seed(&rng, (uint64_t)start, 0);
 
     while (time(NULL) - start < test_time) {
         // Set random actions for all agents
         for(int j = 0; j < env.active_agent_count; j++) {
-            int accel = rand() % 7;
-            int steer = rand() % 13;
+            int accel = rng_int(&rng, 7);
+            int steer = rng_int(&rng, 13);
             actions[j][0] = accel;  // -1, 0, or 1
             actions[j][1] = steer;  // Random steering
         }
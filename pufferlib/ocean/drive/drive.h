@@ -6,11 +6,13 @@
 #include <math.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
 #include "raylib.h"
 #include "raymath.h"
 #include "rlgl.h"
 #include <time.h>
 #include "error.h"
+#include "dynamics.h"
 
 
 
@@ -40,6 +42,8 @@
 #define INVERTIBLE_BICYLE 1
 #define DELTA_LOCAL 2
 #define STATE_DYNAMICS 3
+// Continuous action dimensions: (accel, steering), (accel, steering), (dx, dy, dyaw), (x, y, heading, vx, vy)
+static const int DYNAMICS_ACTION_DIMS[4] = {2, 2, 3, 5};
 
 // collision state
 #define NO_COLLISION 0
@@ -57,9 +61,32 @@
 #define GRID_CELL_SIZE 5.0f
 #define MAX_ENTITIES_PER_CELL 30    // Depends on resolution of data Formula: 3 * (2 + GRID_CELL_SIZE*sqrt(2)/resolution) => For each entity type in gridmap, diagonal poly-lines -> sqrt(2), include diagonal ends -> 2
 
-// Max road segment observation entities
+// Max road segment observation entities, the default and upper bound of max_roads
 #define MAX_ROAD_SEGMENT_OBSERVATIONS 200
-#define MAX_AGENTS 64
+// Max partner observation slots, the default and upper bound of max_partners
+#define MAX_PARTNER_OBSERVATIONS 63
+#define OBS_HEADER_SIZE 2  // optional [partners written, roads written] prefix of each obs row
+
+// Road slot layout. FLAT stores the road type as one float, STRUCTURED expands
+// it in place to a one-hot over the NUM_ROAD_TYPES types (ROAD_LANE..DRIVEWAY),
+// which is the 13-feature input the road encoders consume.
+#define OBS_LAYOUT_FLAT 0
+#define OBS_LAYOUT_STRUCTURED 1
+#define NUM_ROAD_TYPES 7
+#define ROAD_FEATURES_FLAT 7
+#define ROAD_FEATURES_ONEHOT (6 + NUM_ROAD_TYPES)
+
+// Element type of the observation buffer handed to the trainer
+#define OBS_FLOAT32 0
+#define OBS_FLOAT16 1
+#define OBS_BFLOAT16 2
+#define OBS_INT8 3
+
+// int8 observations store round(x * 127 / range), clamped to [-127, 127]. The
+// ranges bound each feature after the normalisation in compute_observations.
+static const float OBS_INT8_EGO_RANGE[7] = {4.0f, 4.0f, 2.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+static const float OBS_INT8_PARTNER_RANGE[7] = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+static const float OBS_INT8_ROAD_RANGE[7] = {2.0f, 2.0f, 1.0f, 1.0f, 1.0f, 1.0f, 127.0f}; // road type stays an exact integer
 // Observation Space Constants
 #define MAX_SPEED 100.0f
 #define MAX_VEH_LEN 30.0f
@@ -75,6 +102,13 @@
 #define MAX_ROAD_SCALE 100.0f
 #define MAX_ROAD_SEGMENT_LENGTH 100.0f
 
+// Continuous action bounds (drive.py declares the same action spaces)
+#define MAX_CONTINUOUS_ACCEL 1.0f
+#define MAX_CONTINUOUS_STEERING 1.0f
+#define DELTA_LOCAL_MAX_DX (MAX_SPEED * 0.1f)
+#define DELTA_LOCAL_MAX_DY 1.0f
+#define DELTA_LOCAL_MAX_DYAW 0.5f
+
 // Acceleration Values
 static const float ACCELERATION_VALUES[7] = {-4.0000f, -2.6670f, -1.3330f, -0.0000f,  1.3330f,  2.6670f,  4.0000f};
 // static const float STEERING_VALUES[13] = {-3.1420f, -2.6180f, -2.0940f, -1.5710f, -1.0470f, -0.5240f,  0.0000f,  0.5240f,
@@ -103,6 +137,40 @@ typedef struct Log Log;
 typedef struct Graph Graph;
 typedef struct AdjListNode AdjListNode;
 
+// PCG32 (O'Neill). Each Drive owns one so sampling never touches the global
+// rand() state and rollouts are reproducible regardless of thread count.
+typedef struct DriveRNG DriveRNG;
+struct DriveRNG {
+    uint64_t state;
+    uint64_t inc;
+};
+
+static inline uint32_t rng_next(DriveRNG* rng) {
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ULL + rng->inc;
+    uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = (uint32_t)(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+static inline void rng_seed(DriveRNG* rng, uint64_t seed, uint64_t stream) {
+    rng->state = 0;
+    rng->inc = (stream << 1u) | 1u;
+    rng_next(rng);
+    rng->state += seed;
+    rng_next(rng);
+}
+
+// Uniform integer in [0, n) via Lemire's multiply-shift
+static inline int rng_int(DriveRNG* rng, int n) {
+    return (int)(((uint64_t)rng_next(rng) * (uint64_t)n) >> 32);
+}
+
+// Uniform float in [0, 1)
+static inline float rng_float(DriveRNG* rng) {
+    return (rng_next(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
 struct Log {
     float episode_return;
     float episode_length;
@@ -122,8 +190,23 @@ struct Log {
     float avg_collisions_per_agent;
 };
 
+// A collision or offroad event recorded during c_step. `other` is the entity
+// index of the vehicle that was hit, or of the road edge that was crossed.
+typedef struct DriveEvent DriveEvent;
+struct DriveEvent {
+    int timestep;
+    int agent;      // active agent slot (observation row within the env)
+    int other;
+    int type;       // VEHICLE_COLLISION or OFFROAD
+    float x;
+    float y;
+};
+
+// Static per-entity data loaded from the map binary. Immutable once init() has
+// finished; everything that changes during an episode lives in SimState/AgentState.
 typedef struct Entity Entity;
 struct Entity {
+    int id;         // position in the map binary, stable across order_objects_by_role
     int type;
     int array_size;
     float* traj_x;
@@ -137,37 +220,115 @@ struct Entity {
     float width;
     float length;
     float height;
-    float goal_position_x;
+    float goal_position_x;  // logged goal, the agent's current goal is in AgentState
     float goal_position_y;
     float goal_position_z;
-    float init_goal_x;
-    float init_goal_y;
     int mark_as_expert;
-    int collision_state;
+    int active_agent;
+};
+
+// Per-step kinematic state of the objects (vehicles, pedestrians, cyclists), one
+// array per field, indexed by entity index. init() orders the objects so that
+// active agents occupy [0, active_agent_count) followed by the static cars, so
+// the per-agent loops walk contiguous memory.
+typedef struct SimState SimState;
+struct SimState {
+    float* x;
+    float* y;
+    float* z;
+    float* vx;
+    float* vy;
+    float* vz;
+    float* heading;
+    float* heading_x;
+    float* heading_y;
+    int* collision_state;
+    int* respawn_timestep;
+    int* done;      // agent finished its episode early (async_episodes), frozen until reset
+    int capacity;   // length of each array, rounded up to a multiple of SIM_STATE_ALIGN
+    void* data;     // single allocation backing all the arrays above
+};
+
+#define SIM_STATE_ALIGN 8
+#define SIM_STATE_FIELDS 12
+
+// Per-episode bookkeeping of the objects, touched about once per agent per step
+typedef struct AgentState AgentState;
+struct AgentState {
+    float goal_position_x;
+    float goal_position_y;
     float metrics_array[5]; // metrics_array: [collision, offroad, reached_goal, lane_aligned, avg_displacement_error]
-    float x;
-    float y;
-    float z;
-    float vx;
-    float vy;
-    float vz;
-    float heading;
-    float heading_x;
-    float heading_y;
     int current_lane_idx;
     int valid;
-    int respawn_timestep;
     int respawn_count;
     int collided_before_goal;
     int sampled_new_goal;
     int reached_goal_this_episode;
-    int num_goals_reached;
-    int active_agent;
     float cumulative_displacement;
     int displacement_sample_count;
-    float goal_radius;
 };
 
+// Expert (static) car motion precomputed from the logs at init. Step k covers
+// timestep first_step + k: entries [offsets[k], offsets[k+1]) hold the experts
+// that are on their log at that timestep together with the state to write, and
+// [expire_offsets[k], expire_offsets[k+1]) the experts that leave their log then
+// and are parked at INVALID_POSITION for the rest of the episode.
+#define EXPERT_REPLAY_FIELDS 8
+typedef struct ExpertReplay ExpertReplay;
+struct ExpertReplay {
+    int first_step;
+    int num_steps;
+    int* offsets;
+    int* entity;
+    float* x;
+    float* y;
+    float* z;
+    float* heading;
+    float* heading_x;
+    float* heading_y;
+    float* vx;
+    float* vy;
+    int* expire_offsets;
+    int* expire_entity;
+    float* data;    // single allocation backing the per-entry float arrays
+};
+
+void alloc_sim_state(SimState* sim, int num_objects) {
+    int capacity = (num_objects + SIM_STATE_ALIGN - 1) / SIM_STATE_ALIGN * SIM_STATE_ALIGN;
+    if (capacity == 0) capacity = SIM_STATE_ALIGN;
+    // Every field is 4 bytes wide, so all arrays can share one block
+    float* data = (float*)calloc((size_t)SIM_STATE_FIELDS * capacity, sizeof(float));
+    sim->capacity = capacity;
+    sim->data = data;
+    sim->x = data + 0*capacity;
+    sim->y = data + 1*capacity;
+    sim->z = data + 2*capacity;
+    sim->vx = data + 3*capacity;
+    sim->vy = data + 4*capacity;
+    sim->vz = data + 5*capacity;
+    sim->heading = data + 6*capacity;
+    sim->heading_x = data + 7*capacity;
+    sim->heading_y = data + 8*capacity;
+    sim->collision_state = (int*)(data + 9*capacity);
+    sim->respawn_timestep = (int*)(data + 10*capacity);
+    sim->done = (int*)(data + 11*capacity);
+}
+
+void free_sim_state(SimState* sim) {
+    free(sim->data);
+    memset(sim, 0, sizeof(SimState));
+}
+
+// Zeroes the state for num_objects, reallocating only when it does not fit
+void reserve_sim_state(SimState* sim, int num_objects) {
+    if (sim->data && num_objects <= sim->capacity) {
+        memset(sim->data, 0, (size_t)SIM_STATE_FIELDS*sim->capacity*sizeof(float));
+        return;
+    }
+    free_sim_state(sim);
+    alloc_sim_state(sim, num_objects);
+}
+
 void free_entity(Entity* entity){
     // free trajectory arrays
     free(entity->traj_x);
@@ -192,33 +353,6 @@ float relative_distance_2d(float x1, float y1, float x2, float y2){
     return distance;
 }
 
-float compute_displacement_error(Entity* agent, int timestep) {
-    // Check if timestep is within valid range
-    if (timestep < 0 || timestep >= agent->array_size) {
-        return 0.0f;
-    }
-
-    // Check if reference trajectory is valid at this timestep
-    if (!agent->traj_valid[timestep]) {
-        return 0.0f;
-    }
-
-    // Get reference position at current timestep, skip invalid ones
-    float ref_x = agent->traj_x[timestep];
-    float ref_y = agent->traj_y[timestep];
-
-    if (ref_x == INVALID_POSITION || ref_y == INVALID_POSITION) {
-        return 0.0f;
-    }
-
-    // Compute deltas: Euclidean distance between actual and reference position
-    float dx = agent->x - ref_x;
-    float dy = agent->y - ref_y;
-    float displacement = sqrtf(dx*dx + dy*dy);
-
-    return displacement;
-}
-
 typedef struct GridMapEntity GridMapEntity;
 struct GridMapEntity {
     int entity_idx;
@@ -244,6 +378,45 @@ struct GridMap {
     GridMapEntity** neighbor_cache_entities; // preallocated array to hold neighbor entities
 };
 
+// Controllable agents bucketed by position, rebuilt whenever they move so the
+// collision and partner loops only visit nearby cells. Slots follow the order
+// active agents, then static cars (see agent_slot_index).
+#define AGENT_GRID_CELL_SIZE 15.0f
+
+typedef struct AgentGrid AgentGrid;
+struct AgentGrid {
+    float origin_x;
+    float origin_y;
+    int cols;
+    int rows;
+    int* cell_start;    // cols*rows + 1 offsets into slots
+    int* slots;         // agent slots sorted by cell, ascending within a cell
+    int* slot_cell;     // cell of each slot from the last build
+};
+
+// State c_reset leaves behind, which only depends on the map and agent set.
+// Recorded by the first reset of a map and copied back by later ones.
+typedef struct ResetState ResetState;
+struct ResetState {
+    int valid;
+    void* sim;                  // SimState block
+    AgentState* agent_states;
+    float* observations;        // float rows (the scratch for reduced obs_dtype)
+    void* obs_out;              // encoded rows, reduced obs_dtype only
+    int* obs_partner_count;
+    int* obs_road_count;
+};
+
+void free_reset_state(ResetState* state) {
+    free(state->sim);
+    free(state->agent_states);
+    free(state->observations);
+    free(state->obs_out);
+    free(state->obs_partner_count);
+    free(state->obs_road_count);
+    memset(state, 0, sizeof(ResetState));
+}
+
 struct Drive {
     Client* client;
     float* observations;
@@ -270,8 +443,22 @@ struct Drive {
     int timestep;
     int init_steps;
     int dynamics_model;
+    int action_repeat;      // physics substeps per c_step; obs are computed once at the end
+    int async_episodes;     // agents terminate individually on collision, offroad or goal
+    int done_count;         // active agents finished since the last reset
+    unsigned char* masks;   // optional, 0 for agents that finished on an earlier step
+    int obs_header;         // 1 to prefix each obs row with OBS_HEADER_SIZE populated counts
+    int obs_layout;         // OBS_LAYOUT_*
+    int max_partners;       // K nearest partners observed, at most MAX_PARTNER_OBSERVATIONS
+    int max_roads;          // road slots observed, at most MAX_ROAD_SEGMENT_OBSERVATIONS
+    int* obs_partner_count; // partner slots written per agent by the last compute_observations
+    int* obs_road_count;    // road slots written per agent, only these are cleared on the next call
+    int obs_dtype;          // OBS_*; for anything but OBS_FLOAT32, observations is float scratch
+    void* obs_out;          // caller's buffer the scratch rows are encoded into, NULL for OBS_FLOAT32
+    float* obs_inv_scale;   // per-feature 127 / range for OBS_INT8
     GridMap* grid_map;
     int* neighbor_offsets;
+    AgentGrid agent_grid;
     float reward_vehicle_collision;
     float reward_offroad_collision;
     float reward_ade;
@@ -285,25 +472,205 @@ struct Drive {
     int deterministic_agent_selection;
     int policy_agents_per_env;
     int logs_capacity;
+    int agent_capacity;     // rows allocated in logs, the obs counts and the obs scratch
     int use_goal_generation;
     char* ini_file;
     int scenario_length;
     int control_non_vehicles;
+    DriveRNG rng;
+    SimState sim;
+    AgentState* agent_states;
+    ExpertReplay expert_replay;
+    BicycleBatch bicycle;   // decoded actions for [0, active_agent_count), bicycle models
+    float steering_yaw_factor[13];  // per-action tables for discrete steering
+    float steering_tan[13];
+    float steering_cos_beta[13];
+    float steering_sin_beta[13];
+    DriveEvent* events;     // ring buffer, NULL when event recording is disabled
+    int event_capacity;
+    int64_t event_count;    // total events written; next write goes to event_count % event_capacity
+    int num_scenarios;      // > 0 for a packed host whose scenarios step on slices of its buffers
+    Drive* scenarios;
+    int* map_refs;          // Drives sharing this map data (see clone_drive), NULL while unshared
+    int reset_cache;        // 1 to restore resets from reset_state instead of recomputing them
+    ResetState reset_state;
 };
 
+// Floats per road slot
+static inline int road_features(Drive* env) {
+    return env->obs_layout == OBS_LAYOUT_STRUCTURED ? ROAD_FEATURES_ONEHOT : ROAD_FEATURES_FLAT;
+}
+
+// Offset of the road block within a row, after the header
+static inline int obs_road_offset(Drive* env) {
+    return 7 + 7*env->max_partners;
+}
+
+// Floats per agent in env->observations
+static inline int obs_size(Drive* env) {
+    return (env->obs_header ? OBS_HEADER_SIZE : 0) + obs_road_offset(env) + road_features(env)*env->max_roads;
+}
+
+// Road type index (entity type - ROAD_LANE) of an observed road slot
+static inline int obs_road_type(Drive* env, const float* slot) {
+    if (env->obs_layout != OBS_LAYOUT_STRUCTURED) return (int)slot[6];
+    for (int k = 0; k < NUM_ROAD_TYPES; k++) {
+        if (slot[6 + k] != 0.0f) return k;
+    }
+    return 0;
+}
+
+// Round-to-nearest-even float -> IEEE half
+static inline uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+    x &= 0x7FFFFFFF;
+    if (x > 0x7F800000) return sign | 0x7E00;       // NaN
+    if (x >= 0x47800000) return sign | 0x7C00;      // overflow and inf
+    if (x < 0x38800000) {
+        // Subnormal: let the FPU round by adding 0.5, which aligns the half ulp to bit 0
+        float a;
+        memcpy(&a, &x, sizeof(a));
+        a += 0.5f;
+        uint32_t r;
+        memcpy(&r, &a, sizeof(r));
+        return sign | (uint16_t)(r - 0x3F000000);
+    }
+    x += 0xC8000FFF + ((x >> 13) & 1);              // rebias exponent, round to nearest even
+    return sign | (uint16_t)(x >> 13);
+}
+
+// Round-to-nearest-even float -> bfloat16
+static inline uint16_t float_to_bfloat16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7FFFFFFF) > 0x7F800000) return (uint16_t)((x >> 16) | 0x40);
+    x += 0x7FFF + ((x >> 16) & 1);
+    return (uint16_t)(x >> 16);
+}
+
+static inline int8_t quantize_int8(float f, float inv_scale) {
+    float q = rintf(f * inv_scale);
+    if (q > 127.0f) q = 127.0f;
+    if (q < -127.0f) q = -127.0f;
+    return (int8_t)q;
+}
+
+// For reduced precision output, moves the caller's buffer to obs_out and gives
+// compute_observations a float scratch buffer of the same shape instead
+void init_obs_codec(Drive* env) {
+    if (env->obs_dtype == OBS_FLOAT32) return;
+    int max_obs = obs_size(env);
+    env->obs_out = env->observations;
+    env->observations = (float*)calloc((size_t)env->active_agent_count*max_obs, sizeof(float));
+    if (env->obs_dtype != OBS_INT8) return;
+    int header = env->obs_header ? OBS_HEADER_SIZE : 0;
+    env->obs_inv_scale = (float*)malloc(max_obs*sizeof(float));
+    for (int k = 0; k < header; k++) env->obs_inv_scale[k] = 1.0f;
+    float* scale = env->obs_inv_scale + header;
+    for (int k = 0; k < 7; k++) scale[k] = 127.0f / OBS_INT8_EGO_RANGE[k];
+    int road_offset = obs_road_offset(env);
+    for (int k = 7; k < road_offset; k++) scale[k] = 127.0f / OBS_INT8_PARTNER_RANGE[(k - 7) % 7];
+    int road_dim = road_features(env);
+    for (int k = 0; k < road_dim*env->max_roads; k++) {
+        int feature = k % road_dim;
+        float range = road_dim == ROAD_FEATURES_FLAT || feature < 6 ? OBS_INT8_ROAD_RANGE[feature] : 1.0f;
+        scale[road_offset + k] = 127.0f / range;
+    }
+}
+
+// Copies floats [offset, offset + n) of scratch row i into the output buffer
+static void encode_obs_span(Drive* env, int i, int offset, int n) {
+    if (env->obs_out == NULL || n <= 0) return;
+    size_t start = (size_t)i*obs_size(env) + offset;
+    const float* src = env->observations + start;
+    if (env->obs_dtype == OBS_FLOAT16) {
+        uint16_t* dst = (uint16_t*)env->obs_out + start;
+        for (int k = 0; k < n; k++) dst[k] = float_to_half(src[k]);
+    } else if (env->obs_dtype == OBS_BFLOAT16) {
+        uint16_t* dst = (uint16_t*)env->obs_out + start;
+        for (int k = 0; k < n; k++) dst[k] = float_to_bfloat16(src[k]);
+    } else if (env->obs_dtype == OBS_INT8) {
+        int8_t* dst = (int8_t*)env->obs_out + start;
+        const float* inv_scale = env->obs_inv_scale + offset;
+        for (int k = 0; k < n; k++) dst[k] = quantize_int8(src[k], inv_scale[k]);
+    }
+}
+
+// Encodes the parts of row i that changed: header, ego, and the first
+// partner_slots / road_slots slots of each block
+static void encode_obs_row(Drive* env, int i, int partner_slots, int road_slots) {
+    int header = env->obs_header ? OBS_HEADER_SIZE : 0;
+    encode_obs_span(env, i, 0, header + 7);
+    encode_obs_span(env, i, header + 7, partner_slots*7);
+    encode_obs_span(env, i, header + obs_road_offset(env), road_slots*road_features(env));
+}
+
+// Rows are cleared incrementally, so the counts have to describe what is in the
+// buffer. Call this whenever its contents are unknown (new buffer, reset).
+void invalidate_obs_counts(Drive* env) {
+    if (env->num_scenarios > 0) {
+        for (int s = 0; s < env->num_scenarios; s++) invalidate_obs_counts(&env->scenarios[s]);
+        return;
+    }
+    for(int i = 0; i < env->active_agent_count; i++) {
+        env->obs_partner_count[i] = env->max_partners;
+        env->obs_road_count[i] = env->max_roads;
+    }
+}
+
+float compute_displacement_error(Drive* env, int agent_idx, int timestep) {
+    Entity* agent = &env->entities[agent_idx];
+    // Check if timestep is within valid range
+    if (timestep < 0 || timestep >= agent->array_size) {
+        return 0.0f;
+    }
+
+    // Check if reference trajectory is valid at this timestep
+    if (!agent->traj_valid[timestep]) {
+        return 0.0f;
+    }
+
+    // Get reference position at current timestep, skip invalid ones
+    float ref_x = agent->traj_x[timestep];
+    float ref_y = agent->traj_y[timestep];
+
+    if (ref_x == INVALID_POSITION || ref_y == INVALID_POSITION) {
+        return 0.0f;
+    }
+
+    // Compute deltas: Euclidean distance between actual and reference position
+    float dx = env->sim.x[agent_idx] - ref_x;
+    float dy = env->sim.y[agent_idx] - ref_y;
+    float displacement = sqrtf(dx*dx + dy*dy);
+
+    return displacement;
+}
+
+// Each bucket can hold every object of the map, so no vehicle is dropped
 typedef struct {
-    int candidates[MAX_AGENTS];
+    int* candidates;
     int candidates_count;
-    int forced_experts[MAX_AGENTS];
+    int* forced_experts;
     int forced_experts_count;
-    int statics[MAX_AGENTS];
+    int* statics;
     int statics_count;
 } SelectionBuckets;
 
-static inline void push_capped(int* arr, int* count, int val, int cap) {
-    if (*count < cap) {
-        arr[(*count)++] = val;
-    }
+static void alloc_selection_buckets(SelectionBuckets* b, int capacity) {
+    int* data = (int*)malloc(3 * (capacity > 0 ? capacity : 1) * sizeof(int));
+    b->candidates = data;
+    b->forced_experts = data + capacity;
+    b->statics = data + 2*capacity;
+    b->candidates_count = 0;
+    b->forced_experts_count = 0;
+    b->statics_count = 0;
+}
+
+static void free_selection_buckets(SelectionBuckets* b) {
+    free(b->candidates);
+    memset(b, 0, sizeof(SelectionBuckets));
 }
 
 static inline float ego_goal_distance_t0(const Entity* e) {
@@ -323,9 +690,9 @@ static inline int vehicle_eligible_t0(const Entity* e) {
     return dist >= 2.0f;
 }
 
-static inline void fisher_yates_shuffle(int* arr, int n) {
+static inline void fisher_yates_shuffle(DriveRNG* rng, int* arr, int n) {
     for (int i = n - 1; i > 0; --i) {
-        int j = rand() % (i + 1);
+        int j = rng_int(rng, i + 1);
         int tmp = arr[i];
         arr[i] = arr[j];
         arr[j] = tmp;
@@ -343,24 +710,24 @@ static void scan_vehicles_initial(const Drive* env, SelectionBuckets* out, int c
 
         int eligible = vehicle_eligible_t0(e);
         if (!eligible) {
-            push_capped(out->statics, &out->statics_count, i, MAX_AGENTS);
+            out->statics[out->statics_count++] = i;
             continue;
         }
 
         if (control_all_agents) {
-            push_capped(out->candidates, &out->candidates_count, i, MAX_AGENTS);
+            out->candidates[out->candidates_count++] = i;
         } else {
             if (e->mark_as_expert == 1) {
-                push_capped(out->forced_experts, &out->forced_experts_count, i, MAX_AGENTS);
+                out->forced_experts[out->forced_experts_count++] = i;
             } else {
-                push_capped(out->candidates, &out->candidates_count, i, MAX_AGENTS);
+                out->candidates[out->candidates_count++] = i;
             }
         }
     }
 }
 void add_log(Drive* env) {
     for(int i = 0; i < env->active_agent_count; i++){
-        Entity* e = &env->entities[env->active_agent_indices[i]];
+        AgentState* e = &env->agent_states[env->active_agent_indices[i]];
 
         if(e->reached_goal_this_episode){
             env->log.completion_rate += 1.0f;
@@ -468,6 +835,7 @@ Entity* load_map_binary(const char* filename, Drive* env) {
     Entity* entities = (Entity*)malloc(env->num_entities * sizeof(Entity));
     for (int i = 0; i < env->num_entities; i++) {
 	    // Read base entity data
+        entities[i].id = i;
         fread(&entities[i].type, sizeof(int), 1, file);
         fread(&entities[i].array_size, sizeof(int), 1, file);
         // Allocate arrays based on type
@@ -515,56 +883,50 @@ Entity* load_map_binary(const char* filename, Drive* env) {
 }
 
 void set_start_position(Drive* env){
-    //InitWindow(800, 600, "GPU Drive");
-    //BeginDrawing();
-    for(int i = 0; i < env->num_entities; i++){
-        int is_active = 0;
-        for(int j = 0; j < env->active_agent_count; j++){
-            if(env->active_agent_indices[j] == i){
-                is_active = 1;
-                break;
-            }
-        }
+    SimState* sim = &env->sim;
+    for(int i = 0; i < env->num_objects; i++){
+        // Active agents occupy the first slots, see order_objects_by_role
+        int is_active = i < env->active_agent_count;
         Entity* e = &env->entities[i];
+        AgentState* state = &env->agent_states[i];
 
         // Clamp init_steps to ensure we don't go out of bounds
         int step = env->init_steps;
         if (step >= e->array_size) step = e->array_size - 1;
         if (step < 0) step = 0;
 
-        e->x = e->traj_x[step];
-        e->y = e->traj_y[step];
-        e->z = e->traj_z[step];
+        sim->x[i] = e->traj_x[step];
+        sim->y[i] = e->traj_y[step];
+        sim->z[i] = e->traj_z[step];
 
         if(e->type > CYCLIST || e->type == 0){
             continue;
         }
         if(is_active == 0){
-            e->vx = 0;
-            e->vy = 0;
-            e->vz = 0;
-            e->collided_before_goal = 0;
+            sim->vx[i] = 0;
+            sim->vy[i] = 0;
+            sim->vz[i] = 0;
+            state->collided_before_goal = 0;
         } else {
-            e->vx = e->traj_vx[env->init_steps];
-            e->vy = e->traj_vy[env->init_steps];
-            e->vz = e->traj_vz[env->init_steps];
-        }
-        e->heading = e->traj_heading[env->init_steps];
-        e->heading_x = cosf(e->heading);
-        e->heading_y = sinf(e->heading);
-        e->valid = e->traj_valid[env->init_steps];
-        e->collision_state = 0;
-        e->metrics_array[COLLISION_IDX] = 0.0f; // vehicle collision
-        e->metrics_array[OFFROAD_IDX] = 0.0f; // offroad
-        e->metrics_array[REACHED_GOAL_IDX] = 0.0f; // reached goal
-        e->metrics_array[LANE_ALIGNED_IDX] = 0.0f; // lane aligned
-        e->metrics_array[AVG_DISPLACEMENT_ERROR_IDX] = 0.0f; // avg displacement error
-        e->cumulative_displacement = 0.0f;
-        e->displacement_sample_count = 0;
-        e->respawn_timestep = -1;
-        e->respawn_count = 0;
-    }
-    //EndDrawing();
+            sim->vx[i] = e->traj_vx[env->init_steps];
+            sim->vy[i] = e->traj_vy[env->init_steps];
+            sim->vz[i] = e->traj_vz[env->init_steps];
+        }
+        sim->heading[i] = e->traj_heading[env->init_steps];
+        sim->heading_x[i] = cosf(sim->heading[i]);
+        sim->heading_y[i] = sinf(sim->heading[i]);
+        state->valid = e->traj_valid[env->init_steps];
+        sim->collision_state[i] = 0;
+        state->metrics_array[COLLISION_IDX] = 0.0f; // vehicle collision
+        state->metrics_array[OFFROAD_IDX] = 0.0f; // offroad
+        state->metrics_array[REACHED_GOAL_IDX] = 0.0f; // reached goal
+        state->metrics_array[LANE_ALIGNED_IDX] = 0.0f; // lane aligned
+        state->metrics_array[AVG_DISPLACEMENT_ERROR_IDX] = 0.0f; // avg displacement error
+        state->cumulative_displacement = 0.0f;
+        state->displacement_sample_count = 0;
+        sim->respawn_timestep[i] = -1;
+        state->respawn_count = 0;
+    }
 }
 
 int getGridIndex(Drive* env, float x1, float y1) {
@@ -904,31 +1266,149 @@ void set_means(Drive* env) {
 
 void move_expert(Drive* env, float* actions, int agent_idx){
     Entity* agent = &env->entities[agent_idx];
+    SimState* sim = &env->sim;
     int t = env->timestep;
-    if (t < 0 || t >= agent->array_size) {
-        agent->x = INVALID_POSITION;
-        agent->y = INVALID_POSITION;
-        agent->z = 0.0f;
-        agent->heading = 0.0f;
-        agent->heading_x = 1.0f;
-        agent->heading_y = 0.0f;
+    if (t < 0 || t >= agent->array_size || (agent->traj_valid && agent->traj_valid[t] == 0)) {
+        sim->x[agent_idx] = INVALID_POSITION;
+        sim->y[agent_idx] = INVALID_POSITION;
+        sim->z[agent_idx] = 0.0f;
+        sim->heading[agent_idx] = 0.0f;
+        sim->heading_x[agent_idx] = 1.0f;
+        sim->heading_y[agent_idx] = 0.0f;
         return;
     }
-    if (agent->traj_valid && agent->traj_valid[t] == 0) {
-        agent->x = INVALID_POSITION;
-        agent->y = INVALID_POSITION;
-        agent->z = 0.0f;
-        agent->heading = 0.0f;
-        agent->heading_x = 1.0f;
-        agent->heading_y = 0.0f;
-        return;
+    sim->x[agent_idx] = agent->traj_x[t];
+    sim->y[agent_idx] = agent->traj_y[t];
+    sim->z[agent_idx] = agent->traj_z[t];
+    sim->heading[agent_idx] = agent->traj_heading[t];
+    sim->heading_x[agent_idx] = cosf(sim->heading[agent_idx]);
+    sim->heading_y[agent_idx] = sinf(sim->heading[agent_idx]);
+}
+
+// Builds the expert replay schedule for an episode starting at init_steps. An
+// expert is on its log from the start while its initial position is valid and
+// until the first timestep whose log entry is invalid, matching move_expert.
+void init_expert_replay(Drive* env) {
+    ExpertReplay* replay = &env->expert_replay;
+    int first_step = env->init_steps + 1;
+    int num_steps = env->scenario_length - first_step;
+    if (num_steps < 0) num_steps = 0;
+    replay->first_step = first_step;
+    replay->num_steps = num_steps;
+    replay->offsets = (int*)calloc(num_steps + 1, sizeof(int));
+    replay->expire_offsets = (int*)calloc(num_steps + 1, sizeof(int));
+
+    // Pass 1: the last timestep each expert is placed at and where it expires
+    int count = env->expert_static_car_count;
+    int live_until[count > 0 ? count : 1];
+    int expires_at[count > 0 ? count : 1];
+    int total = 0;
+    int total_expired = 0;
+    for (int i = 0; i < count; i++) {
+        Entity* agent = &env->entities[env->expert_static_car_indices[i]];
+        int start = env->init_steps;
+        if (start >= agent->array_size) start = agent->array_size - 1;
+        if (start < 0) start = 0;
+        live_until[i] = first_step - 1;
+        expires_at[i] = -1;
+        if (agent->traj_x[start] == INVALID_POSITION) continue;
+        for (int t = first_step; t < env->scenario_length; t++) {
+            if (t >= agent->array_size || (agent->traj_valid && agent->traj_valid[t] == 0)) {
+                expires_at[i] = t;
+                break;
+            }
+            live_until[i] = t;
+            // A logged INVALID_POSITION parks the expert just like an invalid entry
+            if (agent->traj_x[t] == INVALID_POSITION) break;
+        }
+        for (int t = first_step; t <= live_until[i]; t++) replay->offsets[t - first_step + 1]++;
+        if (expires_at[i] >= 0) replay->expire_offsets[expires_at[i] - first_step + 1]++;
+        total += live_until[i] - first_step + 1;
+        total_expired += expires_at[i] >= 0;
+    }
+    for (int k = 0; k < num_steps; k++) {
+        replay->offsets[k + 1] += replay->offsets[k];
+        replay->expire_offsets[k + 1] += replay->expire_offsets[k];
+    }
+
+    replay->entity = (int*)malloc((total > 0 ? total : 1) * sizeof(int));
+    replay->expire_entity = (int*)malloc((total_expired > 0 ? total_expired : 1) * sizeof(int));
+    float* data = (float*)malloc((size_t)EXPERT_REPLAY_FIELDS * (total > 0 ? total : 1) * sizeof(float));
+    replay->data = data;
+    replay->x = data + 0*total;
+    replay->y = data + 1*total;
+    replay->z = data + 2*total;
+    replay->heading = data + 3*total;
+    replay->heading_x = data + 4*total;
+    replay->heading_y = data + 5*total;
+    replay->vx = data + 6*total;
+    replay->vy = data + 7*total;
+
+    // Pass 2: fill each timestep's entries in expert order
+    int fill[num_steps > 0 ? num_steps : 1];
+    int expire_fill[num_steps > 0 ? num_steps : 1];
+    for (int k = 0; k < num_steps; k++) {
+        fill[k] = replay->offsets[k];
+        expire_fill[k] = replay->expire_offsets[k];
+    }
+    for (int i = 0; i < count; i++) {
+        int expert_idx = env->expert_static_car_indices[i];
+        Entity* agent = &env->entities[expert_idx];
+        for (int t = first_step; t <= live_until[i]; t++) {
+            int e = fill[t - first_step]++;
+            replay->entity[e] = expert_idx;
+            replay->x[e] = agent->traj_x[t];
+            replay->y[e] = agent->traj_y[t];
+            replay->z[e] = agent->traj_z[t];
+            replay->heading[e] = agent->traj_heading[t];
+            replay->heading_x[e] = cosf(agent->traj_heading[t]);
+            replay->heading_y[e] = sinf(agent->traj_heading[t]);
+            replay->vx[e] = agent->traj_vx[t];
+            replay->vy[e] = agent->traj_vy[t];
+        }
+        if (expires_at[i] >= 0) {
+            replay->expire_entity[expire_fill[expires_at[i] - first_step]++] = expert_idx;
+        }
+    }
+}
+
+void free_expert_replay(ExpertReplay* replay) {
+    free(replay->offsets);
+    free(replay->entity);
+    free(replay->expire_offsets);
+    free(replay->expire_entity);
+    free(replay->data);
+    memset(replay, 0, sizeof(ExpertReplay));
+}
+
+// Places the expert cars for the current timestep from the precomputed schedule
+void replay_experts(Drive* env) {
+    ExpertReplay* replay = &env->expert_replay;
+    int k = env->timestep - replay->first_step;
+    if (k < 0 || k >= replay->num_steps) return;
+    SimState* sim = &env->sim;
+    for (int e = replay->offsets[k]; e < replay->offsets[k + 1]; e++) {
+        int idx = replay->entity[e];
+        sim->x[idx] = replay->x[e];
+        sim->y[idx] = replay->y[e];
+        sim->z[idx] = replay->z[e];
+        sim->heading[idx] = replay->heading[e];
+        sim->heading_x[idx] = replay->heading_x[e];
+        sim->heading_y[idx] = replay->heading_y[e];
+        sim->vx[idx] = replay->vx[e];
+        sim->vy[idx] = replay->vy[e];
+    }
+    for (int e = replay->expire_offsets[k]; e < replay->expire_offsets[k + 1]; e++) {
+        int idx = replay->expire_entity[e];
+        sim->x[idx] = INVALID_POSITION;
+        sim->y[idx] = INVALID_POSITION;
+        sim->z[idx] = 0.0f;
+        sim->heading[idx] = 0.0f;
+        sim->heading_x[idx] = 1.0f;
+        sim->heading_y[idx] = 0.0f;
+        sim->vx[idx] = 0.0f;
+        sim->vy[idx] = 0.0f;
     }
-    agent->x = agent->traj_x[t];
-    agent->y = agent->traj_y[t];
-    agent->z = agent->traj_z[t];
-    agent->heading = agent->traj_heading[t];
-    agent->heading_x = cosf(agent->heading);
-    agent->heading_y = sinf(agent->heading);
 }
 
 bool check_line_intersection(float p1[2], float p2[2], float q1[2], float q2[2]) {
@@ -989,12 +1469,19 @@ int checkNeighbors(Drive* env, float x, float y, GridMapEntity* entity_list, int
     return entity_list_count;
 }
 
-int check_aabb_collision(Entity* car1, Entity* car2) {
+int check_aabb_collision(Drive* env, int idx1, int idx2) {
+    SimState* sim = &env->sim;
+    Entity* car1 = &env->entities[idx1];
+    Entity* car2 = &env->entities[idx2];
+    float x1 = sim->x[idx1];
+    float y1 = sim->y[idx1];
+    float x2 = sim->x[idx2];
+    float y2 = sim->y[idx2];
     // Get car corners in world space
-    float cos1 = car1->heading_x;
-    float sin1 = car1->heading_y;
-    float cos2 = car2->heading_x;
-    float sin2 = car2->heading_y;
+    float cos1 = sim->heading_x[idx1];
+    float sin1 = sim->heading_y[idx1];
+    float cos2 = sim->heading_x[idx2];
+    float sin2 = sim->heading_y[idx2];
 
     // Calculate half dimensions
     float half_len1 = car1->length * 0.5f;
@@ -1004,18 +1491,18 @@ int check_aabb_collision(Entity* car1, Entity* car2) {
 
     // Calculate car1's corners in world space
     float car1_corners[4][2] = {
-        {car1->x + (half_len1 * cos1 - half_width1 * sin1), car1->y + (half_len1 * sin1 + half_width1 * cos1)},
-        {car1->x + (half_len1 * cos1 + half_width1 * sin1), car1->y + (half_len1 * sin1 - half_width1 * cos1)},
-        {car1->x + (-half_len1 * cos1 - half_width1 * sin1), car1->y + (-half_len1 * sin1 + half_width1 * cos1)},
-        {car1->x + (-half_len1 * cos1 + half_width1 * sin1), car1->y + (-half_len1 * sin1 - half_width1 * cos1)}
+        {x1 + (half_len1 * cos1 - half_width1 * sin1), y1 + (half_len1 * sin1 + half_width1 * cos1)},
+        {x1 + (half_len1 * cos1 + half_width1 * sin1), y1 + (half_len1 * sin1 - half_width1 * cos1)},
+        {x1 + (-half_len1 * cos1 - half_width1 * sin1), y1 + (-half_len1 * sin1 + half_width1 * cos1)},
+        {x1 + (-half_len1 * cos1 + half_width1 * sin1), y1 + (-half_len1 * sin1 - half_width1 * cos1)}
     };
 
     // Calculate car2's corners in world space
     float car2_corners[4][2] = {
-        {car2->x + (half_len2 * cos2 - half_width2 * sin2), car2->y + (half_len2 * sin2 + half_width2 * cos2)},
-        {car2->x + (half_len2 * cos2 + half_width2 * sin2), car2->y + (half_len2 * sin2 - half_width2 * cos2)},
-        {car2->x + (-half_len2 * cos2 - half_width2 * sin2), car2->y + (-half_len2 * sin2 + half_width2 * cos2)},
-        {car2->x + (-half_len2 * cos2 + half_width2 * sin2), car2->y + (-half_len2 * sin2 - half_width2 * cos2)}
+        {x2 + (half_len2 * cos2 - half_width2 * sin2), y2 + (half_len2 * sin2 + half_width2 * cos2)},
+        {x2 + (half_len2 * cos2 + half_width2 * sin2), y2 + (half_len2 * sin2 - half_width2 * cos2)},
+        {x2 + (-half_len2 * cos2 - half_width2 * sin2), y2 + (-half_len2 * sin2 + half_width2 * cos2)},
+        {x2 + (-half_len2 * cos2 + half_width2 * sin2), y2 + (-half_len2 * sin2 - half_width2 * cos2)}
     };
 
     // Get the axes to check (normalized vectors perpendicular to each edge)
@@ -1055,40 +1542,132 @@ int check_aabb_collision(Entity* car1, Entity* car2) {
     return 1;  // Collision
 }
 
+// Agents in slot order: active agents, then static cars up to num_controllable_agents
+static inline int agent_slot_count(Drive* env) {
+    int statics = env->num_controllable_agents - env->active_agent_count;
+    if (statics < 0) statics = 0;
+    if (statics > env->static_car_count) statics = env->static_car_count;
+    return env->active_agent_count + statics;
+}
+
+static inline int agent_slot_index(Drive* env, int slot) {
+    if (slot < env->active_agent_count) return env->active_agent_indices[slot];
+    return env->static_car_indices[slot - env->active_agent_count];
+}
+
+// (distance, slot) ordering used to rank partners deterministically
+static inline int agent_closer(float dist, int slot, float other_dist, int other_slot) {
+    return dist < other_dist || (dist == other_dist && slot < other_slot);
+}
+
+// Positions outside the map (including INVALID_POSITION) clamp to the border cells
+static inline int agent_grid_cell_coord(float value, float origin, int cells) {
+    float c = (value - origin) / AGENT_GRID_CELL_SIZE;
+    if (!(c >= 0.0f)) return 0;  // also catches NaN
+    if (c >= (float)cells) return cells - 1;
+    return (int)c;
+}
+
+void init_agent_grid(Drive* env) {
+    AgentGrid* grid = &env->agent_grid;
+    GridMap* map = env->grid_map;
+    float width = map->bottom_right_x - map->top_left_x;
+    float height = map->top_left_y - map->bottom_right_y;
+    grid->origin_x = map->top_left_x;
+    grid->origin_y = map->bottom_right_y;
+    grid->cols = width > 0.0f ? (int)ceilf(width / AGENT_GRID_CELL_SIZE) : 1;
+    grid->rows = height > 0.0f ? (int)ceilf(height / AGENT_GRID_CELL_SIZE) : 1;
+    if (grid->cols < 1) grid->cols = 1;
+    if (grid->rows < 1) grid->rows = 1;
+    int num_slots = agent_slot_count(env);
+    grid->cell_start = (int*)calloc(grid->cols*grid->rows + 1, sizeof(int));
+    grid->slots = (int*)calloc(num_slots > 0 ? num_slots : 1, sizeof(int));
+    grid->slot_cell = (int*)calloc(num_slots > 0 ? num_slots : 1, sizeof(int));
+}
+
+void free_agent_grid(AgentGrid* grid) {
+    free(grid->cell_start);
+    free(grid->slots);
+    free(grid->slot_cell);
+    memset(grid, 0, sizeof(AgentGrid));
+}
+
+// Counting sort of the agent slots by cell. Call after agents move and
+// before collision_check.
+void build_agent_grid(Drive* env) {
+    AgentGrid* grid = &env->agent_grid;
+    SimState* sim = &env->sim;
+    int num_cells = grid->cols*grid->rows;
+    int num_slots = agent_slot_count(env);
+    memset(grid->cell_start, 0, (num_cells + 1)*sizeof(int));
+    for (int slot = 0; slot < num_slots; slot++) {
+        int index = agent_slot_index(env, slot);
+        int col = agent_grid_cell_coord(sim->x[index], grid->origin_x, grid->cols);
+        int row = agent_grid_cell_coord(sim->y[index], grid->origin_y, grid->rows);
+        int cell = row*grid->cols + col;
+        grid->slot_cell[slot] = cell;
+        grid->cell_start[cell]++;
+    }
+    for (int c = 1; c < num_cells; c++) grid->cell_start[c] += grid->cell_start[c - 1];
+    // Filling backwards leaves cell_start[c] at the first slot of cell c and
+    // keeps the slots of each cell ascending
+    for (int slot = num_slots - 1; slot >= 0; slot--) {
+        grid->slots[--grid->cell_start[grid->slot_cell[slot]]] = slot;
+    }
+    grid->cell_start[num_cells] = num_slots;
+}
+
+// Cell bounds of the square of half-width radius around (x, y)
+static inline void agent_grid_range(AgentGrid* grid, float x, float y, float radius,
+        int* col0, int* col1, int* row0, int* row1) {
+    *col0 = agent_grid_cell_coord(x - radius, grid->origin_x, grid->cols);
+    *col1 = agent_grid_cell_coord(x + radius, grid->origin_x, grid->cols);
+    *row0 = agent_grid_cell_coord(y - radius, grid->origin_y, grid->rows);
+    *row1 = agent_grid_cell_coord(y + radius, grid->origin_y, grid->rows);
+}
+
 int collision_check(Drive* env, int agent_idx) {
-    Entity* agent = &env->entities[agent_idx];
+    SimState* sim = &env->sim;
+    float agent_x = sim->x[agent_idx];
+    float agent_y = sim->y[agent_idx];
 
-    if(agent->x == INVALID_POSITION ) return -1;
+    if(agent_x == INVALID_POSITION ) return -1;
 
     int car_collided_with_index = -1;
 
-    if (agent->respawn_timestep != -1) return car_collided_with_index; // Skip respawning entities
-
-    for(int i = 0; i < MAX_AGENTS; i++){
-        int index = -1;
-        if(i < env->active_agent_count){
-            index = env->active_agent_indices[i];
-        } else if (i < env->num_controllable_agents){
-            index = env->static_car_indices[i - env->active_agent_count];
-        }
-        if(index == -1) continue;
-        if(index == agent_idx) continue;
-        Entity* entity = &env->entities[index];
-        if (entity->respawn_timestep != -1) continue; // Skip respawning entities
-        float x1 = entity->x;
-        float y1 = entity->y;
-        float dist = ((x1 - agent->x)*(x1 - agent->x) + (y1 - agent->y)*(y1 - agent->y));
-        if(dist > 225.0f) continue;
-        if(check_aabb_collision(agent, entity)) {
-            car_collided_with_index = index;
-            break;
+    if (sim->respawn_timestep[agent_idx] != -1) return car_collided_with_index; // Skip respawning entities
+
+    // Report the lowest colliding slot, whatever order the cells are visited in
+    AgentGrid* grid = &env->agent_grid;
+    int collided_slot = INT_MAX;
+    int col0, col1, row0, row1;
+    agent_grid_range(grid, agent_x, agent_y, 15.0f, &col0, &col1, &row0, &row1);
+    for(int row = row0; row <= row1; row++){
+        for(int col = col0; col <= col1; col++){
+            int cell = row*grid->cols + col;
+            for(int k = grid->cell_start[cell]; k < grid->cell_start[cell + 1]; k++){
+                int slot = grid->slots[k];
+                if(slot >= collided_slot) continue;
+                int index = agent_slot_index(env, slot);
+                if(index == agent_idx) continue;
+                if (sim->respawn_timestep[index] != -1) continue; // Skip respawning entities
+                if (sim->done[index]) continue; // Finished agents are removed from the scene
+                float x1 = sim->x[index];
+                float y1 = sim->y[index];
+                float dist = ((x1 - agent_x)*(x1 - agent_x) + (y1 - agent_y)*(y1 - agent_y));
+                if(dist > 225.0f) continue;
+                if(check_aabb_collision(env, agent_idx, index)) {
+                    car_collided_with_index = index;
+                    collided_slot = slot;
+                }
+            }
         }
     }
 
     return car_collided_with_index;
 }
 
-int check_lane_aligned(Entity* car, Entity* lane, int geometry_idx) {
+int check_lane_aligned(float car_heading, Entity* lane, int geometry_idx) {
     // Validate lane geometry length
     if (!lane || lane->array_size < 2) return 0;
 
@@ -1119,7 +1698,6 @@ int check_lane_aligned(Entity* car, Entity* lane, int geometry_idx) {
     if (heading < -M_PI) heading += 2.0f * M_PI;
 
     // Compute heading difference
-    float car_heading = car->heading; // radians
     float heading_diff = fabsf(car_heading - heading);
 
     if (heading_diff > M_PI) heading_diff = 2.0f * M_PI - heading_diff;
@@ -1129,12 +1707,12 @@ int check_lane_aligned(Entity* car, Entity* lane, int geometry_idx) {
 }
 
 void reset_agent_metrics(Drive* env, int agent_idx){
-    Entity* agent = &env->entities[agent_idx];
+    AgentState* agent = &env->agent_states[agent_idx];
     agent->metrics_array[COLLISION_IDX] = 0.0f; // vehicle collision
     agent->metrics_array[OFFROAD_IDX] = 0.0f; // offroad
     agent->metrics_array[LANE_ALIGNED_IDX] = 0.0f; // lane aligned
     agent->metrics_array[AVG_DISPLACEMENT_ERROR_IDX] = 0.0f;
-    agent->collision_state = 0;
+    env->sim.collision_state[agent_idx] = 0;
 }
 
 float point_to_segment_distance_2d(float px, float py, float x1, float y1, float x2, float y2) {
@@ -1161,30 +1739,36 @@ float point_to_segment_distance_2d(float px, float py, float x1, float y1, float
     return sqrtf((px - closestX) * (px - closestX) + (py - closestY) * (py - closestY));
 }
 
-void compute_agent_metrics(Drive* env, int agent_idx) {
+// Returns the entity index of the vehicle or road edge the agent collided with, or -1
+int compute_agent_metrics(Drive* env, int agent_idx) {
     Entity* agent = &env->entities[agent_idx];
+    AgentState* state = &env->agent_states[agent_idx];
+    float agent_x = env->sim.x[agent_idx];
+    float agent_y = env->sim.y[agent_idx];
+    float agent_heading = env->sim.heading[agent_idx];
 
     reset_agent_metrics(env, agent_idx);
 
-    if(agent->x == INVALID_POSITION ) return; // invalid agent position
+    if(agent_x == INVALID_POSITION ) return -1; // invalid agent position
 
     // Compute displacement error
-    float displacement_error = compute_displacement_error(agent, env->timestep);
+    float displacement_error = compute_displacement_error(env, agent_idx, env->timestep);
 
     if (displacement_error > 0.0f) { // Only count valid displacements
-        agent->cumulative_displacement += displacement_error;
-        agent->displacement_sample_count++;
+        state->cumulative_displacement += displacement_error;
+        state->displacement_sample_count++;
 
         // Compute running average
-        agent->metrics_array[AVG_DISPLACEMENT_ERROR_IDX] =
-            agent->cumulative_displacement / agent->displacement_sample_count;
+        state->metrics_array[AVG_DISPLACEMENT_ERROR_IDX] =
+            state->cumulative_displacement / state->displacement_sample_count;
     }
 
     int collided = 0;
+    int offroad_edge_idx = -1;
     float half_length = agent->length/2.0f;
     float half_width = agent->width/2.0f;
-    float cos_heading = cosf(agent->heading);
-    float sin_heading = sinf(agent->heading);
+    float cos_heading = cosf(agent_heading);
+    float sin_heading = sinf(agent_heading);
     float min_distance = (float)INT16_MAX;
 
     int closest_lane_entity_idx = -1;
@@ -1192,12 +1776,12 @@ void compute_agent_metrics(Drive* env, int agent_idx) {
 
     float corners[4][2];
     for (int i = 0; i < 4; i++) {
-        corners[i][0] = agent->x + (offsets[i][0]*half_length*cos_heading - offsets[i][1]*half_width*sin_heading);
-        corners[i][1] = agent->y + (offsets[i][0]*half_length*sin_heading + offsets[i][1]*half_width*cos_heading);
+        corners[i][0] = agent_x + (offsets[i][0]*half_length*cos_heading - offsets[i][1]*half_width*sin_heading);
+        corners[i][1] = agent_y + (offsets[i][0]*half_length*sin_heading + offsets[i][1]*half_width*cos_heading);
     }
 
     GridMapEntity entity_list[MAX_ENTITIES_PER_CELL*25];  // Array big enough for all neighboring cells
-    int list_size = checkNeighbors(env, agent->x, agent->y, entity_list, MAX_ENTITIES_PER_CELL*25, collision_offsets, 25);
+    int list_size = checkNeighbors(env, agent_x, agent_y, entity_list, MAX_ENTITIES_PER_CELL*25, collision_offsets, 25);
     for (int i = 0; i < list_size ; i++) {
         if(entity_list[i].entity_idx == -1) continue;
         if(entity_list[i].entity_idx == agent_idx) continue;
@@ -1213,6 +1797,7 @@ void compute_agent_metrics(Drive* env, int agent_idx) {
                 int next = (k + 1) % 4;
                 if (check_line_intersection(corners[k], corners[next], start, end)) {
                     collided = OFFROAD;
+                    offroad_edge_idx = entity_list[i].entity_idx;
                     break;
                 }
             }
@@ -1228,8 +1813,8 @@ void compute_agent_metrics(Drive* env, int agent_idx) {
             float start[2] = {entity->traj_x[geometry_idx], entity->traj_y[geometry_idx]};
             float end[2] = {entity->traj_x[geometry_idx + 1], entity->traj_y[geometry_idx + 1]};
 
-            float dist = point_to_segment_distance_2d(agent->x, agent->y, start[0], start[1], end[0], end[1]);
-            float heading_diff = fabsf(atan2f(end[1]-start[1], end[0]-start[0]) - agent->heading);
+            float dist = point_to_segment_distance_2d(agent_x, agent_y, start[0], start[1], end[0], end[1]);
+            float heading_diff = fabsf(atan2f(end[1]-start[1], end[0]-start[0]) - agent_heading);
 
             // Normalize heading difference to [0, pi]
             if (heading_diff > M_PI) heading_diff = 2.0f * M_PI - heading_diff;
@@ -1248,22 +1833,35 @@ void compute_agent_metrics(Drive* env, int agent_idx) {
     // check if aligned with closest lane and set current lane
     // 4.0m threshold: agents more than 4 meters from any lane are considered off-road
     if (min_distance > 4.0f || closest_lane_entity_idx == -1) {
-        agent->metrics_array[LANE_ALIGNED_IDX] = 0.0f;
-        agent->current_lane_idx = -1;
+        state->metrics_array[LANE_ALIGNED_IDX] = 0.0f;
+        state->current_lane_idx = -1;
     } else {
-        agent->current_lane_idx = closest_lane_entity_idx;
+        state->current_lane_idx = closest_lane_entity_idx;
 
-        int lane_aligned = check_lane_aligned(agent, &env->entities[closest_lane_entity_idx], closest_lane_geometry_idx);
-        agent->metrics_array[LANE_ALIGNED_IDX] = lane_aligned;
+        int lane_aligned = check_lane_aligned(agent_heading, &env->entities[closest_lane_entity_idx], closest_lane_geometry_idx);
+        state->metrics_array[LANE_ALIGNED_IDX] = lane_aligned;
     }
 
     // Check for vehicle collisions
     int car_collided_with_index = collision_check(env, agent_idx);
     if (car_collided_with_index != -1) collided = VEHICLE_COLLISION;
 
-    agent->collision_state = collided;
+    env->sim.collision_state[agent_idx] = collided;
 
-    return;
+    if (collided == VEHICLE_COLLISION) return car_collided_with_index;
+    if (collided == OFFROAD) return offroad_edge_idx;
+    return -1;
+}
+
+void record_event(Drive* env, int agent, int other, int type, float x, float y) {
+    DriveEvent* event = &env->events[env->event_count % env->event_capacity];
+    event->timestep = env->timestep;
+    event->agent = agent;
+    event->other = other;
+    event->type = type;
+    event->x = x;
+    event->y = y;
+    env->event_count++;
 }
 
 int valid_active_agent(Drive* env, int agent_idx){
@@ -1290,24 +1888,24 @@ void set_active_agents(Drive* env){
     int capacity = env->num_agents;
     if (capacity < 0) {
         capacity = 0;
-    } else if (capacity > MAX_AGENTS) {
-        capacity = MAX_AGENTS;
     }
 
     env->active_agent_count = 0;
     env->static_car_count = 0;
     env->num_controllable_agents = 1;
     env->expert_static_car_count = 0;
-    int active_agent_indices[MAX_AGENTS];
-    int static_car_indices[MAX_AGENTS];
-    int expert_static_car_indices[MAX_AGENTS];
+    // Scratch index lists sized by the map, so busy scenes keep every vehicle
+    int scratch_size = env->num_objects > 0 ? env->num_objects : 1;
+    int* active_agent_indices = (int*)malloc(3 * scratch_size * sizeof(int));
+    int* static_car_indices = active_agent_indices + scratch_size;
+    int* expert_static_car_indices = static_car_indices + scratch_size;
+    SelectionBuckets b;
+    alloc_selection_buckets(&b, scratch_size);
 
     if (env->control_all_agents == 1) {
-        SelectionBuckets b;
         scan_vehicles_initial(env, &b, 1);
 
         int desired = b.candidates_count;
-        if (desired > MAX_AGENTS) desired = MAX_AGENTS;
         if (desired > capacity) desired = capacity;
 
         if (desired <= 0) {
@@ -1315,17 +1913,17 @@ void set_active_agents(Drive* env){
         }
 
         if (!env->deterministic_agent_selection) {
-            fisher_yates_shuffle(b.candidates, b.candidates_count);
+            fisher_yates_shuffle(&env->rng, b.candidates, b.candidates_count);
         }
 
         for (int k = 0; k < desired; k++) {
             active_agent_indices[env->active_agent_count++] = b.candidates[k];
             env->entities[b.candidates[k]].active_agent = 1;
         }
-        for (int i = 0; i < b.statics_count && env->static_car_count < MAX_AGENTS; i++) {
+        for (int i = 0; i < b.statics_count; i++) {
             static_car_indices[env->static_car_count++] = b.statics[i];
         }
-        for (int k = desired; k < b.candidates_count && env->static_car_count < MAX_AGENTS; k++) {
+        for (int k = desired; k < b.candidates_count; k++) {
             static_car_indices[env->static_car_count++] = b.candidates[k];
             env->entities[b.candidates[k]].active_agent = 0;
         }
@@ -1339,16 +1937,14 @@ void set_active_agents(Drive* env){
 
         goto finalize;
     } else if (env->policy_agents_per_env > 0) {
-        SelectionBuckets b;
         scan_vehicles_initial(env, &b, 0);
 
         int desired = env->policy_agents_per_env;
-        if (desired > MAX_AGENTS) desired = MAX_AGENTS;
         if (desired > b.candidates_count) desired = b.candidates_count;
         if (desired > capacity) desired = capacity;
 
         if (!env->deterministic_agent_selection) {
-            fisher_yates_shuffle(b.candidates, b.candidates_count);
+            fisher_yates_shuffle(&env->rng, b.candidates, b.candidates_count);
         }
         if (desired > 0) {
             for (int k = 0; k < desired; k++) {
@@ -1357,25 +1953,17 @@ void set_active_agents(Drive* env){
             }
             for (int k = desired; k < b.candidates_count; k++) {
                 int idx = b.candidates[k];
-                if (env->expert_static_car_count < MAX_AGENTS) {
-                    expert_static_car_indices[env->expert_static_car_count++] = idx;
-                }
-                if (env->static_car_count < MAX_AGENTS) {
-                    static_car_indices[env->static_car_count++] = idx;
-                }
+                expert_static_car_indices[env->expert_static_car_count++] = idx;
+                static_car_indices[env->static_car_count++] = idx;
                 env->entities[idx].mark_as_expert = 1;
                 env->entities[idx].active_agent = 0;
             }
             for (int k = 0; k < b.forced_experts_count; k++) {
                 int idx = b.forced_experts[k];
-                if (env->expert_static_car_count < MAX_AGENTS) {
-                    expert_static_car_indices[env->expert_static_car_count++] = idx;
-                }
-                if (env->static_car_count < MAX_AGENTS) {
-                    static_car_indices[env->static_car_count++] = idx;
-                }
+                expert_static_car_indices[env->expert_static_car_count++] = idx;
+                static_car_indices[env->static_car_count++] = idx;
             }
-            for (int i = 0; i < b.statics_count && env->static_car_count < MAX_AGENTS; i++) {
+            for (int i = 0; i < b.statics_count; i++) {
                 static_car_indices[env->static_car_count++] = b.statics[i];
             }
 
@@ -1403,12 +1991,8 @@ void set_active_agents(Drive* env){
                 for (int i = 0; i < env->num_objects; i++) {
                     if (i == picked) continue;
                     if (env->entities[i].type == VEHICLE) {
-                        if (env->static_car_count < MAX_AGENTS) {
-                            static_car_indices[env->static_car_count++] = i;
-                        }
-                        if (env->expert_static_car_count < MAX_AGENTS) {
-                            expert_static_car_indices[env->expert_static_car_count++] = i;
-                        }
+                        static_car_indices[env->static_car_count++] = i;
+                        expert_static_car_indices[env->expert_static_car_count++] = i;
                         env->entities[i].active_agent = 0;
                         env->entities[i].mark_as_expert = 1;
                     }
@@ -1427,7 +2011,8 @@ void set_active_agents(Drive* env){
 
 legacy_select:
     if(env->num_agents == 0){
-        env->num_agents = MAX_AGENTS;
+        // No limit requested: control every valid agent of the map
+        env->num_agents = env->num_objects;
     }
     int first_agent_id = env->num_objects-1;
     float distance_to_goal = valid_active_agent(env, first_agent_id);
@@ -1440,7 +2025,7 @@ legacy_select:
         env->active_agent_count = 0;
         env->num_controllable_agents = 0;
     }
-    for(int i = 0; i < env->num_objects-1 && env->num_controllable_agents < MAX_AGENTS; i++){
+    for(int i = 0; i < env->num_objects-1; i++){
 
         // Check if the entity type is controllable
         int is_type_controllable;
@@ -1491,6 +2076,8 @@ legacy_select:
         env->expert_static_car_indices[i] = expert_static_car_indices[i];
     }
 finalize:
+    free(active_agent_indices);
+    free_selection_buckets(&b);
     if (env->logs_capacity > 0 && env->active_agent_count > env->logs_capacity) {
         fprintf(stderr,
                 "[set_active_agents] ERROR map=%s active=%d exceeds logs_capacity=%d\n",
@@ -1518,13 +2105,14 @@ void remove_bad_trajectories(Drive* env){
         }
         for(int i = 0; i < env->expert_static_car_count; i++){
             int expert_idx = env->expert_static_car_indices[i];
-            if(env->entities[expert_idx].x == INVALID_POSITION) continue;
+            if(env->sim.x[expert_idx] == INVALID_POSITION) continue;
             move_expert(env, env->actions, expert_idx);
         }
+        build_agent_grid(env);
         // check collisions
         for(int i = 0; i < env->active_agent_count; i++){
             int agent_idx = env->active_agent_indices[i];
-            env->entities[agent_idx].collision_state = 0;
+            env->sim.collision_state[agent_idx] = 0;
             int collided_with_index = collision_check(env, agent_idx);
             if((collided_with_index >= 0) && collided_agents[i] == 0){
                 collided_agents[i] = 1;
@@ -1547,18 +2135,96 @@ void remove_bad_trajectories(Drive* env){
 }
 
 void init_goal_positions(Drive* env){
-    for(int x = 0;x<env->active_agent_count; x++){
-        int agent_idx = env->active_agent_indices[x];
-        env->entities[agent_idx].init_goal_x = env->entities[agent_idx].goal_position_x;
-        env->entities[agent_idx].init_goal_y = env->entities[agent_idx].goal_position_y;
+    for(int i = 0; i < env->num_objects; i++){
+        env->agent_states[i].goal_position_x = env->entities[i].goal_position_x;
+        env->agent_states[i].goal_position_y = env->entities[i].goal_position_y;
+        env->agent_states[i].sampled_new_goal = 0;
     }
 }
 
-void init(Drive* env){
-    env->human_agent_idx = 0;
-    env->timestep = 0;
+// Reorders the objects so that active agents come first (in selection order),
+// followed by the static cars and then every other object, and remaps the index
+// lists accordingly. After this, active agent slot i is entity i, which lets the
+// per-agent loops read the SimState arrays contiguously. Roads keep their indices.
+void order_objects_by_role(Drive* env){
+    int n = env->num_objects;
+    if (n == 0) return;
+    int* order = (int*)malloc(n * sizeof(int));
+    int* new_index = (int*)malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) new_index[i] = -1;
+    int count = 0;
+    for (int i = 0; i < env->active_agent_count; i++) {
+        int idx = env->active_agent_indices[i];
+        if (new_index[idx] != -1) continue;
+        new_index[idx] = count;
+        order[count++] = idx;
+    }
+    for (int i = 0; i < env->static_car_count; i++) {
+        int idx = env->static_car_indices[i];
+        if (new_index[idx] != -1) continue;
+        new_index[idx] = count;
+        order[count++] = idx;
+    }
+    for (int i = 0; i < env->expert_static_car_count; i++) {
+        int idx = env->expert_static_car_indices[i];
+        if (new_index[idx] != -1) continue;
+        new_index[idx] = count;
+        order[count++] = idx;
+    }
+    for (int i = 0; i < n; i++) {
+        if (new_index[i] != -1) continue;
+        new_index[i] = count;
+        order[count++] = i;
+    }
+
+    Entity* objects = (Entity*)malloc(n * sizeof(Entity));
+    for (int i = 0; i < n; i++) objects[i] = env->entities[order[i]];
+    memcpy(env->entities, objects, n * sizeof(Entity));
+    free(objects);
+
+    for (int i = 0; i < env->active_agent_count; i++) env->active_agent_indices[i] = new_index[env->active_agent_indices[i]];
+    for (int i = 0; i < env->static_car_count; i++) env->static_car_indices[i] = new_index[env->static_car_indices[i]];
+    for (int i = 0; i < env->expert_static_car_count; i++) env->expert_static_car_indices[i] = new_index[env->expert_static_car_indices[i]];
+    free(order);
+    free(new_index);
+}
+
+void init_bicycle_batch(Drive* env) {
+    for (int k = 0; k < 13; k++) {
+        bicycle_steering_factors(STEERING_VALUES[k], &env->steering_yaw_factor[k],
+            &env->steering_cos_beta[k], &env->steering_sin_beta[k]);
+        env->steering_tan[k] = tanf(STEERING_VALUES[k]);
+    }
+    alloc_bicycle_batch(&env->bicycle, env->active_agent_count);
+    for (int i = 0; i < env->active_agent_count; i++) {
+        int agent_idx = env->active_agent_indices[i];
+        env->bicycle.inv_length[i] = 1.0f / env->entities[agent_idx].length;
+    }
+}
+
+// Per-agent arrays, kept across map reloads while they are large enough
+static void reserve_agent_buffers(Drive* env) {
+    int n = env->active_agent_count;
+    if (n <= env->agent_capacity) {
+        memset(env->logs, 0, env->agent_capacity*sizeof(Log));
+        return;
+    }
+    free(env->logs);
+    free(env->obs_partner_count);
+    free(env->obs_road_count);
+    env->logs = (Log*)calloc(n, sizeof(Log));
+    env->obs_partner_count = (int*)calloc(n, sizeof(int));
+    env->obs_road_count = (int*)calloc(n, sizeof(int));
+    if (env->obs_out) {
+        free(env->observations);
+        env->observations = (float*)calloc((size_t)n*obs_size(env), sizeof(float));
+    }
+    env->agent_capacity = n;
+}
+
+// Everything derived from env->map_name and env->num_agents
+static void init_map_state(Drive* env) {
     env->entities = load_map_binary(env->map_name, env);
-    env->dynamics_model = CLASSIC;
     set_means(env);
     init_grid_map(env);
     if (env->use_goal_generation) init_topology_graph(env);
@@ -1568,19 +2234,50 @@ void init(Drive* env){
     env->logs_capacity = 0;
     set_active_agents(env);
     env->logs_capacity = env->active_agent_count;
+    order_objects_by_role(env);
+    reserve_sim_state(&env->sim, env->num_objects);
+    init_agent_grid(env);
+    env->agent_states = (AgentState*)calloc(env->num_objects > 0 ? env->num_objects : 1, sizeof(AgentState));
     remove_bad_trajectories(env);
     set_start_position(env);
     init_goal_positions(env);
-    env->logs = (Log*)calloc(env->active_agent_count, sizeof(Log));
+    init_bicycle_batch(env);
+    init_expert_replay(env);
+    reserve_agent_buffers(env);
+    invalidate_obs_counts(env);
 }
 
-void c_close(Drive* env){
+static void free_map_state(Drive* env) {
+    free_reset_state(&env->reset_state);
+    free(env->agent_states);
+    env->agent_states = NULL;
+    free_bicycle_batch(&env->bicycle);
+    free_agent_grid(&env->agent_grid);
+    // Clones share the immutable part, the last one to let go frees it
+    if (env->map_refs) {
+        int refs = __atomic_sub_fetch(env->map_refs, 1, __ATOMIC_ACQ_REL);
+        if (refs == 0) free(env->map_refs);
+        env->map_refs = NULL;
+        if (refs > 0) {
+            env->entities = NULL;
+            memset(&env->expert_replay, 0, sizeof(ExpertReplay));
+            env->active_agent_indices = NULL;
+            env->grid_map = NULL;
+            env->neighbor_offsets = NULL;
+            env->static_car_indices = NULL;
+            env->expert_static_car_indices = NULL;
+            env->topology_graph = NULL;
+            return;
+        }
+    }
     for(int i = 0; i < env->num_entities; i++){
         free_entity(&env->entities[i]);
     }
     free(env->entities);
+    env->entities = NULL;
+    free_expert_replay(&env->expert_replay);
     free(env->active_agent_indices);
-    free(env->logs);
+    env->active_agent_indices = NULL;
     // GridMap cleanup
     int grid_cell_count = env->grid_map->grid_cols*env->grid_map->grid_rows;
     for(int grid_index = 0; grid_index < grid_cell_count; grid_index++){
@@ -1589,6 +2286,7 @@ void c_close(Drive* env){
     free(env->grid_map->cells);
     free(env->grid_map->cell_entities_count);
     free(env->neighbor_offsets);
+    env->neighbor_offsets = NULL;
 
     for(int i = 0; i < grid_cell_count; i++){
         free(env->grid_map->neighbor_cache_entities[i]);
@@ -1596,16 +2294,84 @@ void c_close(Drive* env){
     free(env->grid_map->neighbor_cache_entities);
     free(env->grid_map->neighbor_cache_count);
     free(env->grid_map);
+    env->grid_map = NULL;
     free(env->static_car_indices);
+    env->static_car_indices = NULL;
     free(env->expert_static_car_indices);
+    env->expert_static_car_indices = NULL;
     freeTopologyGraph(env->topology_graph);
+    env->topology_graph = NULL;
+}
+
+void init(Drive* env){
+    env->human_agent_idx = 0;
+    env->timestep = 0;
+    if (env->rng.inc == 0) rng_seed(&env->rng, 0, 0);  // never seeded
+    if (env->action_repeat < 1) env->action_repeat = 1;
+    if (env->max_partners < 1 || env->max_partners > MAX_PARTNER_OBSERVATIONS) env->max_partners = MAX_PARTNER_OBSERVATIONS;
+    if (env->max_roads < 1 || env->max_roads > MAX_ROAD_SEGMENT_OBSERVATIONS) env->max_roads = MAX_ROAD_SEGMENT_OBSERVATIONS;
+
+    init_map_state(env);
+    env->event_count = 0;
+    if (env->event_capacity > 0) {
+        env->events = (DriveEvent*)calloc(env->event_capacity, sizeof(DriveEvent));
+    }
+}
+
+// The settings a Drive is configured with before init, without any map state
+void copy_drive_config(Drive* dst, const Drive* src) {
+    dst->action_type = src->action_type;
+    dst->dynamics_model = src->dynamics_model;
+    dst->action_repeat = src->action_repeat;
+    dst->async_episodes = src->async_episodes;
+    dst->reset_cache = src->reset_cache;
+    dst->obs_header = src->obs_header;
+    dst->obs_dtype = src->obs_dtype;
+    dst->obs_layout = src->obs_layout;
+    dst->max_partners = src->max_partners;
+    dst->max_roads = src->max_roads;
+    dst->reward_vehicle_collision = src->reward_vehicle_collision;
+    dst->reward_offroad_collision = src->reward_offroad_collision;
+    dst->reward_goal = src->reward_goal;
+    dst->reward_goal_post_respawn = src->reward_goal_post_respawn;
+    dst->reward_ade = src->reward_ade;
+    dst->goal_radius = src->goal_radius;
+    dst->scenario_length = src->scenario_length;
+    dst->use_goal_generation = src->use_goal_generation;
+    dst->event_capacity = src->event_capacity;
+    dst->policy_agents_per_env = src->policy_agents_per_env;
+    dst->control_all_agents = src->control_all_agents;
+    dst->deterministic_agent_selection = src->deterministic_agent_selection;
+    dst->control_non_vehicles = src->control_non_vehicles;
+    dst->init_steps = src->init_steps;
+    dst->timestep = src->timestep;
+}
+
+void c_close(Drive* env){
+    if (env->num_scenarios > 0) {
+        for (int s = 0; s < env->num_scenarios; s++) {
+            c_close(&env->scenarios[s]);
+            free(env->scenarios[s].map_name);
+        }
+        free(env->scenarios);
+        free(env->ini_file);
+        return;
+    }
+    free_map_state(env);
+    free_sim_state(&env->sim);
+    free(env->logs);
+    free(env->obs_partner_count);
+    free(env->obs_road_count);
+    free(env->obs_inv_scale);
+    if (env->obs_out) free(env->observations);  // float scratch owned by the env
+    free(env->events);
     // free(env->map_name);
     free(env->ini_file);
 }
 
 void allocate(Drive* env){
     init(env);
-    int max_obs = 7 + 7*(MAX_AGENTS - 1) + 7*MAX_ROAD_SEGMENT_OBSERVATIONS;
+    int max_obs = obs_size(env);
     // printf("num static cars: %d\n", env->static_car_count);
     // printf("active agent count: %d\n", env->active_agent_count);
     // printf("num objects: %d\n", env->num_objects);
@@ -1615,6 +2381,101 @@ void allocate(Drive* env){
     env->terminals= (unsigned char*)calloc(env->active_agent_count, sizeof(unsigned char));
 }
 
+// Packed scenarios: a host Drive owns no map of its own. Each scenario is a full
+// Drive over a disjoint row range of the host's buffers, with its own grids,
+// timestep and RNG, so one vectorized handle steps several maps in turn.
+
+// Bytes per stored observation value
+static inline int obs_elem_size(Drive* env) {
+    if (env->obs_dtype == OBS_INT8) return 1;
+    return env->obs_dtype == OBS_FLOAT32 ? 4 : 2;
+}
+
+// 4-byte values per action row: int[2] for discrete, the model's floats otherwise
+static inline int action_dim(Drive* env) {
+    return env->action_type == 1 ? DYNAMICS_ACTION_DIMS[env->dynamics_model] : 2;
+}
+
+// Points each scenario at its rows of the host buffers. Scenarios with a
+// reduced obs_dtype keep their float scratch and encode into the host rows.
+void set_scenario_buffers(Drive* env) {
+    int row = 0;
+    for (int s = 0; s < env->num_scenarios; s++) {
+        Drive* sc = &env->scenarios[s];
+        char* obs = (char*)env->observations + (size_t)row*obs_size(env)*obs_elem_size(env);
+        if (sc->obs_out) {
+            sc->obs_out = obs;
+        } else {
+            sc->observations = (float*)obs;
+        }
+        sc->actions = env->actions + (size_t)row*action_dim(env);
+        sc->rewards = env->rewards + row;
+        sc->terminals = env->terminals + row;
+        sc->masks = env->masks ? env->masks + row : NULL;
+        row += sc->active_agent_count;
+    }
+}
+
+// Loads one scenario per map into a host configured like a regular env (rewards,
+// dynamics, obs layout). max_agents and seeds are per scenario.
+void init_scenarios(Drive* env, char** map_names, const int* max_agents, const int* seeds, int n) {
+    env->scenarios = (Drive*)calloc(n, sizeof(Drive));
+    env->num_scenarios = n;
+    env->active_agent_count = 0;
+    for (int s = 0; s < n; s++) {
+        Drive* sc = &env->scenarios[s];
+        copy_drive_config(sc, env);
+        sc->map_name = strdup(map_names[s]);
+        sc->num_agents = max_agents[s];
+        rng_seed(&sc->rng, (uint64_t)(uint32_t)seeds[s], 0);
+        init(sc);
+        env->active_agent_count += sc->active_agent_count;
+    }
+    env->logs_capacity = env->active_agent_count;
+    set_scenario_buffers(env);
+    for (int s = 0; s < n; s++) init_obs_codec(&env->scenarios[s]);
+}
+
+// Moves the scenario logs into the host, where vec_log reads them
+static void fold_scenario_logs(Drive* env) {
+    float* dst = (float*)&env->log;
+    for (int s = 0; s < env->num_scenarios; s++) {
+        float* src = (float*)&env->scenarios[s].log;
+        for (size_t k = 0; k < sizeof(Log)/sizeof(float); k++) dst[k] += src[k];
+        memset(src, 0, sizeof(Log));
+    }
+}
+
+// Predicted c_step time in microseconds, used to balance maps across packs and
+// pool threads. Fit on synthetic scenes of 8 to 96 agents and 100 to 5000 road
+// points (within ~15%): each agent pays a fixed cost, a scan over the other
+// objects and a road lookup that grows with the square root of the road points.
+#define STEP_COST_AGENT 0.05f
+#define STEP_COST_OBJECT 0.034f
+#define STEP_COST_ROAD 0.11f
+
+static inline float predicted_step_cost(int agents, int objects, int road_points) {
+    return agents*(STEP_COST_AGENT + STEP_COST_OBJECT*objects + STEP_COST_ROAD*sqrtf((float)road_points));
+}
+
+int road_point_count(Drive* env) {
+    int points = 0;
+    for (int i = env->num_objects; i < env->num_entities; i++) {
+        points += env->entities[i].array_size;
+    }
+    return points;
+}
+
+// Predicted step cost of a loaded env, summed over its scenarios when packed
+float drive_step_cost(Drive* env) {
+    if (env->num_scenarios > 0) {
+        float cost = 0.0f;
+        for (int s = 0; s < env->num_scenarios; s++) cost += drive_step_cost(&env->scenarios[s]);
+        return cost;
+    }
+    return predicted_step_cost(env->active_agent_count, env->num_objects, road_point_count(env));
+}
+
 void free_allocated(Drive* env){
     free(env->observations);
     free(env->actions);
@@ -1639,6 +2500,7 @@ float normalize_heading(float heading){
 void move_dynamics(Drive* env, int action_idx, int agent_idx){
     if(env->dynamics_model == CLASSIC){
         Entity* agent = &env->entities[agent_idx];
+        SimState* sim = &env->sim;
         float acceleration = 0.0f;
         float steering = 0.0f;
 
@@ -1656,11 +2518,11 @@ void move_dynamics(Drive* env, int action_idx, int agent_idx){
         }
 
         // Current state
-        float x = agent->x;
-        float y = agent->y;
-        float heading = agent->heading;
-        float vx = agent->vx;
-        float vy = agent->vy;
+        float x = sim->x[agent_idx];
+        float y = sim->y[agent_idx];
+        float heading = sim->heading[agent_idx];
+        float vx = sim->vx[agent_idx];
+        float vy = sim->vy[agent_idx];
 
         // Calculate current speed
         float speed = sqrtf(vx*vx + vy*vy);
@@ -1684,17 +2546,258 @@ void move_dynamics(Drive* env, int action_idx, int agent_idx){
         heading = heading + yaw_rate*dt;
         // heading = normalize_heading(heading);
         // Apply updates to the agent's state
-        agent->x = x;
-        agent->y = y;
-        agent->heading = heading;
-        agent->heading_x = cosf(heading);
-        agent->heading_y = sinf(heading);
-        agent->vx = new_vx;
-        agent->vy = new_vy;
+        sim->x[agent_idx] = x;
+        sim->y[agent_idx] = y;
+        sim->heading[agent_idx] = heading;
+        sim->heading_x[agent_idx] = cosf(heading);
+        sim->heading_y[agent_idx] = sinf(heading);
+        sim->vx[agent_idx] = new_vx;
+        sim->vy[agent_idx] = new_vy;
+    } else if(env->dynamics_model == INVERTIBLE_BICYLE){
+        Entity* agent = &env->entities[agent_idx];
+        SimState* sim = &env->sim;
+        float acceleration = 0.0f;
+        float steering = 0.0f;
+
+        if (env->action_type == 1) { // continuous
+            float (*action_array_f)[2] = (float(*)[2])env->actions;
+            acceleration = action_array_f[action_idx][0];
+            steering = action_array_f[action_idx][1];
+        } else { // discrete
+            int (*action_array)[2] = (int(*)[2])env->actions;
+            acceleration = ACCELERATION_VALUES[action_array[action_idx][0]];
+            steering = STEERING_VALUES[action_array[action_idx][1]];
+        }
+
+        const float dt = 0.1f;
+        float heading = sim->heading[agent_idx];
+        // Signed speed along the heading
+        float speed = sim->vx[agent_idx]*cosf(heading) + sim->vy[agent_idx]*sinf(heading);
+        float new_speed = clipSpeed(speed + acceleration*dt);
+        float avg_speed = 0.5f*(speed + new_speed);
+        float yaw_delta = avg_speed*tanf(steering)/agent->length*dt;
+        float mid_heading = heading + 0.5f*yaw_delta;
+        heading = heading + yaw_delta;
+        sim->x[agent_idx] += avg_speed*cosf(mid_heading)*dt;
+        sim->y[agent_idx] += avg_speed*sinf(mid_heading)*dt;
+        sim->heading[agent_idx] = heading;
+        sim->heading_x[agent_idx] = cosf(heading);
+        sim->heading_y[agent_idx] = sinf(heading);
+        sim->vx[agent_idx] = new_speed*cosf(heading);
+        sim->vy[agent_idx] = new_speed*sinf(heading);
+    } else if(env->dynamics_model == DELTA_LOCAL){
+        SimState* sim = &env->sim;
+        float (*action_array_f)[3] = (float(*)[3])env->actions;
+        float heading = sim->heading[agent_idx];
+        float c = cosf(heading);
+        float s = sinf(heading);
+        // Rotate the local displacement into the world frame
+        float dx = c*action_array_f[action_idx][0] - s*action_array_f[action_idx][1];
+        float dy = s*action_array_f[action_idx][0] + c*action_array_f[action_idx][1];
+        const float dt = 0.1f;
+        heading = heading + action_array_f[action_idx][2];
+        sim->x[agent_idx] += dx;
+        sim->y[agent_idx] += dy;
+        sim->vx[agent_idx] = dx/dt;
+        sim->vy[agent_idx] = dy/dt;
+        sim->heading[agent_idx] = heading;
+        sim->heading_x[agent_idx] = cosf(heading);
+        sim->heading_y[agent_idx] = sinf(heading);
+    } else if(env->dynamics_model == STATE_DYNAMICS){
+        SimState* sim = &env->sim;
+        float (*action_array_f)[5] = (float(*)[5])env->actions;
+        sim->x[agent_idx] = action_array_f[action_idx][0];
+        sim->y[agent_idx] = action_array_f[action_idx][1];
+        sim->heading[agent_idx] = action_array_f[action_idx][2];
+        sim->vx[agent_idx] = action_array_f[action_idx][3];
+        sim->vy[agent_idx] = action_array_f[action_idx][4];
+        sim->heading_x[agent_idx] = cosf(sim->heading[agent_idx]);
+        sim->heading_y[agent_idx] = sinf(sim->heading[agent_idx]);
     }
     return;
 }
 
+// Batched dynamics for all active agents. Active agents occupy entity slots
+// [0, active_agent_count) (see order_objects_by_role), so action i drives sim
+// index i and each model's kernel runs straight over the SoA arrays.
+// Integrates agents [start, start + n) in one batch
+static void move_dynamics_range(Drive* env, int start, int n) {
+    SimState* sim = &env->sim;
+    float* x = sim->x + start;
+    float* y = sim->y + start;
+    float* heading = sim->heading + start;
+    float* heading_x = sim->heading_x + start;
+    float* heading_y = sim->heading_y + start;
+    float* vx = sim->vx + start;
+    float* vy = sim->vy + start;
+    const float dt = 0.1f;
+    if (env->dynamics_model == DELTA_LOCAL) {
+        delta_local_step_batch((const float(*)[3])env->actions + start, n, x, y, heading,
+            heading_x, heading_y, vx, vy, dt);
+        return;
+    }
+    if (env->dynamics_model == STATE_DYNAMICS) {
+        state_step_batch((const float(*)[5])env->actions + start, n, x, y, heading,
+            heading_x, heading_y, vx, vy);
+        return;
+    }
+
+    // Bicycle models: decode actions, then integrate. The scratch arrays are
+    // per run, but inv_length is indexed by slot, so the view starts at start.
+    BicycleBatch view = env->bicycle;
+    view.inv_length += start;
+    BicycleBatch* batch = &view;
+    int classic = env->dynamics_model == CLASSIC;
+    if (env->action_type == 1) { // continuous
+        float (*action_array_f)[2] = (float(*)[2])env->actions + start;
+        for (int i = 0; i < n; i++) {
+            batch->accel[i] = action_array_f[i][0];
+            if (classic) {
+                bicycle_steering_factors(action_array_f[i][1], &batch->yaw_factor[i],
+                    &batch->cos_beta[i], &batch->sin_beta[i]);
+            } else {
+                batch->yaw_factor[i] = tanf(action_array_f[i][1]);
+            }
+        }
+    } else { // discrete
+        int (*action_array)[2] = (int(*)[2])env->actions + start;
+        const float* yaw_table = classic ? env->steering_yaw_factor : env->steering_tan;
+        for (int i = 0; i < n; i++) {
+            int steering_index = action_array[i][1];
+            batch->accel[i] = ACCELERATION_VALUES[action_array[i][0]];
+            batch->yaw_factor[i] = yaw_table[steering_index];
+            batch->cos_beta[i] = env->steering_cos_beta[steering_index];
+            batch->sin_beta[i] = env->steering_sin_beta[steering_index];
+        }
+    }
+    if (classic) {
+        bicycle_step_batch(batch, n, x, y, heading, heading_x, heading_y, vx, vy, dt, MAX_SPEED);
+    } else {
+        invertible_bicycle_step_batch(batch, n, x, y, heading, heading_x, heading_y, vx, vy, dt, MAX_SPEED);
+    }
+}
+
+void move_dynamics_batch(Drive* env) {
+    int n = env->active_agent_count;
+    if (env->done_count == 0) {
+        move_dynamics_range(env, 0, n);
+        return;
+    }
+    // Finished agents stay frozen; integrate the runs of live agents between them
+    int* done = env->sim.done;
+    int i = 0;
+    while (i < n) {
+        while (i < n && done[i]) i++;
+        int start = i;
+        while (i < n && !done[i]) i++;
+        if (i > start) move_dynamics_range(env, start, i - start);
+    }
+}
+
+int nearest_value_index(const float* values, int count, float value) {
+    int best = 0;
+    for (int k = 1; k < count; k++) {
+        if (fabsf(values[k] - value) < fabsf(values[best] - value)) best = k;
+    }
+    return best;
+}
+
+// Inverse dynamics: the action that moves each active agent from its logged
+// state at `timestep` to its logged state at timestep + 1 under the env's
+// dynamics model. `actions` has the layout of env->actions. valid[i] is 0 when
+// either log entry is missing; the action is then neutral (zero acceleration and
+// steering, zero displacement, or the agent's current state for STATE_DYNAMICS).
+// A negative timestep uses the current one, per scenario when packed.
+void compute_expert_actions(Drive* env, int timestep, void* actions, unsigned char* valid) {
+    if (env->num_scenarios > 0) {
+        int row = 0;
+        for (int s = 0; s < env->num_scenarios; s++) {
+            Drive* sc = &env->scenarios[s];
+            compute_expert_actions(sc, timestep, (float*)actions + (size_t)row*action_dim(env), valid + row);
+            row += sc->active_agent_count;
+        }
+        return;
+    }
+    if (timestep < 0) timestep = env->timestep;
+    const float dt = 0.1f;
+    int dim = DYNAMICS_ACTION_DIMS[env->dynamics_model];
+    for (int i = 0; i < env->active_agent_count; i++) {
+        int agent_idx = env->active_agent_indices[i];
+        Entity* agent = &env->entities[agent_idx];
+        int t = timestep;
+        int ok = t >= 0 && t + 1 < agent->array_size && agent->traj_valid[t] && agent->traj_valid[t + 1];
+        valid[i] = (unsigned char)ok;
+
+        float out[5] = {0};
+        if (!ok) {
+            if (env->dynamics_model == STATE_DYNAMICS) {
+                out[0] = env->sim.x[agent_idx];
+                out[1] = env->sim.y[agent_idx];
+                out[2] = env->sim.heading[agent_idx];
+            }
+        } else if (env->dynamics_model == CLASSIC || env->dynamics_model == INVERTIBLE_BICYLE) {
+            float h0 = agent->traj_heading[t];
+            float h1 = agent->traj_heading[t + 1];
+            float yaw_delta = normalize_heading(h1 - h0);
+            float vx0 = agent->traj_vx[t], vy0 = agent->traj_vy[t];
+            float vx1 = agent->traj_vx[t + 1], vy1 = agent->traj_vy[t + 1];
+            if (env->dynamics_model == CLASSIC) {
+                float speed0 = sqrtf(vx0*vx0 + vy0*vy0);
+                float speed1 = sqrtf(vx1*vx1 + vy1*vy1);
+                out[0] = 2.0f*(speed1 - speed0)/dt;
+                out[1] = speed1 > 0.1f ? yaw_delta*agent->length/(speed1*dt) : 0.0f; // yaw factor
+            } else {
+                float speed0 = vx0*cosf(h0) + vy0*sinf(h0);
+                float speed1 = vx1*cosf(h1) + vy1*sinf(h1);
+                float avg_speed = 0.5f*(speed0 + speed1);
+                out[0] = (speed1 - speed0)/dt;
+                out[1] = fabsf(avg_speed) > 0.1f ? atanf(yaw_delta*agent->length/(avg_speed*dt)) : 0.0f;
+            }
+            if (env->action_type == 1) {
+                out[0] = fminf(fmaxf(out[0], -MAX_CONTINUOUS_ACCEL), MAX_CONTINUOUS_ACCEL);
+                if (env->dynamics_model == CLASSIC) {
+                    out[1] = bicycle_steering_inverse(out[1], MAX_CONTINUOUS_STEERING);
+                } else {
+                    out[1] = fminf(fmaxf(out[1], -MAX_CONTINUOUS_STEERING), MAX_CONTINUOUS_STEERING);
+                }
+            }
+        } else if (env->dynamics_model == DELTA_LOCAL) {
+            float h0 = agent->traj_heading[t];
+            float dx = agent->traj_x[t + 1] - agent->traj_x[t];
+            float dy = agent->traj_y[t + 1] - agent->traj_y[t];
+            float c = cosf(h0);
+            float s = sinf(h0);
+            out[0] = fminf(fmaxf(c*dx + s*dy, -DELTA_LOCAL_MAX_DX), DELTA_LOCAL_MAX_DX);
+            out[1] = fminf(fmaxf(-s*dx + c*dy, -DELTA_LOCAL_MAX_DY), DELTA_LOCAL_MAX_DY);
+            out[2] = fminf(fmaxf(normalize_heading(agent->traj_heading[t + 1] - h0), -DELTA_LOCAL_MAX_DYAW), DELTA_LOCAL_MAX_DYAW);
+        } else if (env->dynamics_model == STATE_DYNAMICS) {
+            out[0] = agent->traj_x[t + 1];
+            out[1] = agent->traj_y[t + 1];
+            out[2] = agent->traj_heading[t + 1];
+            out[3] = agent->traj_vx[t + 1];
+            out[4] = agent->traj_vy[t + 1];
+        }
+
+        if (env->action_type == 1) {
+            float* row = (float*)actions + i*dim;
+            for (int k = 0; k < dim; k++) row[k] = out[k];
+        } else {
+            int (*action_array)[2] = (int(*)[2])actions;
+            if (!ok) {
+                action_array[i][0] = nearest_value_index(ACCELERATION_VALUES, 7, 0.0f);
+                action_array[i][1] = nearest_value_index(STEERING_VALUES, 13, 0.0f);
+                continue;
+            }
+            action_array[i][0] = nearest_value_index(ACCELERATION_VALUES, 7, out[0]);
+            if (env->dynamics_model == CLASSIC) {
+                action_array[i][1] = nearest_value_index(env->steering_yaw_factor, 13, out[1]);
+            } else {
+                action_array[i][1] = nearest_value_index(STEERING_VALUES, 13, out[1]);
+            }
+        }
+    }
+}
+
 float normalize_value(float value, float min, float max){
     return (value - min) / (max - min);
 }
@@ -1703,24 +2806,56 @@ float reverse_normalize_value(float value, float min, float max){
     return value*50.0f;
 }
 
+// Empties n road slots. The flat decoders one-hot an all-zero slot as type 0,
+// so structured slots get the same one-hot and both layouts decode alike.
+static void clear_road_slots(Drive* env, float* slots, int n) {
+    int road_dim = road_features(env);
+    memset(slots, 0, n*road_dim*sizeof(float));
+    if (road_dim == ROAD_FEATURES_FLAT) return;
+    for (int k = 0; k < n; k++) slots[k*road_dim + 6] = 1.0f;
+}
+
+// Empties the slots of row i written by the previous compute_observations
+static void clear_obs_row(Drive* env, float* row, int i) {
+    int header = env->obs_header ? OBS_HEADER_SIZE : 0;
+    float* obs = row + header;
+    memset(row, 0, (header + 7)*sizeof(float));
+    memset(&obs[7], 0, env->obs_partner_count[i]*7*sizeof(float));
+    clear_road_slots(env, &obs[obs_road_offset(env)], env->obs_road_count[i]);
+    encode_obs_row(env, i, env->obs_partner_count[i], env->obs_road_count[i]);
+    env->obs_partner_count[i] = 0;
+    env->obs_road_count[i] = 0;
+}
+
 void compute_observations(Drive* env) {
-    int max_obs = 7 + 7*(MAX_AGENTS - 1) + 7*MAX_ROAD_SEGMENT_OBSERVATIONS;
-    memset(env->observations, 0, max_obs*env->active_agent_count*sizeof(float));
+    int max_obs = obs_size(env);
+    int header = env->obs_header ? OBS_HEADER_SIZE : 0;
+    int road_dim = road_features(env);
     float (*observations)[max_obs] = (float(*)[max_obs])env->observations;
+    SimState* sim = &env->sim;
+    AgentGrid* grid = &env->agent_grid;
+    build_agent_grid(env);  // respawns may have moved agents since the last build
     for(int i = 0; i < env->active_agent_count; i++) {
-        float* obs = &observations[i][0];
-        Entity* ego_entity = &env->entities[env->active_agent_indices[i]];
-        if(ego_entity->type > 3) break;
-        if(ego_entity->respawn_timestep != -1) {
-            obs[6] = 1;
-            //continue;
-        }
-        float cos_heading = ego_entity->heading_x;
-        float sin_heading = ego_entity->heading_y;
-        float ego_speed = sqrtf(ego_entity->vx*ego_entity->vx + ego_entity->vy*ego_entity->vy);
+        float* row = &observations[i][0];
+        float* obs = row + header;
+        int ego_idx = env->active_agent_indices[i];
+        Entity* ego_entity = &env->entities[ego_idx];
+        AgentState* ego_state = &env->agent_states[ego_idx];
+        // Non-vehicle rows and agents that finished on an earlier step stay zeroed
+        if(ego_entity->type > 3 || (sim->done[ego_idx] && !env->terminals[i])) {
+            clear_obs_row(env, row, i);
+            continue;
+        }
+        int ego_respawned = sim->respawn_timestep[ego_idx] != -1;
+        obs[6] = ego_respawned ? 1.0f : 0.0f;
+        float ego_x = sim->x[ego_idx];
+        float ego_y = sim->y[ego_idx];
+        float cos_heading = sim->heading_x[ego_idx];
+        float sin_heading = sim->heading_y[ego_idx];
+        float ego_speed = sqrtf(sim->vx[ego_idx]*sim->vx[ego_idx] + sim->vy[ego_idx]*sim->vy[ego_idx]);
         // Set goal distances
-        float goal_x = ego_entity->goal_position_x - ego_entity->x;
-        float goal_y = ego_entity->goal_position_y - ego_entity->y;
+        float goal_x = ego_state->goal_position_x - ego_x;
+        float goal_y = ego_state->goal_position_y - ego_y;
         // Rotate to ego vehicle's frame
         float rel_goal_x = goal_x*cos_heading + goal_y*sin_heading;
         float rel_goal_y = -goal_x*sin_heading + goal_y*cos_heading;
@@ -1732,29 +2867,54 @@ void compute_observations(Drive* env) {
         obs[2] = ego_speed * 0.01f;
         obs[3] = ego_entity->width / MAX_VEH_WIDTH;
         obs[4] = ego_entity->length / MAX_VEH_LEN;
-        obs[5] = (ego_entity->collision_state > 0) ? 1.0f : 0.0f;
+        obs[5] = (sim->collision_state[ego_idx] > 0) ? 1.0f : 0.0f;
 
-        // Relative Pos of other cars
+        // Relative Pos of the max_partners nearest other cars within 50 m,
+        // kept sorted by (distance, slot) with an insertion pass over the
+        // agents in the surrounding cells of the agent grid
         int obs_idx = 7;  // Start after goal distances
         int cars_seen = 0;
-        for(int j = 0; j < MAX_AGENTS; j++) {
-            int index = -1;
-            if(j < env->active_agent_count){
-                index = env->active_agent_indices[j];
-            } else if (j < env->num_controllable_agents){
-                index = env->static_car_indices[j - env->active_agent_count];
+        int nearest[MAX_PARTNER_OBSERVATIONS];
+        int nearest_slot[MAX_PARTNER_OBSERVATIONS];
+        float nearest_dist[MAX_PARTNER_OBSERVATIONS];
+        int num_nearest = 0;
+        int max_partners = env->max_partners;
+        int col0, col1, row0, row1;
+        agent_grid_range(grid, ego_x, ego_y, 50.0f, &col0, &col1, &row0, &row1);
+        for(int row = row0; row <= row1 && !ego_respawned; row++) {
+            for(int col = col0; col <= col1; col++) {
+                int cell = row*grid->cols + col;
+                for(int k = grid->cell_start[cell]; k < grid->cell_start[cell + 1]; k++) {
+                    int slot = grid->slots[k];
+                    int index = agent_slot_index(env, slot);
+                    if(env->entities[index].type > 3) continue;
+                    if(index == ego_idx) continue;  // Skip self, but don't increment obs_idx
+                    if(sim->respawn_timestep[index] != -1) continue;
+                    if(sim->done[index]) continue;
+                    float dx = sim->x[index] - ego_x;
+                    float dy = sim->y[index] - ego_y;
+                    float dist = (dx*dx + dy*dy);
+                    if(dist > 2500.0f) continue;
+                    if(num_nearest == max_partners && !agent_closer(dist, slot, nearest_dist[max_partners - 1], nearest_slot[max_partners - 1])) continue;
+                    int pos = num_nearest < max_partners ? num_nearest++ : max_partners - 1;
+                    while(pos > 0 && agent_closer(dist, slot, nearest_dist[pos - 1], nearest_slot[pos - 1])) {
+                        nearest[pos] = nearest[pos - 1];
+                        nearest_slot[pos] = nearest_slot[pos - 1];
+                        nearest_dist[pos] = nearest_dist[pos - 1];
+                        pos--;
+                    }
+                    nearest[pos] = index;
+                    nearest_slot[pos] = slot;
+                    nearest_dist[pos] = dist;
+                }
             }
-            if(index == -1) continue;
-            if(env->entities[index].type > 3) break;
-            if(index == env->active_agent_indices[i]) continue;  // Skip self, but don't increment obs_idx
+        }
+        for(int n = 0; n < num_nearest; n++) {
+            int index = nearest[n];
             Entity* other_entity = &env->entities[index];
-            if(ego_entity->respawn_timestep != -1) continue;
-            if(other_entity->respawn_timestep != -1) continue;
             // Store original relative positions
-            float dx = other_entity->x - ego_entity->x;
-            float dy = other_entity->y - ego_entity->y;
-            float dist = (dx*dx + dy*dy);
-            if(dist > 2500.0f) continue;
+            float dx = sim->x[index] - ego_x;
+            float dy = sim->y[index] - ego_y;
             // Rotate to ego vehicle's frame
             float rel_x = dx*cos_heading + dy*sin_heading;
             float rel_y = -dx*sin_heading + dy*cos_heading;
@@ -1764,29 +2924,35 @@ void compute_observations(Drive* env) {
             obs[obs_idx + 2] = other_entity->width / MAX_VEH_WIDTH;
             obs[obs_idx + 3] = other_entity->length / MAX_VEH_LEN;
             // relative heading
-            float rel_heading_x = other_entity->heading_x * ego_entity->heading_x +
-                     other_entity->heading_y * ego_entity->heading_y;  // cos(a-b) = cos(a)cos(b) + sin(a)sin(b)
-            float rel_heading_y = other_entity->heading_y * ego_entity->heading_x -
-                                other_entity->heading_x * ego_entity->heading_y;  // sin(a-b) = sin(a)cos(b) - cos(a)sin(b)
+            float rel_heading_x = sim->heading_x[index] * cos_heading +
+                     sim->heading_y[index] * sin_heading;  // cos(a-b) = cos(a)cos(b) + sin(a)sin(b)
+            float rel_heading_y = sim->heading_y[index] * cos_heading -
+                                sim->heading_x[index] * sin_heading;  // sin(a-b) = sin(a)cos(b) - cos(a)sin(b)
 
             obs[obs_idx + 4] = rel_heading_x;
             obs[obs_idx + 5] = rel_heading_y;
             // obs[obs_idx + 4] = cosf(rel_heading) / MAX_ORIENTATION_RAD;
             // obs[obs_idx + 5] = sinf(rel_heading) / MAX_ORIENTATION_RAD;
             // // relative speed
-            float other_speed = sqrtf(other_entity->vx*other_entity->vx + other_entity->vy*other_entity->vy);
+            float other_speed = sqrtf(sim->vx[index]*sim->vx[index] + sim->vy[index]*sim->vy[index]);
             obs[obs_idx + 6] = other_speed / MAX_SPEED;
             cars_seen++;
             obs_idx += 7;  // Move to next observation slot
         }
-        int remaining_partner_obs = (MAX_AGENTS - 1 - cars_seen) * 7;
-        memset(&obs[obs_idx], 0, remaining_partner_obs * sizeof(float));
-        obs_idx += remaining_partner_obs;
+        // Only clear the slots that held partners last time
+        int partner_slots = cars_seen;
+        if(env->obs_partner_count[i] > cars_seen) {
+            memset(&obs[obs_idx], 0, (env->obs_partner_count[i] - cars_seen) * 7 * sizeof(float));
+            partner_slots = env->obs_partner_count[i];
+        }
+        env->obs_partner_count[i] = cars_seen;
+        obs_idx = obs_road_offset(env);
+        int road_start = obs_idx;
         // map observations
         GridMapEntity entity_list[MAX_ENTITIES_PER_CELL*25];
-        int grid_idx = getGridIndex(env, ego_entity->x, ego_entity->y);
+        int grid_idx = getGridIndex(env, ego_x, ego_y);
 
-        int list_size = get_neighbor_cache_entities(env, grid_idx, entity_list, MAX_ROAD_SEGMENT_OBSERVATIONS);
+        int list_size = get_neighbor_cache_entities(env, grid_idx, entity_list, env->max_roads);
 
         for(int k = 0; k < list_size; k++) {
             int entity_idx = entity_list[k].entity_idx;
@@ -1812,8 +2978,8 @@ void compute_observations(Drive* env) {
             float end_y = entity->traj_y[geometry_idx+1];
             float mid_x = (start_x + end_x) / 2.0f;
             float mid_y = (start_y + end_y) / 2.0f;
-            float rel_x = mid_x - ego_entity->x;
-            float rel_y = mid_y - ego_entity->y;
+            float rel_x = mid_x - ego_x;
+            float rel_y = mid_y - ego_y;
             float x_obs = rel_x*cos_heading + rel_y*sin_heading;
             float y_obs = -rel_x*sin_heading + rel_y*cos_heading;
             float length = relative_distance_2d(mid_x, mid_y, end_x, end_y);
@@ -1837,16 +3003,35 @@ void compute_observations(Drive* env) {
             obs[obs_idx + 3] = width / MAX_ROAD_SCALE;
             obs[obs_idx + 4] = cos_angle;
             obs[obs_idx + 5] = sin_angle;
-            obs[obs_idx + 6] = entity->type - 4.0f;
-            obs_idx += 7;
+            if(road_dim == ROAD_FEATURES_FLAT) {
+                obs[obs_idx + 6] = entity->type - 4.0f;
+            } else {
+                memset(&obs[obs_idx + 6], 0, NUM_ROAD_TYPES*sizeof(float));
+                int road_type = entity->type - ROAD_LANE;
+                if(road_type >= 0 && road_type < NUM_ROAD_TYPES) obs[obs_idx + 6 + road_type] = 1.0f;
+            }
+            obs_idx += road_dim;
+        }
+        int roads_seen = (obs_idx - road_start) / road_dim;
+        int road_slots = roads_seen;
+        if(env->obs_road_count[i] > roads_seen) {
+            clear_road_slots(env, &obs[obs_idx], env->obs_road_count[i] - roads_seen);
+            road_slots = env->obs_road_count[i];
         }
-        int remaining_obs = (MAX_ROAD_SEGMENT_OBSERVATIONS - list_size) * 7;
-        // Set the entire block to 0 at once
-        memset(&obs[obs_idx], 0, remaining_obs * sizeof(float));
+        env->obs_road_count[i] = roads_seen;
+        if(header) {
+            row[0] = (float)cars_seen;
+            row[1] = (float)roads_seen;
+        }
+        encode_obs_row(env, i, partner_slots, road_slots);
     }
 }
 
-static int find_forward_projection_on_lane(Entity* lane, Entity* agent, int* out_segment_idx, float* out_fraction) {
+static int find_forward_projection_on_lane(Drive* env, Entity* lane, int agent_idx, int* out_segment_idx, float* out_fraction) {
+    float agent_x = env->sim.x[agent_idx];
+    float agent_y = env->sim.y[agent_idx];
+    float heading_x = env->sim.heading_x[agent_idx];
+    float heading_y = env->sim.heading_y[agent_idx];
     int best_idx = -1;
     float best_dist_sq = 1e30f;
 
@@ -1860,8 +3045,8 @@ static int find_forward_projection_on_lane(Entity* lane, Entity* agent, int* out
         float seg_len_sq = dx * dx + dy * dy;
         if (seg_len_sq < 1e-6f) continue;
 
-        float to_agent_x = agent->x - x0;
-        float to_agent_y = agent->y - y0;
+        float to_agent_x = agent_x - x0;
+        float to_agent_y = agent_y - y0;
         float t = (to_agent_x * dx + to_agent_y * dy) / seg_len_sq;
         if (t < 0.0f) t = 0.0f;
         else if (t > 1.0f) t = 1.0f;
@@ -1869,9 +3054,9 @@ static int find_forward_projection_on_lane(Entity* lane, Entity* agent, int* out
         float proj_x = x0 + t * dx;
         float proj_y = y0 + t * dy;
 
-        float rel_x = proj_x - agent->x;
-        float rel_y = proj_y - agent->y;
-        float forward = rel_x * agent->heading_x + rel_y * agent->heading_y;
+        float rel_x = proj_x - agent_x;
+        float rel_y = proj_y - agent_y;
+        float forward = rel_x * heading_x + rel_y * heading_y;
         if (forward < 0.0f) continue;
 
         float dist_sq = rel_x * rel_x + rel_y * rel_y;
@@ -1891,7 +3076,7 @@ static int find_forward_projection_on_lane(Entity* lane, Entity* agent, int* out
 }
 
 void compute_new_goal(Drive* env, int agent_idx) {
-    Entity* agent = &env->entities[agent_idx];
+    AgentState* agent = &env->agent_states[agent_idx];
     int current_lane = agent->current_lane_idx;
 
     if (current_lane == -1) return; // No current lane
@@ -1903,12 +3088,12 @@ void compute_new_goal(Drive* env, int agent_idx) {
 
     int initial_segment_idx = 1;
     float initial_fraction = 0.0f;
-    if (!find_forward_projection_on_lane(lane, agent, &initial_segment_idx, &initial_fraction)) {
+    if (!find_forward_projection_on_lane(env, lane, agent_idx, &initial_segment_idx, &initial_fraction)) {
         int forward_idx = -1;
         for (int i = 0; i < lane->array_size; i++) {
-            float to_point_x = lane->traj_x[i] - agent->x;
-            float to_point_y = lane->traj_y[i] - agent->y;
-            float dot = to_point_x * agent->heading_x + to_point_y * agent->heading_y;
+            float to_point_x = lane->traj_x[i] - env->sim.x[agent_idx];
+            float to_point_y = lane->traj_y[i] - env->sim.y[agent_idx];
+            float dot = to_point_x * env->sim.heading_x[agent_idx] + to_point_y * env->sim.heading_y[agent_idx];
             if (dot > 0.0f) {
                 forward_idx = i;
                 break;
@@ -1968,158 +3153,262 @@ void compute_new_goal(Drive* env, int agent_idx) {
             return; // No further lanes to traverse
         }
 
-        int random_idx = agent_idx % num_connected;
+        int random_idx = env->entities[agent_idx].id % num_connected;
         current_entity = connected_lanes[random_idx];
     }
 }
 
+// masks[i] is 0 once agent i finished on an earlier step, so its outputs are stale
+static void update_masks(Drive* env){
+    if(env->masks == NULL) return;
+    for(int i = 0; i < env->active_agent_count; i++){
+        int agent_idx = env->active_agent_indices[i];
+        env->masks[i] = !(env->sim.done[agent_idx] && !env->terminals[i]);
+    }
+}
+
+static void save_reset_state(Drive* env) {
+    ResetState* state = &env->reset_state;
+    free_reset_state(state);
+    size_t sim_bytes = (size_t)SIM_STATE_FIELDS*env->sim.capacity*sizeof(float);
+    size_t states = (size_t)(env->num_objects > 0 ? env->num_objects : 1)*sizeof(AgentState);
+    size_t rows = (size_t)env->active_agent_count*obs_size(env);
+    size_t counts = (size_t)env->active_agent_count*sizeof(int);
+    state->sim = malloc(sim_bytes);
+    memcpy(state->sim, env->sim.data, sim_bytes);
+    state->agent_states = (AgentState*)malloc(states);
+    memcpy(state->agent_states, env->agent_states, states);
+    state->observations = (float*)malloc(rows*sizeof(float) + 1);
+    memcpy(state->observations, env->observations, rows*sizeof(float));
+    if (env->obs_out) {
+        state->obs_out = malloc(rows*obs_elem_size(env) + 1);
+        memcpy(state->obs_out, env->obs_out, rows*obs_elem_size(env));
+    }
+    state->obs_partner_count = (int*)malloc(counts + 1);
+    memcpy(state->obs_partner_count, env->obs_partner_count, counts);
+    state->obs_road_count = (int*)malloc(counts + 1);
+    memcpy(state->obs_road_count, env->obs_road_count, counts);
+    state->valid = 1;
+}
+
+// The cached equivalent of the reset below: start positions, metrics, the first
+// observations and their slot counts
+static void load_reset_state(Drive* env) {
+    ResetState* state = &env->reset_state;
+    size_t rows = (size_t)env->active_agent_count*obs_size(env);
+    memcpy(env->sim.data, state->sim, (size_t)SIM_STATE_FIELDS*env->sim.capacity*sizeof(float));
+    memcpy(env->agent_states, state->agent_states, (size_t)(env->num_objects > 0 ? env->num_objects : 1)*sizeof(AgentState));
+    memset(env->logs, 0, env->active_agent_count*sizeof(Log));
+    env->done_count = 0;
+    build_agent_grid(env);
+    memcpy(env->observations, state->observations, rows*sizeof(float));
+    if (env->obs_out) memcpy(env->obs_out, state->obs_out, rows*obs_elem_size(env));
+    memcpy(env->obs_partner_count, state->obs_partner_count, env->active_agent_count*sizeof(int));
+    memcpy(env->obs_road_count, state->obs_road_count, env->active_agent_count*sizeof(int));
+    update_masks(env);
+}
+
 void c_reset(Drive* env){
+    if (env->num_scenarios > 0) {
+        for (int s = 0; s < env->num_scenarios; s++) {
+            rng_seed(&env->scenarios[s].rng, rng_next(&env->rng), s);
+            c_reset(&env->scenarios[s]);
+        }
+        fold_scenario_logs(env);
+        return;
+    }
     env->timestep = env->init_steps;
+    if (env->reset_state.valid) {
+        load_reset_state(env);
+        return;
+    }
+    invalidate_obs_counts(env);
     set_start_position(env);
+    memset(env->sim.done, 0, env->sim.capacity*sizeof(int));
+    env->done_count = 0;
+    build_agent_grid(env);
     for(int x = 0;x<env->active_agent_count; x++){
         env->logs[x] = (Log){0};
         int agent_idx = env->active_agent_indices[x];
-        env->entities[agent_idx].respawn_timestep = -1;
-        env->entities[agent_idx].respawn_count = 0;
-        env->entities[agent_idx].collided_before_goal = 0;
-        env->entities[agent_idx].reached_goal_this_episode = 0;
-        env->entities[agent_idx].metrics_array[COLLISION_IDX] = 0.0f;
-        env->entities[agent_idx].metrics_array[OFFROAD_IDX] = 0.0f;
-        env->entities[agent_idx].metrics_array[REACHED_GOAL_IDX] = 0.0f;
-        env->entities[agent_idx].metrics_array[LANE_ALIGNED_IDX] = 0.0f;
-        env->entities[agent_idx].metrics_array[AVG_DISPLACEMENT_ERROR_IDX] = 0.0f;
-        env->entities[agent_idx].cumulative_displacement = 0.0f;
-        env->entities[agent_idx].displacement_sample_count = 0;
+        AgentState* state = &env->agent_states[agent_idx];
+        env->sim.respawn_timestep[agent_idx] = -1;
+        state->respawn_count = 0;
+        state->collided_before_goal = 0;
+        state->reached_goal_this_episode = 0;
+        state->metrics_array[COLLISION_IDX] = 0.0f;
+        state->metrics_array[OFFROAD_IDX] = 0.0f;
+        state->metrics_array[REACHED_GOAL_IDX] = 0.0f;
+        state->metrics_array[LANE_ALIGNED_IDX] = 0.0f;
+        state->metrics_array[AVG_DISPLACEMENT_ERROR_IDX] = 0.0f;
+        state->cumulative_displacement = 0.0f;
+        state->displacement_sample_count = 0;
 
         if (env->use_goal_generation) {
-            env->entities[agent_idx].goal_position_x = env->entities[agent_idx].init_goal_x;
-            env->entities[agent_idx].goal_position_y = env->entities[agent_idx].init_goal_y;
-            env->entities[agent_idx].sampled_new_goal = 0;
+            state->goal_position_x = env->entities[agent_idx].goal_position_x;
+            state->goal_position_y = env->entities[agent_idx].goal_position_y;
+            state->sampled_new_goal = 0;
         }
 
         compute_agent_metrics(env, agent_idx);
     }
     compute_observations(env);
+    update_masks(env);
+    if (env->reset_cache) save_reset_state(env);
 }
 
 void respawn_agent(Drive* env, int agent_idx){
-    env->entities[agent_idx].x = env->entities[agent_idx].traj_x[0];
-    env->entities[agent_idx].y = env->entities[agent_idx].traj_y[0];
-    env->entities[agent_idx].heading = env->entities[agent_idx].traj_heading[0];
-    env->entities[agent_idx].heading_x = cosf(env->entities[agent_idx].heading);
-    env->entities[agent_idx].heading_y = sinf(env->entities[agent_idx].heading);
-    env->entities[agent_idx].vx = env->entities[agent_idx].traj_vx[0];
-    env->entities[agent_idx].vy = env->entities[agent_idx].traj_vy[0];
-    env->entities[agent_idx].metrics_array[COLLISION_IDX] = 0.0f;
-    env->entities[agent_idx].metrics_array[OFFROAD_IDX] = 0.0f;
-    env->entities[agent_idx].metrics_array[REACHED_GOAL_IDX] = 0.0f;
-    env->entities[agent_idx].metrics_array[LANE_ALIGNED_IDX] = 0.0f;
-    env->entities[agent_idx].metrics_array[AVG_DISPLACEMENT_ERROR_IDX] = 0.0f;
-    env->entities[agent_idx].cumulative_displacement = 0.0f;
-    env->entities[agent_idx].displacement_sample_count = 0;
-    env->entities[agent_idx].respawn_timestep = env->timestep;
+    Entity* agent = &env->entities[agent_idx];
+    AgentState* state = &env->agent_states[agent_idx];
+    SimState* sim = &env->sim;
+    sim->x[agent_idx] = agent->traj_x[0];
+    sim->y[agent_idx] = agent->traj_y[0];
+    sim->heading[agent_idx] = agent->traj_heading[0];
+    sim->heading_x[agent_idx] = cosf(sim->heading[agent_idx]);
+    sim->heading_y[agent_idx] = sinf(sim->heading[agent_idx]);
+    sim->vx[agent_idx] = agent->traj_vx[0];
+    sim->vy[agent_idx] = agent->traj_vy[0];
+    state->metrics_array[COLLISION_IDX] = 0.0f;
+    state->metrics_array[OFFROAD_IDX] = 0.0f;
+    state->metrics_array[REACHED_GOAL_IDX] = 0.0f;
+    state->metrics_array[LANE_ALIGNED_IDX] = 0.0f;
+    state->metrics_array[AVG_DISPLACEMENT_ERROR_IDX] = 0.0f;
+    state->cumulative_displacement = 0.0f;
+    state->displacement_sample_count = 0;
+    sim->respawn_timestep[agent_idx] = env->timestep;
 }
 
-void c_step(Drive* env){
-    memset(env->rewards, 0, env->active_agent_count * sizeof(float));
-    memset(env->terminals, 0, env->active_agent_count * sizeof(unsigned char));
+// Advances the simulation by one 0.1 s tick with the current actions, adding
+// the tick's rewards into env->rewards. Returns 1 if the scenario ended and
+// the env was reset (which also refreshes the observations).
+static int physics_substep(Drive* env){
     env->timestep++;
-    if(env->timestep == env->scenario_length){
+    // With async episodes the scenario also ends once every agent has finished
+    if(env->timestep == env->scenario_length ||
+            (env->done_count > 0 && env->done_count == env->active_agent_count)){
         add_log(env);
 	    c_reset(env);
-        return;
+        return 1;
     }
 
-    // Move statix experts
-    for (int i = 0; i < env->expert_static_car_count; i++) {
-        int expert_idx = env->expert_static_car_indices[i];
-        if(env->entities[expert_idx].x == INVALID_POSITION) continue;
-        move_expert(env, env->actions, expert_idx);
-    }
+    // Move static experts along their logs
+    replay_experts(env);
     // Process actions for all active agents
     for(int i = 0; i < env->active_agent_count; i++){
+        int agent_idx = env->active_agent_indices[i];
+        if(env->sim.done[agent_idx]) continue;
         env->logs[i].score = 0.0f;
 	    env->logs[i].episode_length += 1;
-        int agent_idx = env->active_agent_indices[i];
-        env->entities[agent_idx].collision_state = 0;
-        move_dynamics(env, i, agent_idx);
+        env->sim.collision_state[agent_idx] = 0;
         // move_expert(env, env->actions, agent_idx);
     }
+    move_dynamics_batch(env);
+    build_agent_grid(env);
     for(int i = 0; i < env->active_agent_count; i++){
         int agent_idx = env->active_agent_indices[i];
-        env->entities[agent_idx].collision_state = 0;
-        //if(env->entities[agent_idx].respawn_timestep != -1) continue;
-        compute_agent_metrics(env, agent_idx);
-        int collision_state = env->entities[agent_idx].collision_state;
+        AgentState* state = &env->agent_states[agent_idx];
+        if(env->sim.done[agent_idx]) continue;
+        env->sim.collision_state[agent_idx] = 0;
+        //if(env->sim.respawn_timestep[agent_idx] != -1) continue;
+        int collided_with = compute_agent_metrics(env, agent_idx);
+        int collision_state = env->sim.collision_state[agent_idx];
 
         if(collision_state > 0){
+            if(env->event_capacity > 0){
+                record_event(env, i, collided_with, collision_state,
+                    env->sim.x[agent_idx], env->sim.y[agent_idx]);
+            }
             if(collision_state == VEHICLE_COLLISION){
-                env->rewards[i] = env->reward_vehicle_collision;
+                env->rewards[i] += env->reward_vehicle_collision;
                 env->logs[i].episode_return += env->reward_vehicle_collision;
                 env->logs[i].collision_rate = 1.0f;
                 env->logs[i].avg_collisions_per_agent += 1.0f;
             }
             else if(collision_state == OFFROAD){
-                env->rewards[i] = env->reward_offroad_collision;
+                env->rewards[i] += env->reward_offroad_collision;
                 env->logs[i].offroad_rate = 1.0f;
                 env->logs[i].episode_return += env->reward_offroad_collision;
                 env->logs[i].avg_offroad_per_agent += 1.0f;
             }
-            if(!env->entities[agent_idx].reached_goal_this_episode){
-                env->entities[agent_idx].collided_before_goal = 1;
+            if(!state->reached_goal_this_episode){
+                state->collided_before_goal = 1;
             }
         }
 
         float distance_to_goal = relative_distance_2d(
-                env->entities[agent_idx].x,
-                env->entities[agent_idx].y,
-                env->entities[agent_idx].goal_position_x,
-                env->entities[agent_idx].goal_position_y);
+                env->sim.x[agent_idx],
+                env->sim.y[agent_idx],
+                state->goal_position_x,
+                state->goal_position_y);
 
         // Reward agent if it is within X meters of goal
         if(distance_to_goal < env->goal_radius){
-            if(env->entities[agent_idx].respawn_timestep != -1){
+            if(env->sim.respawn_timestep[agent_idx] != -1){
                 env->rewards[i] += env->reward_goal_post_respawn;
                 env->logs[i].episode_return += env->reward_goal_post_respawn;
             } else {
                 env->rewards[i] += env->reward_goal;
                 env->logs[i].episode_return += env->reward_goal;
-                env->entities[agent_idx].sampled_new_goal = 1;
+                state->sampled_new_goal = 1;
                 env->logs[i].num_goals_reached += 1;
             }
-            env->entities[agent_idx].reached_goal_this_episode = 1;
-            env->entities[agent_idx].metrics_array[REACHED_GOAL_IDX] = 1.0f;
+            state->reached_goal_this_episode = 1;
+            state->metrics_array[REACHED_GOAL_IDX] = 1.0f;
 	    }
 
-        if (env->use_goal_generation && env->entities[agent_idx].sampled_new_goal) {
+        if (env->use_goal_generation && state->sampled_new_goal) {
             compute_new_goal(env, agent_idx);
         }
 
-        int lane_aligned = env->entities[agent_idx].metrics_array[LANE_ALIGNED_IDX];
+        int lane_aligned = state->metrics_array[LANE_ALIGNED_IDX];
         env->logs[i].lane_alignment_rate = lane_aligned;
 
         // Apply ADE reward
-        float current_ade = env->entities[agent_idx].metrics_array[AVG_DISPLACEMENT_ERROR_IDX];
+        float current_ade = state->metrics_array[AVG_DISPLACEMENT_ERROR_IDX];
         if(current_ade > 0.0f && env->reward_ade != 0.0f) {
             float ade_reward = env->reward_ade * current_ade;
             env->rewards[i] += ade_reward;
             env->logs[i].episode_return += ade_reward;
         }
         env->logs[i].avg_displacement_error = current_ade;
+
+        if(env->async_episodes){
+            // Goal generation keeps agents going after a goal, so only crashes end them
+            int reached_goal = !env->use_goal_generation && state->metrics_array[REACHED_GOAL_IDX];
+            if(collision_state > 0 || reached_goal){
+                env->sim.done[agent_idx] = 1;
+                env->terminals[i] = 1;
+                env->done_count++;
+            }
+        }
     }
 
-    if (!env->use_goal_generation) {
+    if (!env->use_goal_generation && !env->async_episodes) {
         for(int i = 0; i < env->active_agent_count; i++){
             int agent_idx = env->active_agent_indices[i];
-            int reached_goal = env->entities[agent_idx].metrics_array[REACHED_GOAL_IDX];
+            int reached_goal = env->agent_states[agent_idx].metrics_array[REACHED_GOAL_IDX];
             if(reached_goal){
                 respawn_agent(env, agent_idx);
-                env->entities[agent_idx].respawn_count++;
+                env->agent_states[agent_idx].respawn_count++;
             }
         }
     }
+    return 0;
+}
 
+void c_step(Drive* env){
+    if (env->num_scenarios > 0) {
+        for (int s = 0; s < env->num_scenarios; s++) c_step(&env->scenarios[s]);
+        fold_scenario_logs(env);
+        return;
+    }
+    memset(env->rewards, 0, env->active_agent_count * sizeof(float));
+    memset(env->terminals, 0, env->active_agent_count * sizeof(unsigned char));
+    // Hold the actions for action_repeat ticks; rewards and events accumulate
+    for(int k = 0; k < env->action_repeat; k++){
+        if(physics_substep(env)) return;
+    }
     compute_observations(env);
+    update_masks(env);
 }
 
 const Color STONE_GRAY = (Color){80, 80, 80, 255};
@@ -2139,7 +3428,7 @@ struct Client {
     float camera_zoom;
     Camera3D camera;
     Model cars[6];
-    int car_assignments[MAX_AGENTS];  // To keep car model assignments consistent per vehicle
+    int* car_assignments;  // To keep car model assignments consistent per vehicle, one per object
     Vector3 default_camera_position;
     Vector3 default_camera_target;
 };
@@ -2158,8 +3447,9 @@ Client* make_client(Drive* env){
     client->cars[3] = LoadModel("resources/drive/YellowCar.glb");
     client->cars[4] = LoadModel("resources/drive/GreenCar.glb");
     client->cars[5] = LoadModel("resources/drive/GreyCar.glb");
-    for (int i = 0; i < MAX_AGENTS; i++) {
-        client->car_assignments[i] = (rand() % 4) + 1;
+    client->car_assignments = (int*)malloc((env->num_objects > 0 ? env->num_objects : 1) * sizeof(int));
+    for (int i = 0; i < env->num_objects; i++) {
+        client->car_assignments[i] = rng_int(&env->rng, 4) + 1;
     }
     // Get initial target position from first active agent
     Vector3 target_pos = {
@@ -2274,15 +3564,15 @@ void draw_agent_obs(Drive* env, int agent_index, int mode, int obs_only, int las
         return;
     }
 
-    int max_obs = 7 + 7*(MAX_AGENTS - 1) + 7*MAX_ROAD_SEGMENT_OBSERVATIONS;
+    int max_obs = obs_size(env);
     float (*observations)[max_obs] = (float(*)[max_obs])env->observations;
-    float* agent_obs = &observations[agent_index][0];
+    float* agent_obs = &observations[agent_index][env->obs_header ? OBS_HEADER_SIZE : 0];
     // self
     int active_idx = env->active_agent_indices[agent_index];
-    float heading_self_x = env->entities[active_idx].heading_x;
-    float heading_self_y = env->entities[active_idx].heading_y;
-    float px = env->entities[active_idx].x;
-    float py = env->entities[active_idx].y;
+    float heading_self_x = env->sim.heading_x[active_idx];
+    float heading_self_y = env->sim.heading_y[active_idx];
+    float px = env->sim.x[active_idx];
+    float py = env->sim.y[active_idx];
     // draw goal
     float goal_x = agent_obs[0] * 200;
     float goal_y = agent_obs[1] * 200;
@@ -2299,7 +3589,7 @@ void draw_agent_obs(Drive* env, int agent_index, int mode, int obs_only, int las
     }
     // First draw other agent observations
     int obs_idx = 7;  // Start after goal distances
-    for(int j = 0; j < MAX_AGENTS - 1; j++) {
+    for(int j = 0; j < env->max_partners; j++) {
         if(agent_obs[obs_idx] == 0 || agent_obs[obs_idx + 1] == 0) {
             obs_idx += 7;  // Move to next agent observation
             continue;
@@ -2446,14 +3736,14 @@ void draw_agent_obs(Drive* env, int agent_index, int mode, int obs_only, int las
         obs_idx += 7;  // Move to next agent observation (7 values per agent)
     }
     // Then draw map observations
-    int map_start_idx = 7 + 7*(MAX_AGENTS - 1);  // Start after agent observations
-    for(int k = 0; k < MAX_ROAD_SEGMENT_OBSERVATIONS; k++) {  // Loop through potential map entities
-        int entity_idx = map_start_idx + k*7;
+    int map_start_idx = obs_road_offset(env);  // Start after agent observations
+    for(int k = 0; k < env->max_roads; k++) {  // Loop through potential map entities
+        int entity_idx = map_start_idx + k*road_features(env);
         if(agent_obs[entity_idx] == 0 && agent_obs[entity_idx + 1] == 0){
             continue;
         }
         Color lineColor = BLUE;  // Default color
-        int entity_type = (int)agent_obs[entity_idx + 6];
+        int entity_type = obs_road_type(env, &agent_obs[entity_idx]);
         // Choose color based on entity type
         if(entity_type+4 != ROAD_EDGE){
             continue;
@@ -2603,17 +3893,17 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
                 }
             }
             // HIDE CARS ON RESPAWN - IMPORTANT TO KNOW VISUAL SETTING
-            if((!is_active_agent && !is_static_car) || env->entities[i].respawn_timestep != -1){
+            if((!is_active_agent && !is_static_car) || env->sim.respawn_timestep[i] != -1){
                 continue;
             }
             Vector3 position;
             float heading;
             position = (Vector3){
-                env->entities[i].x,
-                env->entities[i].y,
+                env->sim.x[i],
+                env->sim.y[i],
                 1
             };
-            heading = env->entities[i].heading;
+            heading = env->sim.heading[i];
             // Create size vector
             Vector3 size = {
                 env->entities[i].length,
@@ -2625,8 +3915,8 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
 
             // Save current transform
             if(mode==1){
-                float cos_heading = env->entities[i].heading_x;
-                float sin_heading = env->entities[i].heading_y;
+                float cos_heading = env->sim.heading_x[i];
+                float sin_heading = env->sim.heading_y[i];
 
                 // Calculate half dimensions
                 float half_len = env->entities[i].length * 0.5f;
@@ -2660,7 +3950,7 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
 
                 };
 
-                if(agent_index == env->human_agent_idx && !env->entities[agent_index].metrics_array[REACHED_GOAL_IDX]) {
+                if(agent_index == env->human_agent_idx && !env->agent_states[agent_index].metrics_array[REACHED_GOAL_IDX]) {
                     draw_agent_obs(env, agent_index, mode, obs_only, lasers);
                 }
                 if((obs_only ||  IsKeyDown(KEY_LEFT_CONTROL)) && agent_index != env->human_agent_idx){
@@ -2673,7 +3963,7 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
                 Color car_color = GRAY;              // default for static
                 if (is_expert) car_color = GOLD;      // expert replay
                 if (is_active_agent) car_color = BLUE; // policy-controlled
-                if (is_active_agent && env->entities[i].collision_state > 0) car_color = RED;
+                if (is_active_agent && env->sim.collision_state[i] > 0) car_color = RED;
                 rlSetLineWidth(3.0f);
                 for (int j = 0; j < 4; j++) {
                     DrawLine3D(corners[j], corners[(j+1)%4], car_color);
@@ -2700,17 +3990,17 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
                 Color outline_color = PUFF_CYAN;        // not used for model tint
                 Model car_model = client->cars[5];
                 if(is_active_agent){
-                    car_model = client->cars[client->car_assignments[i %64]];
+                    car_model = client->cars[client->car_assignments[i]];
                 }
                 if(agent_index == env->human_agent_idx){
                     object_color = PUFF_CYAN;
                     outline_color = PUFF_WHITE;
                 }
-                if(is_active_agent && env->entities[i].collision_state > 0) {
+                if(is_active_agent && env->sim.collision_state[i] > 0) {
                     car_model = client->cars[0];  // Collided agent
                 }
                 // Draw obs for human selected agent
-                if(agent_index == env->human_agent_idx && !env->entities[agent_index].metrics_array[REACHED_GOAL_IDX]) {
+                if(agent_index == env->human_agent_idx && !env->agent_states[agent_index].metrics_array[REACHED_GOAL_IDX]) {
                     draw_agent_obs(env, agent_index, mode, obs_only, lasers);
                 }
                 // Draw cube for cars static and active
@@ -2734,8 +4024,8 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
 
                 DrawModelEx(car_model, (Vector3){0, 0, 0}, (Vector3){1, 0, 0}, 90.0f, scale, WHITE);
                 {
-                    float cos_heading = env->entities[i].heading_x;
-                    float sin_heading = env->entities[i].heading_y;
+                    float cos_heading = env->sim.heading_x[i];
+                    float sin_heading = env->sim.heading_y[i];
                     float half_len = env->entities[i].length * 0.5f;
                     float half_width = env->entities[i].width * 0.5f;
                     Vector3 corners[4] = {
@@ -2747,7 +4037,7 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
                     Color wire_color = GRAY;                 // static
                     if (!is_active_agent && env->entities[i].mark_as_expert == 1) wire_color = GOLD;  // expert replay
                     if (is_active_agent) wire_color = BLUE;   // policy
-                    if (is_active_agent && env->entities[i].collision_state > 0) wire_color = RED;
+                    if (is_active_agent && env->sim.collision_state[i] > 0) wire_color = RED;
                     rlSetLineWidth(2.0f);
                     for (int j = 0; j < 4; j++) {
                         DrawLine3D(corners[j], corners[(j+1)%4], wire_color);
@@ -2758,8 +4048,8 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
 
             // FPV Camera Control
             if(IsKeyDown(KEY_SPACE) && env->human_agent_idx== agent_index){
-                if(env->entities[agent_index].metrics_array[REACHED_GOAL_IDX]){
-                    env->human_agent_idx = rand() % env->active_agent_count;
+                if(env->agent_states[agent_index].metrics_array[REACHED_GOAL_IDX]){
+                    env->human_agent_idx = rng_int(&env->rng, env->active_agent_count);
                 }
                 Vector3 camera_position = (Vector3){
                         position.x - (25.0f * cosf(heading)),
@@ -2783,19 +4073,19 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
             }
             // Draw goal position for active agents
 
-            if(!is_active_agent || env->entities[i].valid == 0) {
+            if(!is_active_agent || env->agent_states[i].valid == 0) {
                 continue;
             }
             if(!IsKeyDown(KEY_LEFT_CONTROL) && obs_only==0){
                 DrawSphere((Vector3){
-                    env->entities[i].goal_position_x,
-                    env->entities[i].goal_position_y,
+                    env->agent_states[i].goal_position_x,
+                    env->agent_states[i].goal_position_y,
                     1
                 }, 0.5f, DARKGREEN);
 
                 DrawCircle3D((Vector3){
-                    env->entities[i].goal_position_x,
-                    env->entities[i].goal_position_y,
+                    env->agent_states[i].goal_position_x,
+                    env->agent_states[i].goal_position_y,
                     0.1f
                 }, env->goal_radius, (Vector3){0, 0, 1}, 90.0f, Fade(LIGHTGREEN, 0.3f));
             }
@@ -2899,18 +4189,20 @@ void saveTopDownImage(Drive* env, Client* client, const char *filename, RenderTe
 void saveAgentViewImage(Drive* env, Client* client, const char *filename, RenderTexture2D target, int map_height, int obs_only, int lasers, int show_grid) {
     // Agent perspective camera following the human agent
     int agent_idx = env->active_agent_indices[env->human_agent_idx];
-    Entity* agent = &env->entities[agent_idx];
+    float agent_x = env->sim.x[agent_idx];
+    float agent_y = env->sim.y[agent_idx];
+    float agent_heading = env->sim.heading[agent_idx];
 
     Camera3D camera = {0};
     // Position camera behind and above the agent
     camera.position = (Vector3){
-        agent->x - (25.0f * cosf(agent->heading)),
-        agent->y - (25.0f * sinf(agent->heading)),
+        agent_x - (25.0f * cosf(agent_heading)),
+        agent_y - (25.0f * sinf(agent_heading)),
         15.0f
     };
     camera.target = (Vector3){
-        agent->x + 40.0f * cosf(agent->heading),
-        agent->y + 40.0f * sinf(agent->heading),
+        agent_x + 40.0f * cosf(agent_heading),
+        agent_y + 40.0f * sinf(agent_heading),
         1.0f
     };
     camera.up = (Vector3){ 0.0f, 0.0f, 1.0f };
@@ -2935,6 +4227,10 @@ void saveAgentViewImage(Drive* env, Client* client, const char *filename, Render
 }
 
 void c_render(Drive* env) {
+    if (env->num_scenarios > 0) {
+        c_render(&env->scenarios[0]);
+        return;
+    }
     if (env->client == NULL) {
         env->client = make_client(env);
     }
@@ -2983,5 +4279,256 @@ void close_client(Client* client){
     }
     UnloadTexture(client->puffers);
     CloseWindow();
+    free(client->car_assignments);
     free(client);
 }
+
+// Swaps the env to another map in place, keeping its configuration and its
+// buffers. Map-dependent state is rebuilt; the sim state, per-agent arrays, obs
+// scratch and event buffer are reused while they are large enough. The env
+// takes map_name as is. Point the buffers at the new rows before the next reset.
+void reload(Drive* env, char* map_name, int num_agents) {
+    free_map_state(env);
+    env->map_name = map_name;
+    env->num_agents = num_agents;
+    env->human_agent_idx = 0;
+    env->timestep = 0;
+    env->done_count = 0;
+    env->event_count = 0;
+    memset(&env->log, 0, sizeof(Log));
+    init_map_state(env);
+    if (env->client) {
+        Client* client = env->client;
+        free(client->car_assignments);
+        client->car_assignments = (int*)malloc((env->num_objects > 0 ? env->num_objects : 1) * sizeof(int));
+        for (int i = 0; i < env->num_objects; i++) {
+            client->car_assignments[i] = rng_int(&env->rng, 4) + 1;
+        }
+    }
+}
+
+// Re-packs a host with n scenarios, reloading the ones it already has in place
+void reload_scenarios(Drive* env, char** map_names, const int* max_agents, const int* seeds, int n) {
+    int old = env->num_scenarios;
+    for (int s = n; s < old; s++) {
+        c_close(&env->scenarios[s]);
+        free(env->scenarios[s].map_name);
+    }
+    if (n != old) {
+        env->scenarios = (Drive*)realloc(env->scenarios, n*sizeof(Drive));
+        if (n > old) memset(&env->scenarios[old], 0, (n - old)*sizeof(Drive));
+    }
+    env->num_scenarios = n;
+    env->active_agent_count = 0;
+    for (int s = 0; s < n; s++) {
+        Drive* sc = &env->scenarios[s];
+        rng_seed(&sc->rng, (uint64_t)(uint32_t)seeds[s], 0);
+        if (s < old) {
+            free(sc->map_name);
+            reload(sc, strdup(map_names[s]), max_agents[s]);
+        } else {
+            copy_drive_config(sc, env);
+            sc->map_name = strdup(map_names[s]);
+            sc->num_agents = max_agents[s];
+            init(sc);
+        }
+        env->active_agent_count += sc->active_agent_count;
+    }
+    env->logs_capacity = env->active_agent_count;
+    memset(&env->log, 0, sizeof(Log));
+    set_scenario_buffers(env);
+    for (int s = old; s < n; s++) init_obs_codec(&env->scenarios[s]);
+}
+
+// Snapshots hold the mutable per-episode state of an env: timestep, RNG, aggregate
+// and per-agent logs, the event count, the SimState arrays and agent states of
+// every object, one field after another, and the agents' terminal flags. Maps,
+// grids and configuration are not included, so a snapshot only restores into an
+// env on the same maps and agent set, which map_hash checks. The event ring
+// itself is not saved: restoring rewinds its count, and later events overwrite
+// the newer entries.
+#define SNAPSHOT_MAGIC 0x50414e53u
+
+typedef struct SnapshotHeader SnapshotHeader;
+struct SnapshotHeader {
+    uint32_t magic;
+    int num_objects;
+    int active_agent_count;
+    int num_scenarios;
+    int timestep;
+    int done_count;
+    int64_t event_count;
+    uint64_t map_hash;
+    DriveRNG rng;
+    Log log;
+};
+
+// FNV-1a over the map file name and, per active agent, its entity id and start
+// position, so snapshots of another map or agent set with the same counts differ
+static uint64_t snapshot_map_hash(Drive* env) {
+    uint64_t hash = 14695981039346656037ull;
+    const char* name = env->map_name ? env->map_name : "";
+    for (const char* c = name; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+    for (int i = 0; i < env->active_agent_count; i++) {
+        Entity* e = &env->entities[env->active_agent_indices[i]];
+        uint32_t words[3] = {(uint32_t)e->id, 0, 0};
+        memcpy(&words[1], &e->traj_x[0], sizeof(float));
+        memcpy(&words[2], &e->traj_y[0], sizeof(float));
+        const unsigned char* bytes = (const unsigned char*)words;
+        for (size_t b = 0; b < sizeof(words); b++) hash = (hash ^ bytes[b]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+size_t snapshot_size(Drive* env) {
+    size_t size = sizeof(SnapshotHeader);
+    if (env->num_scenarios > 0) {
+        for (int s = 0; s < env->num_scenarios; s++) size += snapshot_size(&env->scenarios[s]);
+        return size;
+    }
+    size += (size_t)SIM_STATE_FIELDS*env->num_objects*sizeof(float);
+    size += (size_t)env->num_objects*sizeof(AgentState);
+    size += (size_t)env->active_agent_count*sizeof(Log);
+    size += (size_t)env->active_agent_count;    // terminals
+    return size;
+}
+
+// Writes snapshot_size(env) bytes to out and returns the end of the written range
+char* write_snapshot(Drive* env, char* out) {
+    SnapshotHeader header = {
+        SNAPSHOT_MAGIC, env->num_objects, env->active_agent_count, env->num_scenarios,
+        env->timestep, env->done_count, env->event_count,
+        env->num_scenarios > 0 ? 0 : snapshot_map_hash(env), env->rng, env->log,
+    };
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    if (env->num_scenarios > 0) {
+        for (int s = 0; s < env->num_scenarios; s++) out = write_snapshot(&env->scenarios[s], out);
+        return out;
+    }
+    size_t field_bytes = (size_t)env->num_objects*sizeof(float);
+    for (int k = 0; k < SIM_STATE_FIELDS; k++) {
+        memcpy(out, (float*)env->sim.data + (size_t)k*env->sim.capacity, field_bytes);
+        out += field_bytes;
+    }
+    memcpy(out, env->agent_states, (size_t)env->num_objects*sizeof(AgentState));
+    out += (size_t)env->num_objects*sizeof(AgentState);
+    memcpy(out, env->logs, (size_t)env->active_agent_count*sizeof(Log));
+    out += (size_t)env->active_agent_count*sizeof(Log);
+    memcpy(out, env->terminals, env->active_agent_count);
+    return out + env->active_agent_count;
+}
+
+// Returns the end of env's part of the snapshot at in, NULL if it was taken
+// from an env with other maps or agents
+static const char* check_snapshot(Drive* env, const char* in) {
+    SnapshotHeader header;
+    memcpy(&header, in, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.num_objects != env->num_objects
+            || header.active_agent_count != env->active_agent_count
+            || header.num_scenarios != env->num_scenarios
+            || header.map_hash != (env->num_scenarios > 0 ? 0 : snapshot_map_hash(env))) {
+        return NULL;
+    }
+    if (env->num_scenarios == 0) return in + snapshot_size(env);
+    in += sizeof(header);
+    for (int s = 0; s < env->num_scenarios && in; s++) in = check_snapshot(&env->scenarios[s], in);
+    return in;
+}
+
+static const char* apply_snapshot(Drive* env, const char* in) {
+    SnapshotHeader header;
+    memcpy(&header, in, sizeof(header));
+    in += sizeof(header);
+    env->timestep = header.timestep;
+    env->done_count = header.done_count;
+    env->event_count = header.event_count;
+    env->rng = header.rng;
+    env->log = header.log;
+    if (env->num_scenarios > 0) {
+        for (int s = 0; s < env->num_scenarios; s++) in = apply_snapshot(&env->scenarios[s], in);
+        return in;
+    }
+    size_t field_bytes = (size_t)env->num_objects*sizeof(float);
+    for (int k = 0; k < SIM_STATE_FIELDS; k++) {
+        memcpy((float*)env->sim.data + (size_t)k*env->sim.capacity, in, field_bytes);
+        in += field_bytes;
+    }
+    memcpy(env->agent_states, in, (size_t)env->num_objects*sizeof(AgentState));
+    in += (size_t)env->num_objects*sizeof(AgentState);
+    memcpy(env->logs, in, (size_t)env->active_agent_count*sizeof(Log));
+    in += (size_t)env->active_agent_count*sizeof(Log);
+    memcpy(env->terminals, in, env->active_agent_count);
+    // Outputs of the restored step, as c_reset leaves them
+    build_agent_grid(env);
+    invalidate_obs_counts(env);
+    compute_observations(env);
+    update_masks(env);
+    return in + env->active_agent_count;
+}
+
+// Restores a snapshot written by write_snapshot, including the observations,
+// masks and terminals of the step it was taken after. Returns -1 and leaves env
+// untouched if its size, layout or maps do not match env.
+int read_snapshot(Drive* env, const char* in, size_t size) {
+    if (size != snapshot_size(env) || check_snapshot(env, in) == NULL) return -1;
+    apply_snapshot(env, in);
+    return 0;
+}
+
+// Forks src into dst, which must be zeroed. dst shares src's immutable map data
+// (entities and trajectories, road and neighbour grids, topology, agent sets,
+// expert replay) and gets its own copy of everything a step writes, so both
+// continue from the same state independently. The caller points dst at its
+// output buffers; its scratch, obs counts and events start as copies of src's.
+void clone_drive(Drive* dst, Drive* src) {
+    *dst = *src;
+    dst->client = NULL;
+    dst->map_name = src->map_name ? strdup(src->map_name) : NULL;
+    dst->ini_file = src->ini_file ? strdup(src->ini_file) : NULL;
+    memset(&dst->reset_state, 0, sizeof(ResetState));  // recorded again on the clone's first reset
+    if (src->num_scenarios > 0) {
+        dst->scenarios = (Drive*)calloc(src->num_scenarios, sizeof(Drive));
+        for (int s = 0; s < src->num_scenarios; s++) clone_drive(&dst->scenarios[s], &src->scenarios[s]);
+        return;
+    }
+    if (!src->map_refs) {
+        src->map_refs = (int*)malloc(sizeof(int));
+        *src->map_refs = 1;
+    }
+    __atomic_add_fetch(src->map_refs, 1, __ATOMIC_ACQ_REL);
+    dst->map_refs = src->map_refs;
+
+    memset(&dst->sim, 0, sizeof(SimState));
+    alloc_sim_state(&dst->sim, src->sim.capacity);
+    memcpy(dst->sim.data, src->sim.data, (size_t)SIM_STATE_FIELDS*src->sim.capacity*sizeof(float));
+    size_t states = (size_t)(src->num_objects > 0 ? src->num_objects : 1)*sizeof(AgentState);
+    dst->agent_states = (AgentState*)malloc(states);
+    memcpy(dst->agent_states, src->agent_states, states);
+    memset(&dst->agent_grid, 0, sizeof(AgentGrid));
+    init_agent_grid(dst);
+    build_agent_grid(dst);
+    memset(&dst->bicycle, 0, sizeof(BicycleBatch));
+    init_bicycle_batch(dst);
+
+    int capacity = src->agent_capacity;
+    dst->logs = (Log*)malloc(capacity*sizeof(Log));
+    memcpy(dst->logs, src->logs, capacity*sizeof(Log));
+    dst->obs_partner_count = (int*)malloc(capacity*sizeof(int));
+    memcpy(dst->obs_partner_count, src->obs_partner_count, capacity*sizeof(int));
+    dst->obs_road_count = (int*)malloc(capacity*sizeof(int));
+    memcpy(dst->obs_road_count, src->obs_road_count, capacity*sizeof(int));
+    if (src->obs_out) {
+        size_t scratch = (size_t)src->active_agent_count*obs_size(src)*sizeof(float);
+        dst->observations = (float*)calloc((size_t)capacity*obs_size(src), sizeof(float));
+        memcpy(dst->observations, src->observations, scratch);
+    }
+    if (src->obs_inv_scale) {
+        dst->obs_inv_scale = (float*)malloc(obs_size(src)*sizeof(float));
+        memcpy(dst->obs_inv_scale, src->obs_inv_scale, obs_size(src)*sizeof(float));
+    }
+    if (src->events) {
+        dst->events = (DriveEvent*)malloc(src->event_capacity*sizeof(DriveEvent));
+        memcpy(dst->events, src->events, src->event_capacity*sizeof(DriveEvent));
+    }
+}
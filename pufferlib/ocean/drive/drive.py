@@ -3,9 +3,24 @@ import gymnasium
 import json
 import struct
 import os
+import warnings
 import pufferlib
 from pufferlib.ocean.drive import binding
 
+DYNAMICS_MODELS = {"classic": 0, "invertible_bicycle": 1, "delta_local": 2, "state": 3}
+# Floats per road slot: the flat layout stores the road type as one float, the
+# structured layout as a one-hot over the 7 road types
+OBS_LAYOUTS = {"flat": (0, 7), "structured": (1, 13)}
+# name -> (flag passed to C, buffer dtype). bfloat16 is stored as its raw uint16 bits.
+OBS_DTYPES = {
+    "float32": (0, np.float32),
+    "float16": (1, np.float16),
+    "bfloat16": (2, np.uint16),
+    "int8": (3, np.int8),
+}
+# name -> huge_pages mode of binding.alloc_buffer
+HUGE_PAGES = {"none": 0, "transparent": 1, "explicit": 2}
+
 
 class Drive(pufferlib.PufferEnv):
     def __init__(
@@ -26,11 +41,26 @@ class Drive(pufferlib.PufferEnv):
         num_maps=100,
         num_agents=512,
         action_type="discrete",
+        dynamics_model="classic",
+        action_repeat=1,
+        async_episodes=False,
+        reset_cache=True,
+        obs_header=False,
+        obs_dtype="float32",
+        obs_layout="flat",
+        max_partners=63,
+        max_roads=200,
         control_all_agents=False,
         num_policy_controlled_agents=-1,
         deterministic_agent_selection=False,
         use_goal_generation=False,
         control_non_vehicles=False,
+        event_buffer_size=0,
+        num_threads=1,
+        pin_threads=False,
+        huge_pages="none",
+        numa_bind=False,
+        scenarios_per_env=1,
         buf=None,
         seed=1,
         init_steps=0,
@@ -50,14 +80,70 @@ class Drive(pufferlib.PufferEnv):
         self.control_non_vehicles = control_non_vehicles
         self.use_goal_generation = use_goal_generation
         self.resample_frequency = resample_frequency
-        self.num_obs = 7 + 63 * 7 + 200 * 7
-        self.single_observation_space = gymnasium.spaces.Box(low=-1, high=1, shape=(self.num_obs,), dtype=np.float32)
+        self.event_buffer_size = int(event_buffer_size)
+        self.action_repeat = int(action_repeat)
+        self.async_episodes = bool(async_episodes)
+        self.reset_cache = bool(reset_cache)
+        if self.action_repeat < 1:
+            raise ValueError(f"action_repeat must be >= 1. Got: {action_repeat}")
+        self.num_threads = int(num_threads)
+        self.pin_threads = bool(pin_threads)
+        if huge_pages not in HUGE_PAGES:
+            raise ValueError(f"huge_pages must be one of {list(HUGE_PAGES)}. Got: {huge_pages}")
+        self.huge_pages = huge_pages
+        self.numa_bind = bool(numa_bind)
+        # Consecutive scenarios share one C env (and one vectorized handle)
+        self.scenarios_per_env = int(scenarios_per_env)
+        if self.scenarios_per_env < 1:
+            raise ValueError(f"scenarios_per_env must be >= 1. Got: {scenarios_per_env}")
+        # With obs_header each row starts with [partners written, roads written]
+        self.obs_header = bool(obs_header)
+        self.obs_header_size = 2 if self.obs_header else 0
+        if obs_layout not in OBS_LAYOUTS:
+            raise ValueError(f"obs_layout must be one of {list(OBS_LAYOUTS)}. Got: {obs_layout}")
+        self.obs_layout = obs_layout
+        self._obs_layout_flag, self.road_features = OBS_LAYOUTS[obs_layout]
+        # Partner slots hold the max_partners nearest vehicles, sorted by distance
+        self.max_partners = int(max_partners)
+        if not 1 <= self.max_partners <= 63:
+            raise ValueError(f"max_partners must be between 1 and 63. Got: {max_partners}")
+        self.max_roads = int(max_roads)
+        if not 1 <= self.max_roads <= 200:
+            raise ValueError(f"max_roads must be between 1 and 200. Got: {max_roads}")
+        self.num_obs = self.obs_header_size + 7 + self.max_partners * 7 + self.max_roads * self.road_features
+        if obs_dtype not in OBS_DTYPES:
+            raise ValueError(f"obs_dtype must be one of {list(OBS_DTYPES)}. Got: {obs_dtype}")
+        if obs_dtype == "int8" and self.obs_header:
+            raise ValueError("obs_header counts do not fit in int8 observations")
+        self.obs_dtype = obs_dtype
+        self._obs_dtype_flag, storage_dtype = OBS_DTYPES[obs_dtype]
+        if obs_dtype == "int8":
+            self.single_observation_space = gymnasium.spaces.Box(low=-127, high=127, shape=(self.num_obs,), dtype=np.int8)
+        elif obs_dtype == "bfloat16":
+            self.single_observation_space = gymnasium.spaces.Box(low=0, high=65535, shape=(self.num_obs,), dtype=np.uint16)
+        else:
+            self.single_observation_space = gymnasium.spaces.Box(low=-1, high=1, shape=(self.num_obs,), dtype=storage_dtype)
         self.init_steps = init_steps
 
+        if dynamics_model not in DYNAMICS_MODELS:
+            raise ValueError(f"dynamics_model must be one of {list(DYNAMICS_MODELS)}. Got: {dynamics_model}")
+        self.dynamics_model = dynamics_model
+        self._dynamics_model_flag = DYNAMICS_MODELS[dynamics_model]
+
         if action_type == "discrete":
+            if dynamics_model in ("delta_local", "state"):
+                raise ValueError(f"dynamics_model '{dynamics_model}' requires action_type='continuous'")
             self.single_action_space = gymnasium.spaces.MultiDiscrete([7, 13])
         elif action_type == "continuous":
-            self.single_action_space = gymnasium.spaces.Box(low=-1, high=1, shape=(2,), dtype=np.float32)
+            if dynamics_model == "delta_local":
+                # (dx, dy, dyaw) per step in the agent frame; bounds match DELTA_LOCAL_MAX_* in drive.h
+                high = np.array([10.0, 1.0, 0.5], dtype=np.float32)
+                self.single_action_space = gymnasium.spaces.Box(low=-high, high=high, dtype=np.float32)
+            elif dynamics_model == "state":
+                # Next (x, y, heading, vx, vy)
+                self.single_action_space = gymnasium.spaces.Box(low=-np.inf, high=np.inf, shape=(5,), dtype=np.float32)
+            else:
+                self.single_action_space = gymnasium.spaces.Box(low=-1, high=1, shape=(2,), dtype=np.float32)
         else:
             raise ValueError(f"action_space must be 'discrete' or 'continuous'. Got: {action_type}")
 
@@ -86,54 +172,151 @@ class Drive(pufferlib.PufferEnv):
             num_policy_controlled_agents=self.num_policy_controlled_agents,
             control_all_agents=1 if self.control_all_agents else 0,
             deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
+            scenarios_per_env=self.scenarios_per_env,
+            seed=seed,
         )
         self.num_agents = num_agents
         self.agent_offsets = agent_offsets
         self.map_ids = map_ids
         self.num_envs = num_envs
         super().__init__(buf=buf)
-        env_ids = []
-        for i in range(num_envs):
-            cur = agent_offsets[i]
-            nxt = agent_offsets[i + 1]
-            env_id = binding.env_init(
-                self.observations[cur:nxt],
-                self.actions[cur:nxt],
-                self.rewards[cur:nxt],
-                self.terminals[cur:nxt],
-                self.truncations[cur:nxt],
-                seed,
-                action_type=self._action_type_flag,
-                human_agent_idx=human_agent_idx,
-                reward_vehicle_collision=reward_vehicle_collision,
-                reward_offroad_collision=reward_offroad_collision,
-                reward_goal=reward_goal,
-                reward_goal_post_respawn=reward_goal_post_respawn,
-                reward_ade=reward_ade,
-                goal_radius=goal_radius,
-                scenario_length=(int(scenario_length) if scenario_length is not None else None),
-                control_all_agents=1 if self.control_all_agents else 0,
-                num_policy_controlled_agents=self.num_policy_controlled_agents,
-                deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
-                map_id=map_ids[i],
-                max_agents=nxt - cur,
-                ini_file="pufferlib/config/ocean/drive.ini",
-                control_non_vehicles=int(control_non_vehicles),
-                init_steps=init_steps,
+        # Resample seeds come from the constructor seed, not the global NumPy
+        # state, which forked vec workers would all share
+        self._resample_rng = np.random.default_rng(seed)
+        if buf is None and self.huge_pages != "none":
+            self.observations, self.actions, self.rewards, self.terminals, self.truncations, self.masks = (
+                self._page_copy(b)
+                for b in (self.observations, self.actions, self.rewards, self.terminals, self.truncations, self.masks)
             )
-            env_ids.append(env_id)
+        elif self.huge_pages != "none":
+            # Buffers passed in (e.g. multiprocessing shared memory) stay where
+            # they are and only get the transparent huge page hint
+            if self.huge_pages == "explicit":
+                warnings.warn("huge_pages='explicit' cannot move buffers passed in with buf, using 'transparent' hints")
+            for b in (self.observations, self.actions, self.rewards, self.terminals, self.truncations, self.masks):
+                binding.advise_buffer(b)
+        # Second buffer set for step_async, allocated on first use
+        self._slots = None
+        self._slot = 0
+        self._init_envs(seed)
+        # Stored observation times obs_scales gives the float features (int8 only differs from 1)
+        self.obs_scales = binding.env_obs_scales(self.env_ids[0])
+
+    def _init_envs(self, seed):
+        # One C env per pack of scenarios_per_env consecutive scenarios from
+        # agent_offsets/map_ids, built natively with the maps loaded in parallel.
+        # Scenario i is seeded with seed + i either way.
+        self.pack_offsets = self._pack_offsets()
+        self.c_envs, self.env_ids = binding.vec_build(
+            self.map_ids,
+            self.agent_offsets,
+            self.scenarios_per_env,
+            seed,
+            self.observations,
+            self.actions,
+            self.rewards,
+            self.terminals,
+            self.masks,
+            action_type=self._action_type_flag,
+            dynamics_model=self._dynamics_model_flag,
+            human_agent_idx=self.human_agent_idx,
+            reward_vehicle_collision=self.reward_vehicle_collision,
+            reward_offroad_collision=self.reward_offroad_collision,
+            reward_goal=self.reward_goal,
+            reward_goal_post_respawn=self.reward_goal_post_respawn,
+            reward_ade=self.reward_ade,
+            goal_radius=self.goal_radius,
+            scenario_length=(int(self.scenario_length) if self.scenario_length is not None else None),
+            control_all_agents=1 if self.control_all_agents else 0,
+            num_policy_controlled_agents=self.num_policy_controlled_agents,
+            deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
+            ini_file="pufferlib/config/ocean/drive.ini",
+            control_non_vehicles=int(self.control_non_vehicles),
+            init_steps=self.init_steps,
+            event_buffer_size=self.event_buffer_size,
+            action_repeat=self.action_repeat,
+            async_episodes=int(self.async_episodes),
+            reset_cache=int(self.reset_cache),
+            obs_header=int(self.obs_header),
+            obs_dtype=self._obs_dtype_flag,
+            obs_layout=self._obs_layout_flag,
+            max_partners=self.max_partners,
+            max_roads=self.max_roads,
+            num_threads=self.num_threads,
+            pin_threads=self.pin_threads,
+            numa_bind=self.numa_bind,
+        )
 
-        self.c_envs = binding.vectorize(*env_ids)
+    def _pack_offsets(self):
+        # Scenario index where each C env's pack starts, plus num_envs
+        return list(range(0, self.num_envs, self.scenarios_per_env)) + [self.num_envs]
+
+    def _slot_buffers(self, slot):
+        # (observations, actions, rewards, terminals, truncations, masks) of a slot
+        if slot not in (0, 1):
+            raise ValueError(f"slot must be 0 or 1. Got: {slot}")
+        if self._slots is None:
+            main = (self.observations, self.actions, self.rewards, self.terminals, self.truncations, self.masks)
+            self._slots = [main, tuple(self._page_copy(buf) for buf in main)]
+            self._register_slots()
+        return self._slots[slot]
+
+    def _page_copy(self, buf):
+        # Copy of buf on pages from binding.alloc_buffer. Zeros are left untouched
+        # so the pages are first written by the threads that own their rows.
+        if self.huge_pages == "none":
+            return np.copy(buf)
+        copy = binding.alloc_buffer(buf.nbytes, huge_pages=HUGE_PAGES[self.huge_pages])
+        copy = copy.view(buf.dtype).reshape(buf.shape)
+        if buf.any():
+            copy[...] = buf
+        return copy
+
+    def _register_slots(self):
+        for slot, (obs, actions, rewards, terminals, _, masks) in enumerate(self._slots):
+            binding.vec_buffers(self.c_envs, slot, obs, actions, rewards, terminals, masks)
+
+    def _use_slot(self, slot):
+        if slot != self._slot:
+            binding.vec_slot(self.c_envs, slot)
+            self._slot = slot
 
     def reset(self, seed=0):
+        self._use_slot(0)
         binding.vec_reset(self.c_envs, seed)
         self.tick = 0
         return self.observations, []
 
     def step(self, actions):
+        self._use_slot(0)
         self.terminals[:] = 0
         self.actions[:] = actions
         binding.vec_step(self.c_envs)
+        info = self._end_step()
+        return (self.observations, self.rewards, self.terminals, self.truncations, info)
+
+    def step_async(self, actions, slot=0):
+        """Starts a step that reads actions into and writes outputs to buffer slot 0 or 1.
+
+        Slot 0 is self.observations/rewards/terminals/masks, slot 1 a second set of
+        the same shapes. Returns immediately; the envs run on a native thread, so
+        the caller can work on the other slot (e.g. run the policy on it) until
+        step_wait(). The pending slot must not be read or written meanwhile.
+        """
+        _, slot_actions, _, terminals, _, _ = self._slot_buffers(slot)
+        terminals[:] = 0
+        slot_actions[:] = actions
+        binding.vec_step_async(self.c_envs, slot)
+        self._slot = slot
+
+    def step_wait(self):
+        """Waits for step_async and returns the step() tuple of its slot."""
+        binding.vec_wait(self.c_envs)
+        info = self._end_step()
+        obs, _, rewards, terminals, truncations, _ = self._slot_buffers(self._slot)
+        return (obs, rewards, terminals, truncations, info)
+
+    def _end_step(self):
         self.tick += 1
         info = []
         if self.tick % self.report_interval == 0:
@@ -145,50 +328,101 @@ class Drive(pufferlib.PufferEnv):
             self.tick = 0
             will_resample = 1
             if will_resample:
-                binding.vec_close(self.c_envs)
+                seed = int(self._resample_rng.integers(0, 2**31 - 1))
                 agent_offsets, map_ids, num_envs = binding.shared(
                     num_agents=self.num_agents,
                     num_maps=self.num_maps,
                     num_policy_controlled_agents=self.num_policy_controlled_agents,
                     control_all_agents=1 if self.control_all_agents else 0,
                     deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
+                    scenarios_per_env=self.scenarios_per_env,
+                    seed=seed,
+                )
+                slot = self._slot
+                self.agent_offsets = agent_offsets
+                self.map_ids = map_ids
+                self.num_envs = num_envs
+                # Same buffers, new maps: the C envs are re-sliced and reloaded in place
+                self.env_ids = binding.vec_reload(
+                    self.c_envs,
+                    map_ids,
+                    agent_offsets,
+                    self.scenarios_per_env,
+                    seed,
+                    self.observations,
+                    self.actions,
+                    self.rewards,
+                    self.terminals,
+                    self.masks,
                 )
-                env_ids = []
-                seed = np.random.randint(0, 2**32 - 1)
-                for i in range(num_envs):
-                    cur = agent_offsets[i]
-                    nxt = agent_offsets[i + 1]
-                    env_id = binding.env_init(
-                        self.observations[cur:nxt],
-                        self.actions[cur:nxt],
-                        self.rewards[cur:nxt],
-                        self.terminals[cur:nxt],
-                        self.truncations[cur:nxt],
-                        seed,
-                        action_type=self._action_type_flag,
-                        human_agent_idx=self.human_agent_idx,
-                        reward_vehicle_collision=self.reward_vehicle_collision,
-                        reward_offroad_collision=self.reward_offroad_collision,
-                        reward_goal=self.reward_goal,
-                        reward_goal_post_respawn=self.reward_goal_post_respawn,
-                        reward_ade=self.reward_ade,
-                        goal_radius=self.goal_radius,
-                        scenario_length=(int(self.scenario_length) if self.scenario_length is not None else None),
-                        control_all_agents=1 if self.control_all_agents else 0,
-                        num_policy_controlled_agents=self.num_policy_controlled_agents,
-                        deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
-                        map_id=map_ids[i],
-                        max_agents=nxt - cur,
-                        ini_file="pufferlib/config/ocean/drive.ini",
-                        control_non_vehicles=int(self.control_non_vehicles),
-                        init_steps=self.init_steps,
-                    )
-                    env_ids.append(env_id)
-                self.c_envs = binding.vectorize(*env_ids)
+                self.pack_offsets = self._pack_offsets()
+                self._slot = 0
+                self._use_slot(slot)
 
                 binding.vec_reset(self.c_envs, seed)
-                self.terminals[:] = 1
-        return (self.observations, self.rewards, self.terminals, self.truncations, info)
+                terminals = self._slot_buffers(slot)[3] if slot else self.terminals
+                terminals[:] = 1
+        return info
+
+    def events(self, env_idx=0):
+        """Zero-copy view of one env's collision/offroad event ring buffer.
+
+        Returns (events, count). events is a structured array with fields
+        timestep, agent, other, type, x, y where agent is the row within the env
+        (global row is agent_offsets[env_idx] + agent) and type is 1 for vehicle
+        collisions and 2 for offroad. count is the total number of events written;
+        the newest one is events[(count - 1) % len(events)]. The view is invalidated
+        when maps are resampled. Requires event_buffer_size > 0. env_idx counts
+        scenarios, so it is unaffected by scenarios_per_env.
+        """
+        k = self.scenarios_per_env
+        if k == 1:
+            return binding.env_events(self.env_ids[env_idx])
+        return binding.env_events(self.env_ids[env_idx // k], env_idx % k)
+
+    def expert_actions(self, timestep=None):
+        """Actions that reproduce the logged trajectories under the selected dynamics model.
+
+        Returns (actions, valid) for every agent: actions has the layout of
+        self.actions and maps each agent's logged state at `timestep` to its
+        logged state at timestep + 1 (defaults to each env's current timestep,
+        i.e. the action to pass to the next step()). valid is False where either
+        log entry is missing; those agents get a neutral action.
+        """
+        actions = np.zeros_like(self.actions)
+        valid = np.zeros(self.num_agents, dtype=np.uint8)
+        t = -1 if timestep is None else int(timestep)
+        for p, env_id in enumerate(self.env_ids):
+            cur = self.agent_offsets[self.pack_offsets[p]]
+            nxt = self.agent_offsets[self.pack_offsets[p + 1]]
+            binding.env_expert_actions(env_id, t, actions[cur:nxt], valid[cur:nxt])
+        return actions, valid.astype(bool)
+
+    def snapshot(self):
+        """Mutable episode state of every C env, as a list of bytes.
+
+        Covers kinematics, goals, metrics, logs, timesteps and RNG state, but
+        not maps or buffers, so restore() only applies until the next resample.
+        """
+        binding.vec_wait(self.c_envs)
+        return [binding.env_snapshot(env_id) for env_id in self.env_ids]
+
+    def restore(self, snapshots):
+        """Returns every C env to the state of a snapshot() of this Drive.
+
+        Observations, masks and terminals are those of the snapshot's step, and
+        the next step() continues exactly as it did after the snapshot.
+        """
+        binding.vec_wait(self.c_envs)
+        if len(snapshots) != len(self.env_ids):
+            raise ValueError(f"Expected {len(self.env_ids)} snapshots. Got: {len(snapshots)}")
+        for env_id, state in zip(self.env_ids, snapshots):
+            binding.env_restore(env_id, state)
+
+    def clone(self, n, num_threads=None):
+        """Forks every C env n ways at the current step, see DriveBranches."""
+        binding.vec_wait(self.c_envs)
+        return DriveBranches(self, n, self.num_threads if num_threads is None else num_threads)
 
     def render(self):
         binding.vec_render(self.c_envs, 0)
@@ -197,6 +431,49 @@ class Drive(pufferlib.PufferEnv):
         binding.vec_close(self.c_envs)
 
 
+class DriveBranches:
+    """n forks of a Drive taken at one step, for planning and counterfactual rollouts.
+
+    Branches share the Drive's map data (trajectories, grids, topology) and copy
+    only its mutable state, then step independently. Buffers have a leading
+    branch axis: observations[b] starts as the Drive's current observations, and
+    step(actions) takes actions of shape (n, num_agents, ...) and advances all
+    branches together on the thread pool. The Drive may be stepped, resampled or
+    closed without affecting the branches.
+    """
+
+    def __init__(self, env, n, num_threads=1):
+        self.n = int(n)
+        if self.n < 1:
+            raise ValueError(f"n must be >= 1. Got: {n}")
+        self.num_agents = env.num_agents
+        self.observations = np.zeros((self.n,) + env.observations.shape, dtype=env.observations.dtype)
+        self.actions = np.zeros((self.n,) + env.actions.shape, dtype=env.actions.dtype)
+        self.rewards = np.zeros((self.n, env.num_agents), dtype=np.float32)
+        self.terminals = np.zeros((self.n, env.num_agents), dtype=bool)
+        self.masks = np.ones((self.n, env.num_agents), dtype=bool)
+        rows = self.n * env.num_agents
+        self.c_envs, self.env_ids = binding.env_clone(
+            list(env.env_ids),
+            self.n,
+            self.observations.reshape((rows,) + env.observations.shape[1:]),
+            self.actions.reshape((rows,) + env.actions.shape[1:]),
+            self.rewards.reshape(rows),
+            self.terminals.reshape(rows),
+            self.masks.reshape(rows),
+            num_threads=num_threads,
+        )
+
+    def step(self, actions):
+        self.terminals[:] = 0
+        self.actions[:] = actions
+        binding.vec_step(self.c_envs)
+        return self.observations, self.rewards, self.terminals
+
+    def close(self):
+        binding.vec_close(self.c_envs)
+
+
 def calculate_area(p1, p2, p3):
     # Calculate the area of the triangle using the determinant method
     return 0.5 * abs((p1["x"] - p3["x"]) * (p2["y"] - p1["y"]) - (p1["x"] - p2["x"]) * (p3["y"] - p1["y"]))
@@ -10,6 +10,10 @@
 typedef struct DriveNet DriveNet;
 struct DriveNet {
     int num_agents;
+    int obs_layout;     // OBS_LAYOUT_* of the observations passed to forward
+    int max_partners;   // partner slots per observation row
+    int max_roads;      // road slots per observation row
+    int header_size;    // floats before the ego features (OBS_HEADER_SIZE with obs_header)
     float* obs_self;
     float* obs_partner;
     float* obs_road;
@@ -41,21 +45,26 @@ struct DriveNet {
     Multidiscrete* multidiscrete;
 };
 
-DriveNet* init_drivenet(Weights* weights, int num_agents) {
+// obs_header, max_partners and max_roads must match the env the observations come from
+DriveNet* init_drivenet(Weights* weights, int num_agents, int obs_layout, int obs_header, int max_partners, int max_roads) {
     DriveNet* net = calloc(1, sizeof(DriveNet));
     int hidden_size = 256;
     int input_size = 64;
 
     net->num_agents = num_agents;
+    net->obs_layout = obs_layout;
+    net->max_partners = max_partners;
+    net->max_roads = max_roads;
+    net->header_size = obs_header ? OBS_HEADER_SIZE : 0;
     net->obs_self = calloc(num_agents*7, sizeof(float)); // 7 features
-    net->obs_partner = calloc(num_agents*63*7, sizeof(float)); // 63 objects, 7 features
-    net->obs_road = calloc(num_agents*200*13, sizeof(float)); // 200 objects, 13 features
-    net->partner_linear_output = calloc(num_agents*63*input_size, sizeof(float));
-    net->road_linear_output = calloc(num_agents*200*input_size, sizeof(float));
-    net->partner_linear_output_two = calloc(num_agents*63*input_size, sizeof(float));
-    net->road_linear_output_two = calloc(num_agents*200*input_size, sizeof(float));
-    net->partner_layernorm_output = calloc(num_agents*63*input_size, sizeof(float));
-    net->road_layernorm_output = calloc(num_agents*200*input_size, sizeof(float));
+    net->obs_partner = calloc(num_agents*max_partners*7, sizeof(float)); // max_partners objects, 7 features
+    net->obs_road = calloc(num_agents*max_roads*13, sizeof(float)); // max_roads objects, 13 features
+    net->partner_linear_output = calloc(num_agents*max_partners*input_size, sizeof(float));
+    net->road_linear_output = calloc(num_agents*max_roads*input_size, sizeof(float));
+    net->partner_linear_output_two = calloc(num_agents*max_partners*input_size, sizeof(float));
+    net->road_linear_output_two = calloc(num_agents*max_roads*input_size, sizeof(float));
+    net->partner_layernorm_output = calloc(num_agents*max_partners*input_size, sizeof(float));
+    net->road_layernorm_output = calloc(num_agents*max_roads*input_size, sizeof(float));
     net->ego_encoder = make_linear(weights, num_agents, 7, input_size);
     net->ego_layernorm = make_layernorm(weights, num_agents, input_size);
     net->ego_encoder_two = make_linear(weights, num_agents, input_size, input_size);
@@ -65,8 +74,8 @@ DriveNet* init_drivenet(Weights* weights, int num_agents) {
     net->partner_encoder = make_linear(weights, num_agents, 7, input_size);
     net->partner_layernorm = make_layernorm(weights, num_agents, input_size);
     net->partner_encoder_two = make_linear(weights, num_agents, input_size, input_size);
-    net->partner_max = make_max_dim1(num_agents, 63, input_size);
-    net->road_max = make_max_dim1(num_agents, 200, input_size);
+    net->partner_max = make_max_dim1(num_agents, max_partners, input_size);
+    net->road_max = make_max_dim1(num_agents, max_roads, input_size);
     net->cat1 = make_cat_dim1(num_agents, input_size, input_size);
     net->cat2 = make_cat_dim1(num_agents, input_size + input_size, input_size);
     net->gelu = make_gelu(num_agents, 3*input_size);
@@ -116,42 +125,37 @@ void free_drivenet(DriveNet* net) {
 }
 
 void forward(DriveNet* net, float* observations, int* actions) {
-    // Clear previous observations
-    memset(net->obs_self, 0, net->num_agents * 7 * sizeof(float));
-    memset(net->obs_partner, 0, net->num_agents * 63 * 7 * sizeof(float));
-    memset(net->obs_road, 0, net->num_agents * 200 * 13 * sizeof(float));
-
     // Reshape observations into 2D boards and additional features
+    int num_partners = net->max_partners;
+    int num_roads = net->max_roads;
     float (*obs_self)[7] = (float (*)[7])net->obs_self;
-    float (*obs_partner)[63][7] = (float (*)[63][7])net->obs_partner;
-    float (*obs_road)[200][13] = (float (*)[200][13])net->obs_road;
+    float (*obs_road)[13] = (float (*)[13])net->obs_road;  // one row per road object
+    int structured = net->obs_layout == OBS_LAYOUT_STRUCTURED;
+    int road_dim = structured ? 13 : 7;
 
     for (int b = 0; b < net->num_agents; b++) {
-        int b_offset = b * (7 + 63*7 + 200*7);  // offset for each batch
+        // Offset for each batch, skipping the header counts
+        int b_offset = b * (net->header_size + 7 + num_partners*7 + num_roads*road_dim) + net->header_size;
         int partner_offset = b_offset + 7;
-        int road_offset = b_offset + 7 + 63*7;
-        // Process self observation
-        for(int i = 0; i < 7; i++) {
-            obs_self[b][i] = observations[b_offset + i];
-        }
-
-        // Process partner observation
-        for(int i = 0; i < 63; i++) {
-            for(int j = 0; j < 7; j++) {
-                obs_partner[b][i][j] = observations[partner_offset + i*7 + j];
-            }
+        int road_offset = b_offset + 7 + num_partners*7;
+        memcpy(obs_self[b], &observations[b_offset], 7*sizeof(float));
+        memcpy(&net->obs_partner[b*num_partners*7], &observations[partner_offset], num_partners*7*sizeof(float));
+
+        // Structured observations already hold the one-hot road types
+        if (structured) {
+            memcpy(obs_road[b*num_roads], &observations[road_offset], num_roads*13*sizeof(float));
+            continue;
         }
-
-        // Process road observation
-        for(int i = 0; i < 200; i++) {
+        for(int i = 0; i < num_roads; i++) {
+            float* road = obs_road[b*num_roads + i];
             for(int j = 0; j < 7; j++) {
-                obs_road[b][i][j] = observations[road_offset + i*7 + j];
+                road[j] = observations[road_offset + i*7 + j];
             }
             for(int j = 0; j < 7; j++) {
                 if(j == observations[road_offset+i*7 + 6]) {
-                    obs_road[b][i][6 + j] = 1.0f;
+                    road[6 + j] = 1.0f;
                 } else {
-                    obs_road[b][i][6 + j] = 0.0f;
+                    road[6 + j] = 0.0f;
                 }
             }
         }
@@ -162,57 +166,57 @@ void forward(DriveNet* net, float* observations, int* actions) {
     layernorm(net->ego_layernorm, net->ego_encoder->output);
     linear(net->ego_encoder_two, net->ego_layernorm->output);
     for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 63; obj++) {
+        for (int obj = 0; obj < num_partners; obj++) {
             // Get the 7 features for this object
-            float* obj_features = &net->obs_partner[b*63*7 + obj*7];
+            float* obj_features = &net->obs_partner[(b*num_partners + obj)*7];
             // Apply linear layer to this object
             _linear(obj_features, net->partner_encoder->weights, net->partner_encoder->bias,
-                   &net->partner_linear_output[b*63*64 + obj*64], 1, 7, 64);
+                   &net->partner_linear_output[(b*num_partners + obj)*64], 1, 7, 64);
         }
     }
 
     for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 63; obj++) {
-            float* after_first = &net->partner_linear_output[b*63*64 + obj*64];
+        for (int obj = 0; obj < num_partners; obj++) {
+            float* after_first = &net->partner_linear_output[(b*num_partners + obj)*64];
             _layernorm(after_first, net->partner_layernorm->weights, net->partner_layernorm->bias,
-                        &net->partner_layernorm_output[b*63*64 + obj*64], 1, 64);
+                        &net->partner_layernorm_output[(b*num_partners + obj)*64], 1, 64);
         }
     }
     for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 63; obj++) {
+        for (int obj = 0; obj < num_partners; obj++) {
             // Get the 7 features for this object
-            float* obj_features = &net->partner_layernorm_output[b*63*64 + obj*64];
+            float* obj_features = &net->partner_layernorm_output[(b*num_partners + obj)*64];
             // Apply linear layer to this object
             _linear(obj_features, net->partner_encoder_two->weights, net->partner_encoder_two->bias,
-                   &net->partner_linear_output_two[b*63*64 + obj*64], 1, 64, 64);
+                   &net->partner_linear_output_two[(b*num_partners + obj)*64], 1, 64, 64);
 
         }
     }
 
     // Process road objects: apply linear to each object individually
     for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 200; obj++) {
+        for (int obj = 0; obj < num_roads; obj++) {
             // Get the 13 features for this object
-            float* obj_features = &net->obs_road[b*200*13 + obj*13];
+            float* obj_features = &net->obs_road[(b*num_roads + obj)*13];
             // Apply linear layer to this object
             _linear(obj_features, net->road_encoder->weights, net->road_encoder->bias,
-                   &net->road_linear_output[b*200*64 + obj*64], 1, 13, 64);
+                   &net->road_linear_output[(b*num_roads + obj)*64], 1, 13, 64);
         }
     }
 
     // Apply layer norm and second linear to each road object
     for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 200; obj++) {
-            float* after_first = &net->road_linear_output[b*200*64 + obj*64];
+        for (int obj = 0; obj < num_roads; obj++) {
+            float* after_first = &net->road_linear_output[(b*num_roads + obj)*64];
             _layernorm(after_first, net->road_layernorm->weights, net->road_layernorm->bias,
-                        &net->road_layernorm_output[b*200*64 + obj*64], 1, 64);
+                        &net->road_layernorm_output[(b*num_roads + obj)*64], 1, 64);
         }
     }
     for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 200; obj++) {
-            float* after_first = &net->road_layernorm_output[b*200*64 + obj*64];
+        for (int obj = 0; obj < num_roads; obj++) {
+            float* after_first = &net->road_layernorm_output[(b*num_roads + obj)*64];
             _linear(after_first, net->road_encoder_two->weights, net->road_encoder_two->bias,
-                    &net->road_linear_output_two[b*200*64 + obj*64], 1, 64, 64);
+                    &net->road_linear_output_two[(b*num_roads + obj)*64], 1, 64, 64);
         }
     }
 
@@ -0,0 +1,275 @@
+#ifndef DRIVE_DYNAMICS_H
+#define DRIVE_DYNAMICS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Batched kinematic bicycle model. Operates on contiguous per-agent arrays so the
+// inner loop runs 4 agents per iteration with SSE2 and falls back to the same
+// arithmetic in scalar code elsewhere (and for the tail).
+
+#define DYNAMICS_BATCH_ALIGN 4
+
+// sin/cos of |x| up to ~1e4 with ~1 ulp error on [-pi/4, pi/4] after reduction.
+// Cody-Waite reduction by pi/2, Cephes minimax polynomials.
+#define SINCOS_TWO_OVER_PI 0.636619772367581343f
+#define SINCOS_PIO2_1 1.5703125f
+#define SINCOS_PIO2_2 4.837512969970703125e-4f
+#define SINCOS_PIO2_3 7.54978995489188216e-8f
+#define SINCOS_S1 -1.6666654611e-1f
+#define SINCOS_S2 8.3321608736e-3f
+#define SINCOS_S3 -1.9515295891e-4f
+#define SINCOS_C1 4.166664568298827e-2f
+#define SINCOS_C2 -1.388731625493765e-3f
+#define SINCOS_C3 2.443315711809948e-5f
+
+static inline void sincos_approx(float x, float* out_sin, float* out_cos) {
+    int j = (int)lrintf(x * SINCOS_TWO_OVER_PI);
+    float jf = (float)j;
+    float r = x - jf*SINCOS_PIO2_1;
+    r = r - jf*SINCOS_PIO2_2;
+    r = r - jf*SINCOS_PIO2_3;
+    float r2 = r*r;
+    float s = r + r*r2*(SINCOS_S1 + r2*(SINCOS_S2 + r2*SINCOS_S3));
+    float c = 1.0f - 0.5f*r2 + r2*r2*(SINCOS_C1 + r2*(SINCOS_C2 + r2*SINCOS_C3));
+    // Rotate by the quadrant
+    float sin_v = (j & 1) ? c : s;
+    float cos_v = (j & 1) ? s : c;
+    if (j & 2) sin_v = -sin_v;
+    if ((j + 1) & 2) cos_v = -cos_v;
+    *out_sin = sin_v;
+    *out_cos = cos_v;
+}
+
+#if defined(__SSE2__)
+static inline void sincos_approx_ps(__m128 x, __m128* out_sin, __m128* out_cos) {
+    __m128i j = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(SINCOS_TWO_OVER_PI)));
+    __m128 jf = _mm_cvtepi32_ps(j);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(jf, _mm_set1_ps(SINCOS_PIO2_1)));
+    r = _mm_sub_ps(r, _mm_mul_ps(jf, _mm_set1_ps(SINCOS_PIO2_2)));
+    r = _mm_sub_ps(r, _mm_mul_ps(jf, _mm_set1_ps(SINCOS_PIO2_3)));
+    __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 ps = _mm_add_ps(_mm_set1_ps(SINCOS_S2), _mm_mul_ps(r2, _mm_set1_ps(SINCOS_S3)));
+    ps = _mm_add_ps(_mm_set1_ps(SINCOS_S1), _mm_mul_ps(r2, ps));
+    __m128 s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), ps));
+
+    __m128 pc = _mm_add_ps(_mm_set1_ps(SINCOS_C2), _mm_mul_ps(r2, _mm_set1_ps(SINCOS_C3)));
+    pc = _mm_add_ps(_mm_set1_ps(SINCOS_C1), _mm_mul_ps(r2, pc));
+    __m128 c = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2));
+    c = _mm_add_ps(c, _mm_mul_ps(_mm_mul_ps(r2, r2), pc));
+
+    __m128i one = _mm_set1_epi32(1);
+    __m128i two = _mm_set1_epi32(2);
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, one), one));
+    __m128 sin_v = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+    __m128 cos_v = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+    __m128 sign_bit = _mm_set1_ps(-0.0f);
+    __m128 sin_flip = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, two), two));
+    __m128 cos_flip = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_add_epi32(j, one), two), two));
+    *out_sin = _mm_xor_ps(sin_v, _mm_and_ps(sin_flip, sign_bit));
+    *out_cos = _mm_xor_ps(cos_v, _mm_and_ps(cos_flip, sign_bit));
+}
+#endif
+
+void sincos_batch(const float* angle, float* out_sin, float* out_cos, int n) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128 s, c;
+        sincos_approx_ps(_mm_loadu_ps(angle + i), &s, &c);
+        _mm_storeu_ps(out_sin + i, s);
+        _mm_storeu_ps(out_cos + i, c);
+    }
+#endif
+    for (; i < n; i++) {
+        sincos_approx(angle[i], &out_sin[i], &out_cos[i]);
+    }
+}
+
+// Per-agent inputs of the bicycle models, decoded from the actions each step.
+// Steering only enters through tan(steering) and beta = tanh(0.5*tan(steering)),
+// so for discrete actions all factors come from a per-action table.
+#define BICYCLE_BATCH_FIELDS 10
+typedef struct BicycleBatch BicycleBatch;
+struct BicycleBatch {
+    float* accel;
+    float* yaw_factor;  // CLASSIC: cos(beta) * tan(steering), INVERTIBLE_BICYLE: tan(steering)
+    float* cos_beta;
+    float* sin_beta;
+    float* inv_length;  // static, set once per agent at init
+    // INVERTIBLE_BICYLE scratch
+    float* speed;
+    float* distance;
+    float* mid_heading;
+    float* mid_sin;
+    float* mid_cos;
+    int capacity;
+    float* data;
+};
+
+void alloc_bicycle_batch(BicycleBatch* batch, int num_agents) {
+    int capacity = (num_agents + DYNAMICS_BATCH_ALIGN - 1) / DYNAMICS_BATCH_ALIGN * DYNAMICS_BATCH_ALIGN;
+    if (capacity == 0) capacity = DYNAMICS_BATCH_ALIGN;
+    float* data = (float*)calloc((size_t)BICYCLE_BATCH_FIELDS * capacity, sizeof(float));
+    batch->capacity = capacity;
+    batch->data = data;
+    batch->accel = data + 0*capacity;
+    batch->yaw_factor = data + 1*capacity;
+    batch->cos_beta = data + 2*capacity;
+    batch->sin_beta = data + 3*capacity;
+    batch->inv_length = data + 4*capacity;
+    batch->speed = data + 5*capacity;
+    batch->distance = data + 6*capacity;
+    batch->mid_heading = data + 7*capacity;
+    batch->mid_sin = data + 8*capacity;
+    batch->mid_cos = data + 9*capacity;
+}
+
+void free_bicycle_batch(BicycleBatch* batch) {
+    free(batch->data);
+    memset(batch, 0, sizeof(BicycleBatch));
+}
+
+static inline void bicycle_steering_factors(float steering, float* yaw_factor, float* cos_beta, float* sin_beta) {
+    float tan_steering = tanf(steering);
+    float beta = tanh(.5*tan_steering);
+    *cos_beta = cosf(beta);
+    *sin_beta = sinf(beta);
+    *yaw_factor = *cos_beta * tan_steering;
+}
+
+// Steering that gives a CLASSIC yaw factor. cos(beta) * tan(steering) is
+// increasing in steering on (-pi/2, pi/2), so bisect within the action range.
+static inline float bicycle_steering_inverse(float yaw_factor, float max_steering) {
+    float lo = -max_steering;
+    float hi = max_steering;
+    for (int k = 0; k < 24; k++) {
+        float mid = 0.5f*(lo + hi);
+        float f, cb, sb;
+        bicycle_steering_factors(mid, &f, &cb, &sb);
+        if (f < yaw_factor) lo = mid; else hi = mid;
+    }
+    return 0.5f*(lo + hi);
+}
+
+// Advances agents [0, n) by one step of dt. Heading direction uses the cached
+// heading_x/heading_y: cos(h + beta) = cos(h)cos(beta) - sin(h)sin(beta).
+static inline void bicycle_step_scalar(const BicycleBatch* b, int i, float* x, float* y, float* heading,
+        float* heading_x, float* heading_y, float* vx, float* vy, float dt, float max_speed) {
+    float speed = sqrtf(vx[i]*vx[i] + vy[i]*vy[i]);
+    speed = speed + 0.5f*b->accel[i]*dt;
+    speed = fminf(fmaxf(speed, -max_speed), max_speed);
+    float yaw_rate = speed*b->yaw_factor[i]*b->inv_length[i];
+    float dir_x = heading_x[i]*b->cos_beta[i] - heading_y[i]*b->sin_beta[i];
+    float dir_y = heading_y[i]*b->cos_beta[i] + heading_x[i]*b->sin_beta[i];
+    float new_vx = speed*dir_x;
+    float new_vy = speed*dir_y;
+    x[i] = x[i] + new_vx*dt;
+    y[i] = y[i] + new_vy*dt;
+    heading[i] = heading[i] + yaw_rate*dt;
+    sincos_approx(heading[i], &heading_y[i], &heading_x[i]);
+    vx[i] = new_vx;
+    vy[i] = new_vy;
+}
+
+void bicycle_step_batch(const BicycleBatch* b, int n, float* x, float* y, float* heading,
+        float* heading_x, float* heading_y, float* vx, float* vy, float dt, float max_speed) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 v_dt = _mm_set1_ps(dt);
+    __m128 v_half_dt = _mm_set1_ps(0.5f*dt);
+    __m128 v_max = _mm_set1_ps(max_speed);
+    __m128 v_min = _mm_set1_ps(-max_speed);
+    for (; i + 4 <= n; i += 4) {
+        __m128 pvx = _mm_loadu_ps(vx + i);
+        __m128 pvy = _mm_loadu_ps(vy + i);
+        __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(pvx, pvx), _mm_mul_ps(pvy, pvy)));
+        speed = _mm_add_ps(speed, _mm_mul_ps(v_half_dt, _mm_loadu_ps(b->accel + i)));
+        speed = _mm_min_ps(_mm_max_ps(speed, v_min), v_max);
+        __m128 yaw_rate = _mm_mul_ps(_mm_mul_ps(speed, _mm_loadu_ps(b->yaw_factor + i)), _mm_loadu_ps(b->inv_length + i));
+        __m128 hx = _mm_loadu_ps(heading_x + i);
+        __m128 hy = _mm_loadu_ps(heading_y + i);
+        __m128 cb = _mm_loadu_ps(b->cos_beta + i);
+        __m128 sb = _mm_loadu_ps(b->sin_beta + i);
+        __m128 dir_x = _mm_sub_ps(_mm_mul_ps(hx, cb), _mm_mul_ps(hy, sb));
+        __m128 dir_y = _mm_add_ps(_mm_mul_ps(hy, cb), _mm_mul_ps(hx, sb));
+        __m128 new_vx = _mm_mul_ps(speed, dir_x);
+        __m128 new_vy = _mm_mul_ps(speed, dir_y);
+        _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(new_vx, v_dt)));
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(new_vy, v_dt)));
+        __m128 h = _mm_add_ps(_mm_loadu_ps(heading + i), _mm_mul_ps(yaw_rate, v_dt));
+        _mm_storeu_ps(heading + i, h);
+        __m128 sin_h, cos_h;
+        sincos_approx_ps(h, &sin_h, &cos_h);
+        _mm_storeu_ps(heading_x + i, cos_h);
+        _mm_storeu_ps(heading_y + i, sin_h);
+        _mm_storeu_ps(vx + i, new_vx);
+        _mm_storeu_ps(vy + i, new_vy);
+    }
+#endif
+    for (; i < n; i++) {
+        bicycle_step_scalar(b, i, x, y, heading, heading_x, heading_y, vx, vy, dt, max_speed);
+    }
+}
+
+// INVERTIBLE_BICYLE: signed speed along the heading, trapezoidal speed update and
+// displacement along the mid-step heading. Both the speed and the heading change
+// are linear in the actions, which makes the model invertible in closed form.
+void invertible_bicycle_step_batch(BicycleBatch* b, int n, float* x, float* y, float* heading,
+        float* heading_x, float* heading_y, float* vx, float* vy, float dt, float max_speed) {
+    for (int i = 0; i < n; i++) {
+        float speed = heading_x[i]*vx[i] + heading_y[i]*vy[i];
+        float new_speed = fminf(fmaxf(speed + b->accel[i]*dt, -max_speed), max_speed);
+        float avg_speed = 0.5f*(speed + new_speed);
+        float yaw_delta = avg_speed*b->yaw_factor[i]*b->inv_length[i]*dt;
+        b->speed[i] = new_speed;
+        b->distance[i] = avg_speed*dt;
+        b->mid_heading[i] = heading[i] + 0.5f*yaw_delta;
+        heading[i] = heading[i] + yaw_delta;
+    }
+    sincos_batch(b->mid_heading, b->mid_sin, b->mid_cos, n);
+    sincos_batch(heading, heading_y, heading_x, n);
+    for (int i = 0; i < n; i++) {
+        x[i] = x[i] + b->distance[i]*b->mid_cos[i];
+        y[i] = y[i] + b->distance[i]*b->mid_sin[i];
+        vx[i] = b->speed[i]*heading_x[i];
+        vy[i] = b->speed[i]*heading_y[i];
+    }
+}
+
+// DELTA_LOCAL: actions are (dx, dy, dyaw) in the agent's frame at the start of the step.
+void delta_local_step_batch(const float (*actions)[3], int n, float* x, float* y, float* heading,
+        float* heading_x, float* heading_y, float* vx, float* vy, float dt) {
+    float inv_dt = 1.0f / dt;
+    for (int i = 0; i < n; i++) {
+        float dx = heading_x[i]*actions[i][0] - heading_y[i]*actions[i][1];
+        float dy = heading_y[i]*actions[i][0] + heading_x[i]*actions[i][1];
+        x[i] = x[i] + dx;
+        y[i] = y[i] + dy;
+        vx[i] = dx*inv_dt;
+        vy[i] = dy*inv_dt;
+        heading[i] = heading[i] + actions[i][2];
+    }
+    sincos_batch(heading, heading_y, heading_x, n);
+}
+
+// STATE_DYNAMICS: actions are the next (x, y, heading, vx, vy).
+void state_step_batch(const float (*actions)[5], int n, float* x, float* y, float* heading,
+        float* heading_x, float* heading_y, float* vx, float* vy) {
+    for (int i = 0; i < n; i++) {
+        x[i] = actions[i][0];
+        y[i] = actions[i][1];
+        heading[i] = actions[i][2];
+        vx[i] = actions[i][3];
+        vy[i] = actions[i][4];
+    }
+    sincos_batch(heading, heading_y, heading_x, n);
+}
+
+#endif // DRIVE_DYNAMICS_H
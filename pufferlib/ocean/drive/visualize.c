@@ -138,20 +138,22 @@ void renderTopDownView(Drive* env, Client* client, int map_height, int obs, int
 void renderAgentView(Drive* env, Client* client, int map_height, int obs_only, int lasers, int show_grid) {
     // Agent perspective camera following the selected agent
     int agent_idx = env->active_agent_indices[env->human_agent_idx];
-    Entity* agent = &env->entities[agent_idx];
+    float agent_x = env->sim.x[agent_idx];
+    float agent_y = env->sim.y[agent_idx];
+    float agent_heading = env->sim.heading[agent_idx];
 
     BeginDrawing();
 
     Camera3D camera = {0};
     // Position camera behind and above the agent
     camera.position = (Vector3){
-        agent->x - (25.0f * cosf(agent->heading)),
-        agent->y - (25.0f * sinf(agent->heading)),
+        agent_x - (25.0f * cosf(agent_heading)),
+        agent_y - (25.0f * sinf(agent_heading)),
         15.0f
     };
     camera.target = (Vector3){
-        agent->x + 40.0f * cosf(agent->heading),
-        agent->y + 40.0f * sinf(agent->heading),
+        agent_x + 40.0f * cosf(agent_heading),
+        agent_y + 40.0f * sinf(agent_heading),
         1.0f
     };
     camera.up = (Vector3){ 0.0f, 0.0f, 1.0f };
@@ -201,10 +203,12 @@ static int make_gif_from_frames(const char *pattern, int fps,
 
 int eval_gif(const char* map_name, const char* policy_name, int show_grid, int obs_only, int lasers, int log_trajectories, int frame_skip, float goal_radius, int control_non_vehicles, int init_steps, int control_all_agents, int policy_agents_per_env, int deterministic_selection, const char* view_mode, const char* output_topdown, const char* output_agent, int num_maps, int scenario_length_override) {
 
+    DriveRNG rng;
+    rng_seed(&rng, (uint64_t)time(NULL), 0);
+
     char map_buffer[100];
     if (map_name == NULL) {
-        srand(time(NULL));
-        int random_map = rand() % num_maps;
+        int random_map = rng_int(&rng, num_maps);
         sprintf(map_buffer, "resources/drive/binaries/map_%03d.bin", random_map); // random map file
         map_name = map_buffer;
     }
@@ -240,6 +244,7 @@ int eval_gif(const char* map_name, const char* policy_name, int show_grid, int o
         .deterministic_agent_selection = deterministic_selection
     };
     env.scenario_length = (scenario_length_override > 0) ? scenario_length_override : TRAJECTORY_LENGTH_DEFAULT;
+    rng_seed(&env.rng, rng_next(&rng), 1);
     allocate(&env);
 
     // Set which vehicle to focus on for obs mode
@@ -268,7 +273,8 @@ int eval_gif(const char* map_name, const char* policy_name, int show_grid, int o
 
     Weights* weights = load_weights(policy_name);
     printf("Active agents in map: %d\n", env.active_agent_count);
-    DriveNet* net = init_drivenet(weights, env.active_agent_count);
+    DriveNet* net = init_drivenet(weights, env.active_agent_count, env.obs_layout, env.obs_header, env.max_partners, env.max_roads);
+    seed_multidiscrete(net->multidiscrete, rng_next(&rng));
 
     int frame_count = env.scenario_length > 0 ? env.scenario_length : TRAJECTORY_LENGTH_DEFAULT;
     int log_trajectory = log_trajectories;
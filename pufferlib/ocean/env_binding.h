@@ -1,6 +1,14 @@
 #include <../../inih-r62/ini.h>
 #include <Python.h>
 #include <numpy/arrayobject.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <sys/syscall.h>
+#endif
 
 // Forward declarations for env-specific functions supplied by user
 static int my_log(PyObject* dict, Log* log);
@@ -20,6 +28,15 @@ static PyObject* my_get(PyObject* dict, Env* env) {
 }
 #endif
 
+// Seeds the env's sampling state. Envs that keep their own RNG define MY_SEED
+// so that seeding is per env and safe to call from pool threads.
+static void my_seed(Env* env, int seed);
+#ifndef MY_SEED
+static void my_seed(Env* env, int seed) {
+    srand(seed);
+}
+#endif
+
 static int my_put(Env* env, PyObject* args, PyObject* kwargs);
 #ifndef MY_PUT
 static int my_put(Env* env, PyObject* args, PyObject* kwargs) {
@@ -27,6 +44,29 @@ static int my_put(Env* env, PyObject* args, PyObject* kwargs) {
 }
 #endif
 
+// Moves an env's buffer pointers by byte offsets, in the order observations,
+// actions, rewards, terminals, masks. Used to switch a vec between buffer
+// slots. Envs holding other views into these buffers define MY_REBASE.
+#define VEC_BUFFERS 5
+static void my_rebase(Env* env, const ptrdiff_t* delta);
+#ifndef MY_REBASE
+static void my_rebase(Env* env, const ptrdiff_t* delta) {
+    env->observations = (void*)((char*)env->observations + delta[0]);
+    env->actions = (void*)((char*)env->actions + delta[1]);
+    env->rewards = (void*)((char*)env->rewards + delta[2]);
+    env->terminals = (void*)((char*)env->terminals + delta[3]);
+}
+#endif
+
+// Predicted relative step time of an env. The vec splits its envs across pool
+// threads by cumulative cost and vec_log compares it with the measured times.
+static float my_cost(Env* env);
+#ifndef MY_COST
+static float my_cost(Env* env) {
+    return 1.0f;
+}
+#endif
+
 #ifndef MY_METHODS
 #define MY_METHODS {NULL, NULL, 0, NULL}
 #endif
@@ -145,7 +185,7 @@ static PyObject* env_init(PyObject* self, PyObject* args, PyObject* kwargs) {
     int seed = PyLong_AsLong(seed_arg);
 
     // Assumes each process has the same number of environments
-    srand(seed);
+    my_seed(env, seed);
 
     // If kwargs is NULL, create a new dictionary
     if (kwargs == NULL) {
@@ -174,6 +214,11 @@ static PyObject* env_init(PyObject* self, PyObject* args, PyObject* kwargs) {
     return PyLong_FromVoidPtr(env);
 }
 
+// The step/reset/log entry points release the GIL around the pure C work. The
+// env only touches the NumPy buffers captured at init/put time, so Python
+// threads keep running meanwhile. Callers must not close or put into an env
+// from another thread while it is being stepped.
+
 // Python function to reset the environment
 static PyObject* env_reset(PyObject* self, PyObject* args) {
     if (PyTuple_Size(args) != 2) {
@@ -185,7 +230,9 @@ static PyObject* env_reset(PyObject* self, PyObject* args) {
     if (!env){
         return NULL;
     }
+    Py_BEGIN_ALLOW_THREADS
     c_reset(env);
+    Py_END_ALLOW_THREADS
     Py_RETURN_NONE;
 }
 
@@ -201,7 +248,9 @@ static PyObject* env_step(PyObject* self, PyObject* args) {
     if (!env){
         return NULL;
     }
+    Py_BEGIN_ALLOW_THREADS
     c_step(env);
+    Py_END_ALLOW_THREADS
     Py_RETURN_NONE;
 }
 
@@ -260,11 +309,411 @@ static PyObject* env_put(PyObject* self, PyObject* args, PyObject* kwargs) {
     Py_RETURN_NONE;
 }
 
+#define VEC_SLOTS 2
+
 typedef struct {
     Env** envs;
     int num_envs;
+    int num_threads;    // threads used by vec_step/vec_reset, including the caller
+    // Double-buffered outputs: base address and size of each registered buffer
+    // per slot, and the slot the envs currently point into
+    char* slot_base[VEC_SLOTS][VEC_BUFFERS];
+    npy_intp slot_bytes[VEC_SLOTS][VEC_BUFFERS];
+    int slot_registered[VEC_SLOTS];
+    int slot;
+    // vec_step_async hands the step to async_thread, a worker started on the
+    // first call that sleeps on async_cond between steps until vec_close
+    pthread_t async_thread;
+    pthread_mutex_t async_mutex;
+    pthread_cond_t async_cond;
+    int async_started;
+    int async_pending;      // a step was handed over and vec_wait has not returned
+    int async_done;         // the worker finished the pending step
+    int async_shutdown;
+    // Load balancing: my_cost per env and its prefix sums (num_envs + 1), and
+    // the step time measured per env since vec_log last returned stats
+    float* env_cost;
+    double* cost_prefix;
+    double* env_time;
+    // NUMA binding (numa_bind): first buffer row of each env (num_envs + 1) and
+    // the bytes per row of each buffer, set by envs that lay their rows out in order
+    int numa_bind;
+    int* env_rows;
+    npy_intp row_bytes[VEC_BUFFERS];
 } VecEnv;
 
+// Persistent worker pool shared by all VecEnvs of the module. A job runs one
+// task per env: the env range is split into one queue per participant (the
+// calling thread plus the workers) holding about the same predicted cost, each
+// participant drains its own queue and then steals from the others. Queues are
+// claimed with an atomic counter, so mispredicted maps still balance.
+typedef void (*vec_task_fn)(Env* env, int env_idx, void* ctx);
+
+typedef struct {
+    int next;   // claimed with __atomic_fetch_add
+    int end;
+    char pad[64 - 2*sizeof(int)];   // one queue per cache line
+} PoolQueue;
+
+typedef struct {
+    pthread_t* threads;
+    int num_workers;
+    int pin_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    unsigned long generation;
+    int active_workers;     // workers taking part in the current job
+    int workers_done;
+    int shutdown;
+    // Current job
+    vec_task_fn task;
+    void* ctx;
+    Env** envs;
+    PoolQueue* queues;      // num_workers + 1 queues
+    int num_queues;
+} ThreadPool;
+
+static ThreadPool* thread_pool = NULL;
+// Held while a job runs and while the pool is resized, so one job at a time
+static pthread_mutex_t thread_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void pool_run_queues(ThreadPool* pool, int self) {
+    int n = pool->num_queues;
+    for (int k = 0; k < n; k++) {
+        PoolQueue* queue = &pool->queues[(self + k) % n];
+        while (1) {
+            int i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+            if (i >= queue->end) break;
+            pool->task(pool->envs[i], i, pool->ctx);
+        }
+    }
+}
+
+// Pins the calling thread to one core. Uses the raw syscall so the binding does
+// not depend on _GNU_SOURCE being defined before the first system header.
+static void pool_pin_self(int core) {
+#ifdef __linux__
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cores <= 0) return;
+    core = core % num_cores;
+    unsigned long mask[16] = {0};
+    int bits = 8*sizeof(unsigned long);
+    if (core >= 16*bits) return;
+    mask[core / bits] = 1UL << (core % bits);
+    syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+#else
+    (void)core;
+#endif
+}
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define BIND_MPOL_PREFERRED 1
+#define BIND_MPOL_MF_MOVE 2
+
+// NUMA node of a core from sysfs, -1 when unknown
+static int core_node(int core) {
+#ifdef __linux__
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", core);
+    DIR* dir = opendir(path);
+    if (!dir) return -1;
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) break;
+    }
+    closedir(dir);
+    return node;
+#else
+    (void)core;
+    return -1;
+#endif
+}
+
+// NUMA node the calling thread runs on, -1 when unknown
+static int current_node(void) {
+#ifdef __linux__
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return -1;
+    return (int)node;
+#else
+    return -1;
+#endif
+}
+
+// Prefers node for the whole huge pages inside [addr, addr + bytes) and moves
+// the ones already touched there. Best effort: without NUMA support (or on a
+// single node) the pages stay where first touch put them.
+static void bind_pages(char* addr, size_t bytes, int node) {
+#ifdef __linux__
+    if (node < 0 || node >= 1024) return;
+    uintptr_t start = ((uintptr_t)addr + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)addr + bytes) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    if (end <= start) return;
+    unsigned long mask[16] = {0};
+    int bits = 8*sizeof(unsigned long);
+    mask[node / bits] = 1UL << (node % bits);
+    syscall(SYS_mbind, (void*)start, end - start, BIND_MPOL_PREFERRED, mask, 16*bits, BIND_MPOL_MF_MOVE);
+#else
+    (void)addr; (void)bytes; (void)node;
+#endif
+}
+
+typedef struct {
+    ThreadPool* pool;
+    int worker_idx;
+} PoolWorkerArg;
+
+static void* pool_worker(void* arg) {
+    PoolWorkerArg* worker = (PoolWorkerArg*)arg;
+    ThreadPool* pool = worker->pool;
+    int worker_idx = worker->worker_idx;
+    free(worker);
+    if (pool->pin_threads) {
+        pool_pin_self(worker_idx + 1);
+    }
+    unsigned long seen = 0;
+    while (1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->start_cond, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        seen = pool->generation;
+        int participates = worker_idx < pool->active_workers;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (participates) {
+            pool_run_queues(pool, worker_idx + 1);
+            pthread_mutex_lock(&pool->mutex);
+            pool->workers_done++;
+            if (pool->workers_done == pool->active_workers) {
+                pthread_cond_signal(&pool->done_cond);
+            }
+            pthread_mutex_unlock(&pool->mutex);
+        }
+    }
+}
+
+
+static void pool_destroy(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+}
+
+// Makes sure the module pool has at least num_threads - 1 workers. Workers are
+// pinned to cores 1..num_workers when pin_threads is set (Linux only), leaving
+// core 0 to the calling thread. Called with thread_pool_lock held.
+static int pool_reserve_locked(int num_threads, int pin_threads) {
+    int num_workers = num_threads - 1;
+    if (num_workers <= 0) return 0;
+    if (thread_pool && thread_pool->num_workers >= num_workers && thread_pool->pin_threads == pin_threads) {
+        return 0;
+    }
+    if (thread_pool) {
+        if (thread_pool->num_workers > num_workers) num_workers = thread_pool->num_workers;
+        pool_destroy(thread_pool);
+        thread_pool = NULL;
+    }
+
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (!pool) return -1;
+    pool->threads = (pthread_t*)calloc(num_workers, sizeof(pthread_t));
+    pool->queues = (PoolQueue*)calloc(num_workers + 1, sizeof(PoolQueue));
+    if (!pool->threads || !pool->queues) {
+        free(pool->threads);
+        free(pool->queues);
+        free(pool);
+        return -1;
+    }
+    pool->pin_threads = pin_threads;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (int i = 0; i < num_workers; i++) {
+        PoolWorkerArg* arg = (PoolWorkerArg*)malloc(sizeof(PoolWorkerArg));
+        if (arg) {
+            arg->pool = pool;
+            arg->worker_idx = i;
+        }
+        if (!arg || pthread_create(&pool->threads[i], NULL, pool_worker, arg) != 0) {
+            free(arg);
+            pool->num_workers = i;
+            pool_destroy(pool);
+            return -1;
+        }
+        pool->num_workers = i + 1;
+    }
+    thread_pool = pool;
+    return 0;
+}
+
+static int pool_reserve(int num_threads, int pin_threads) {
+    pthread_mutex_lock(&thread_pool_lock);
+    int err = pool_reserve_locked(num_threads, pin_threads);
+    pthread_mutex_unlock(&thread_pool_lock);
+    return err;
+}
+
+// First env of queue q out of num_queues: the first env whose cost prefix
+// reaches q/num_queues of the total. Even split when costs are unknown.
+static int vec_split(VecEnv* vec, int q, int num_queues) {
+    int n = vec->num_envs;
+    if (q >= num_queues) return n;
+    double* prefix = vec->cost_prefix;
+    if (!prefix || prefix[n] <= 0.0) return (int)((long)n * q / num_queues);
+    double target = prefix[n] * q / num_queues;
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (prefix[mid] < target) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Recomputes env costs after the env list or its maps change and restarts the
+// step timers
+static void vec_update_costs(VecEnv* vec) {
+    int n = vec->num_envs;
+    vec->env_cost = (float*)realloc(vec->env_cost, n*sizeof(float));
+    vec->cost_prefix = (double*)realloc(vec->cost_prefix, (n + 1)*sizeof(double));
+    vec->env_time = (double*)realloc(vec->env_time, n*sizeof(double));
+    vec->cost_prefix[0] = 0.0;
+    for (int i = 0; i < n; i++) {
+        vec->env_cost[i] = my_cost(vec->envs[i]);
+        vec->cost_prefix[i + 1] = vec->cost_prefix[i] + vec->env_cost[i];
+        vec->env_time[i] = 0.0;
+    }
+}
+
+// Threads (queues) a job of the vec runs on, given the pool. Called with
+// thread_pool_lock held.
+static int vec_num_queues(VecEnv* vec, ThreadPool* pool) {
+    int num_threads = vec->num_threads;
+    if (!pool) num_threads = 1;
+    else if (num_threads > pool->num_workers + 1) num_threads = pool->num_workers + 1;
+    if (num_threads > vec->num_envs) num_threads = vec->num_envs;
+    return num_threads < 1 ? 1 : num_threads;
+}
+
+// Runs task on every env of the vec, on vec->num_threads threads. Falls back to
+// a plain loop on the calling thread when threading is off.
+static void vec_parallel_for(VecEnv* vec, vec_task_fn task, void* ctx) {
+    if (vec->num_threads <= 1 || vec->num_envs <= 1) {
+        for (int i = 0; i < vec->num_envs; i++) {
+            task(vec->envs[i], i, ctx);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&thread_pool_lock);
+    ThreadPool* pool = thread_pool;
+    int num_threads = vec_num_queues(vec, pool);
+    if (num_threads <= 1) {
+        for (int i = 0; i < vec->num_envs; i++) {
+            task(vec->envs[i], i, ctx);
+        }
+        pthread_mutex_unlock(&thread_pool_lock);
+        return;
+    }
+
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->envs = vec->envs;
+    pool->num_queues = num_threads;
+    for (int q = 0; q < num_threads; q++) {
+        pool->queues[q].next = vec_split(vec, q, num_threads);
+        pool->queues[q].end = vec_split(vec, q + 1, num_threads);
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->active_workers = num_threads - 1;
+    pool->workers_done = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool_run_queues(pool, 0);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->workers_done < pool->active_workers) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&thread_pool_lock);
+}
+
+// Binds each thread's rows of the buffers at base to the NUMA node of that
+// thread: the envs of queue q are stepped first by participant q, which is core
+// q when the pool is pinned. Unpinned threads move around, so their rows go to
+// the node the caller runs on, i.e. the node of the process.
+static void vec_bind_numa(VecEnv* vec, char* const* base) {
+    if (!vec->numa_bind || !vec->env_rows) return;
+    pthread_mutex_lock(&thread_pool_lock);
+    ThreadPool* pool = thread_pool;
+    int num_queues = vec->num_threads > 1 ? vec_num_queues(vec, pool) : 1;
+    int pinned = pool && pool->pin_threads;
+    pthread_mutex_unlock(&thread_pool_lock);
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int caller_node = current_node();
+    for (int q = 0; q < num_queues; q++) {
+        int node = caller_node;
+        if (pinned && q > 0 && num_cores > 0) node = core_node(q % num_cores);
+        int first = vec->env_rows[vec_split(vec, q, num_queues)];
+        int end = vec->env_rows[vec_split(vec, q + 1, num_queues)];
+        for (int k = 0; k < VEC_BUFFERS; k++) {
+            if (!base[k]) continue;
+            bind_pages(base[k] + first*vec->row_bytes[k], (size_t)(end - first)*vec->row_bytes[k], node);
+        }
+    }
+}
+
+// Reads num_threads / pin_threads / numa_bind from kwargs (all optional) and
+// sizes the pool
+static int vec_configure_threads(VecEnv* vec, PyObject* kwargs) {
+    vec->num_threads = 1;
+    if (kwargs == NULL) return 0;
+    PyObject* numa_obj = PyDict_GetItemString(kwargs, "numa_bind");
+    if (numa_obj != NULL) {
+        vec->numa_bind = PyObject_IsTrue(numa_obj);
+        if (vec->numa_bind < 0) return -1;
+    }
+    PyObject* threads_obj = PyDict_GetItemString(kwargs, "num_threads");
+    if (threads_obj == NULL) return 0;
+    int num_threads = PyLong_AsLong(threads_obj);
+    if (PyErr_Occurred()) return -1;
+    if (num_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cores > 0 ? (int)cores : 1;
+    }
+    int pin_threads = 0;
+    PyObject* pin_obj = PyDict_GetItemString(kwargs, "pin_threads");
+    if (pin_obj != NULL) {
+        pin_threads = PyObject_IsTrue(pin_obj);
+    }
+    if (pool_reserve(num_threads, pin_threads) != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to start the vec thread pool");
+        return -1;
+    }
+    vec->num_threads = num_threads;
+    return 0;
+}
+
 static VecEnv* unpack_vecenv(PyObject* args) {
     PyObject* handle_obj = PyTuple_GetItem(args, 0);
     if (!PyObject_TypeCheck(handle_obj, &PyLong_Type)) {
@@ -423,7 +872,7 @@ static PyObject* vec_init(PyObject* self, PyObject* args, PyObject* kwargs) {
 
         // Assumes each process has the same number of environments
         int env_seed = i + seed*vec->num_envs;
-        srand(env_seed);
+        my_seed(env, env_seed);
 
         // Add the seed to kwargs for this environment
         PyObject* py_seed = PyLong_FromLong(env_seed);
@@ -442,13 +891,18 @@ static PyObject* vec_init(PyObject* self, PyObject* args, PyObject* kwargs) {
         }
     }
 
+    if (vec_configure_threads(vec, kwargs) != 0) {
+        Py_DECREF(kwargs);
+        return NULL;
+    }
     Py_DECREF(kwargs);
+    vec_update_costs(vec);
     return PyLong_FromVoidPtr(vec);
 }
 
 
 // Python function to close the environment
-static PyObject* vectorize(PyObject* self, PyObject* args) {
+static PyObject* vectorize(PyObject* self, PyObject* args, PyObject* kwargs) {
     int num_envs = PyTuple_Size(args);
     if (num_envs == 0) {
         PyErr_SetString(PyExc_TypeError, "make_vec requires at least 1 env id");
@@ -476,10 +930,241 @@ static PyObject* vectorize(PyObject* self, PyObject* args) {
         }
         vec->envs[i] = (Env*)PyLong_AsVoidPtr(handle_obj);
     }
+    if (vec_configure_threads(vec, kwargs) != 0) {
+        return NULL;
+    }
+    vec_update_costs(vec);
 
     return PyLong_FromVoidPtr(vec);
 }
 
+typedef struct {
+    int seed;
+    int num_envs;
+} VecResetArgs;
+
+static void vec_reset_task(Env* env, int env_idx, void* ctx) {
+    VecResetArgs* reset = ctx;
+    // Assumes each process has the same number of environments
+    my_seed(env, env_idx + reset->seed*reset->num_envs);
+    c_reset(env);
+}
+
+static double vec_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9*now.tv_nsec;
+}
+
+static void vec_step_task(Env* env, int env_idx, void* ctx) {
+    VecEnv* vec = ctx;
+    double start = vec_now();
+    c_step(env);
+    vec->env_time[env_idx] += vec_now() - start;
+}
+
+// Blocks until a step started by vec_step_async has finished. Every other vec
+// entry point calls this first, so they never race with a pending step.
+static void vec_join_async(VecEnv* vec) {
+    if (!vec->async_pending) return;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&vec->async_mutex);
+    while (!vec->async_done) {
+        pthread_cond_wait(&vec->async_cond, &vec->async_mutex);
+    }
+    vec->async_pending = 0;
+    vec->async_done = 0;
+    pthread_mutex_unlock(&vec->async_mutex);
+    Py_END_ALLOW_THREADS
+}
+
+static void* vec_async_main(void* arg) {
+    VecEnv* vec = (VecEnv*)arg;
+    pthread_mutex_lock(&vec->async_mutex);
+    while (1) {
+        while (!vec->async_shutdown && (!vec->async_pending || vec->async_done)) {
+            pthread_cond_wait(&vec->async_cond, &vec->async_mutex);
+        }
+        if (vec->async_shutdown) break;
+        pthread_mutex_unlock(&vec->async_mutex);
+        vec_parallel_for(vec, vec_step_task, vec);
+        pthread_mutex_lock(&vec->async_mutex);
+        vec->async_done = 1;
+        pthread_cond_broadcast(&vec->async_cond);
+    }
+    pthread_mutex_unlock(&vec->async_mutex);
+    return NULL;
+}
+
+// Starts async_thread on first use
+static int vec_start_async(VecEnv* vec) {
+    if (vec->async_started) return 0;
+    pthread_mutex_init(&vec->async_mutex, NULL);
+    pthread_cond_init(&vec->async_cond, NULL);
+    if (pthread_create(&vec->async_thread, NULL, vec_async_main, vec) != 0) {
+        pthread_mutex_destroy(&vec->async_mutex);
+        pthread_cond_destroy(&vec->async_cond);
+        PyErr_SetString(PyExc_RuntimeError, "Failed to start the async step thread");
+        return -1;
+    }
+    vec->async_started = 1;
+    return 0;
+}
+
+// Waits for a pending step, then stops and joins async_thread
+static void vec_stop_async(VecEnv* vec) {
+    vec_join_async(vec);
+    if (!vec->async_started) return;
+    pthread_mutex_lock(&vec->async_mutex);
+    vec->async_shutdown = 1;
+    pthread_cond_broadcast(&vec->async_cond);
+    pthread_mutex_unlock(&vec->async_mutex);
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(vec->async_thread, NULL);
+    Py_END_ALLOW_THREADS
+    pthread_mutex_destroy(&vec->async_mutex);
+    pthread_cond_destroy(&vec->async_cond);
+    vec->async_started = 0;
+}
+
+// Points every env at the buffers of the given slot
+static int vec_switch_slot(VecEnv* vec, int slot) {
+    if (slot < 0 || slot >= VEC_SLOTS) {
+        PyErr_SetString(PyExc_ValueError, "slot must be 0 or 1");
+        return -1;
+    }
+    if (slot == vec->slot) return 0;
+    if (!vec->slot_registered[slot] || !vec->slot_registered[vec->slot]) {
+        PyErr_SetString(PyExc_ValueError, "Register both slots with vec_buffers before switching");
+        return -1;
+    }
+    ptrdiff_t delta[VEC_BUFFERS];
+    for (int k = 0; k < VEC_BUFFERS; k++) {
+        char* from = vec->slot_base[vec->slot][k];
+        char* to = vec->slot_base[slot][k];
+        delta[k] = from && to ? to - from : 0;
+    }
+    for (int i = 0; i < vec->num_envs; i++) {
+        my_rebase(vec->envs[i], delta);
+    }
+    vec->slot = slot;
+    return 0;
+}
+
+// vec_buffers(vec, slot, observations, actions, rewards, terminals, masks):
+// registers the buffer set of a slot. Slot 0 must be the buffers the envs were
+// created on; slot 1 a second set of the same sizes. masks may be None.
+static PyObject* vec_buffers(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 2 + VEC_BUFFERS) {
+        PyErr_SetString(PyExc_TypeError, "vec_buffers requires 7 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    int slot = PyLong_AsLong(PyTuple_GetItem(args, 1));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    if (slot < 0 || slot >= VEC_SLOTS) {
+        PyErr_SetString(PyExc_ValueError, "slot must be 0 or 1");
+        return NULL;
+    }
+    vec_join_async(vec);
+    char* base[VEC_BUFFERS];
+    npy_intp bytes[VEC_BUFFERS];
+    for (int k = 0; k < VEC_BUFFERS; k++) {
+        PyObject* obj = PyTuple_GetItem(args, 2 + k);
+        base[k] = NULL;
+        bytes[k] = 0;
+        if (obj == Py_None && k == VEC_BUFFERS - 1) {
+            continue;
+        }
+        if (!PyObject_TypeCheck(obj, &PyArray_Type) || !PyArray_ISCONTIGUOUS((PyArrayObject*)obj)) {
+            PyErr_SetString(PyExc_TypeError, "Slot buffers must be contiguous NumPy arrays");
+            return NULL;
+        }
+        base[k] = PyArray_DATA((PyArrayObject*)obj);
+        bytes[k] = PyArray_NBYTES((PyArrayObject*)obj);
+        int other = 1 - slot;
+        if (vec->slot_registered[other] && bytes[k] != vec->slot_bytes[other][k]) {
+            PyErr_SetString(PyExc_ValueError, "Both slots must hold buffers of the same sizes");
+            return NULL;
+        }
+    }
+    memcpy(vec->slot_base[slot], base, sizeof(base));
+    memcpy(vec->slot_bytes[slot], bytes, sizeof(bytes));
+    vec->slot_registered[slot] = 1;
+    vec_bind_numa(vec, base);
+    Py_RETURN_NONE;
+}
+
+// vec_step_async(vec, slot): switches the envs to the slot's buffers and steps
+// them on the vec's async thread, reading that slot's actions and writing its
+// outputs. Returns immediately; the slot must not be touched until vec_wait.
+static PyObject* vec_step_async(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 2) {
+        PyErr_SetString(PyExc_TypeError, "vec_step_async requires 2 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    int slot = PyLong_AsLong(PyTuple_GetItem(args, 1));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    if (vec->async_pending) {
+        PyErr_SetString(PyExc_RuntimeError, "A step is already pending, call vec_wait first");
+        return NULL;
+    }
+    if (vec_switch_slot(vec, slot) != 0) {
+        return NULL;
+    }
+    if (vec_start_async(vec) != 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&vec->async_mutex);
+    vec->async_pending = 1;
+    pthread_cond_broadcast(&vec->async_cond);
+    pthread_mutex_unlock(&vec->async_mutex);
+    Py_RETURN_NONE;
+}
+
+// Waits for the step started by vec_step_async. No-op when none is pending.
+static PyObject* vec_wait(PyObject* self, PyObject* args) {
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    vec_join_async(vec);
+    Py_RETURN_NONE;
+}
+
+// vec_slot(vec, slot): points the envs at a slot's buffers for the synchronous
+// entry points (vec_step, vec_reset)
+static PyObject* vec_slot(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 2) {
+        PyErr_SetString(PyExc_TypeError, "vec_slot requires 2 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    int slot = PyLong_AsLong(PyTuple_GetItem(args, 1));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    vec_join_async(vec);
+    if (vec_switch_slot(vec, slot) != 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyObject* vec_reset(PyObject* self, PyObject* args) {
     if (PyTuple_Size(args) != 2) {
         PyErr_SetString(PyExc_TypeError, "vec_reset requires 2 arguments");
@@ -490,6 +1175,7 @@ static PyObject* vec_reset(PyObject* self, PyObject* args) {
     if (!vec) {
         return NULL;
     }
+    vec_join_async(vec);
 
     PyObject* seed_arg = PyTuple_GetItem(args, 1);
     if (!PyObject_TypeCheck(seed_arg, &PyLong_Type)) {
@@ -498,11 +1184,10 @@ static PyObject* vec_reset(PyObject* self, PyObject* args) {
     }
     int seed = PyLong_AsLong(seed_arg);
 
-    for (int i = 0; i < vec->num_envs; i++) {
-        // Assumes each process has the same number of environments
-        srand(i + seed*vec->num_envs);
-        c_reset(vec->envs[i]);
-    }
+    VecResetArgs reset = {seed, vec->num_envs};
+    Py_BEGIN_ALLOW_THREADS
+    vec_parallel_for(vec, vec_reset_task, &reset);
+    Py_END_ALLOW_THREADS
     Py_RETURN_NONE;
 }
 
@@ -517,10 +1202,11 @@ static PyObject* vec_step(PyObject* self, PyObject* arg) {
     if (!vec) {
         return NULL;
     }
+    vec_join_async(vec);
 
-    for (int i = 0; i < vec->num_envs; i++) {
-        c_step(vec->envs[i]);
-    }
+    Py_BEGIN_ALLOW_THREADS
+    vec_parallel_for(vec, vec_step_task, vec);
+    Py_END_ALLOW_THREADS
     Py_RETURN_NONE;
 }
 
@@ -544,6 +1230,7 @@ static PyObject* vec_render(PyObject* self, PyObject* args) {
     }
     int env_id = PyLong_AsLong(env_id_arg);
 
+    vec_join_async(vec);
     c_render(vec->envs[env_id]);
     Py_RETURN_NONE;
 }
@@ -562,16 +1249,60 @@ static int assign_to_dict(PyObject* dict, char* key, float value) {
     return 0;
 }
 
+// Max over mean of the costs (predicted) and step times (measured) of each env
+// and of each thread's initial share of envs, then restarts the timers. Work
+// stealing evens out the measured thread times within a step, so a measured
+// imbalance well above the predicted one points at a mispredicted map.
+static void vec_log_balance(VecEnv* vec, PyObject* dict) {
+    int n = vec->num_envs;
+    // The queues vec_parallel_for splits the envs into
+    pthread_mutex_lock(&thread_pool_lock);
+    int num_threads = vec->num_threads > 1 ? vec_num_queues(vec, thread_pool) : 1;
+    pthread_mutex_unlock(&thread_pool_lock);
+    double max_cost = 0.0, max_time = 0.0, total_time = 0.0;
+    for (int i = 0; i < n; i++) {
+        if (vec->env_cost[i] > max_cost) max_cost = vec->env_cost[i];
+        if (vec->env_time[i] > max_time) max_time = vec->env_time[i];
+        total_time += vec->env_time[i];
+    }
+    double total_cost = vec->cost_prefix[n];
+    double max_thread_cost = 0.0, max_thread_time = 0.0;
+    for (int q = 0; q < num_threads; q++) {
+        int first = vec_split(vec, q, num_threads);
+        int last = vec_split(vec, q + 1, num_threads);
+        double cost = vec->cost_prefix[last] - vec->cost_prefix[first];
+        double time = 0.0;
+        for (int i = first; i < last; i++) time += vec->env_time[i];
+        if (cost > max_thread_cost) max_thread_cost = cost;
+        if (time > max_thread_time) max_thread_time = time;
+    }
+    // Processes sample their maps independently, so comparing this across
+    // worker processes shows how unevenly they are loaded
+    assign_to_dict(dict, "predicted_step_cost", total_cost);
+    if (total_cost > 0.0) {
+        assign_to_dict(dict, "env_imbalance_predicted", max_cost*n/total_cost);
+        assign_to_dict(dict, "thread_imbalance_predicted", max_thread_cost*num_threads/total_cost);
+    }
+    if (total_time > 0.0) {
+        assign_to_dict(dict, "env_imbalance_measured", max_time*n/total_time);
+        assign_to_dict(dict, "thread_imbalance_measured", max_thread_time*num_threads/total_time);
+    }
+    memset(vec->env_time, 0, n*sizeof(double));
+}
+
 static PyObject* vec_log(PyObject* self, PyObject* args) {
     VecEnv* vec = unpack_vecenv(args);
     if (!vec) {
         return NULL;
     }
 
+    vec_join_async(vec);
+
     // Iterates over logs one float at a time. Will break
     // horribly if Log has non-float data.
     Log aggregate = {0};
     int num_keys = sizeof(Log) / sizeof(float);
+    Py_BEGIN_ALLOW_THREADS
     for (int i = 0; i < vec->num_envs; i++) {
         Env* env = vec->envs[i];
         for (int j = 0; j < num_keys; j++) {
@@ -579,6 +1310,7 @@ static PyObject* vec_log(PyObject* self, PyObject* args) {
             ((float*)&env->log)[j] = 0.0f;
         }
     }
+    Py_END_ALLOW_THREADS
 
     PyObject* dict = PyDict_New();
     if (aggregate.n == 0.0f) {
@@ -594,6 +1326,7 @@ static PyObject* vec_log(PyObject* self, PyObject* args) {
     // User populates dict
     my_log(dict, &aggregate);
     assign_to_dict(dict, "n", n);
+    vec_log_balance(vec, dict);
 
     return dict;
 }
@@ -603,12 +1336,17 @@ static PyObject* vec_close(PyObject* self, PyObject* args) {
     if (!vec) {
         return NULL;
     }
+    vec_stop_async(vec);
 
     for (int i = 0; i < vec->num_envs; i++) {
         c_close(vec->envs[i]);
         free(vec->envs[i]);
     }
     free(vec->envs);
+    free(vec->env_cost);
+    free(vec->cost_prefix);
+    free(vec->env_time);
+    free(vec->env_rows);
     free(vec);
     Py_RETURN_NONE;
 }
@@ -667,6 +1405,119 @@ static char* unpack_str(PyObject* kwargs, char* key) {
     return ret;
 }
 
+// Huge page modes of alloc_buffer
+#define PAGES_DEFAULT 0
+#define PAGES_TRANSPARENT 1     // madvise(MADV_HUGEPAGE), needs THP in madvise or always mode
+#define PAGES_EXPLICIT 2        // MAP_HUGETLB, needs pages reserved with vm.nr_hugepages
+
+typedef struct {
+    void* addr;
+    size_t bytes;
+} PageBuffer;
+
+static void free_page_buffer(PyObject* capsule) {
+    PageBuffer* buf = (PageBuffer*)PyCapsule_GetPointer(capsule, "binding.PageBuffer");
+    if (!buf) return;
+    munmap(buf->addr, buf->bytes);
+    free(buf);
+}
+
+// alloc_buffer(nbytes, huge_pages=0): a 1-D uint8 array over a fresh private
+// mapping, for the caller to view as its observation/action/... buffer. Its
+// pages are untouched, so each lands on the NUMA node of the thread that first
+// writes it (or where vec_bind_numa puts it). huge_pages is one of the PAGES_*
+// modes; the mapping is aligned to HUGE_PAGE_SIZE for both huge page modes.
+static PyObject* alloc_buffer(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"nbytes", "huge_pages", NULL};
+    Py_ssize_t nbytes = 0;
+    int huge_pages = PAGES_DEFAULT;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|i", kwlist, &nbytes, &huge_pages)) {
+        return NULL;
+    }
+    if (nbytes < 0 || huge_pages < PAGES_DEFAULT || huge_pages > PAGES_EXPLICIT) {
+        PyErr_SetString(PyExc_ValueError, "alloc_buffer needs nbytes >= 0 and huge_pages 0, 1 or 2");
+        return NULL;
+    }
+    size_t align = huge_pages == PAGES_DEFAULT ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+    size_t bytes = ((size_t)(nbytes > 0 ? nbytes : 1) + align - 1) / align * align;
+    void* addr = MAP_FAILED;
+    if (huge_pages == PAGES_EXPLICIT) {
+#ifdef MAP_HUGETLB
+        addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (addr == MAP_FAILED) {
+            PyErr_SetString(PyExc_OSError, "No explicit huge pages available, reserve them with vm.nr_hugepages");
+            return NULL;
+        }
+    } else if (huge_pages == PAGES_TRANSPARENT) {
+        // Over-map by one huge page and trim, so the buffer starts on a huge page
+        char* raw = mmap(NULL, bytes + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            char* start = (char*)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+            if (start > raw) munmap(raw, start - raw);
+            munmap(start + bytes, raw + align - start);
+            addr = start;
+#ifdef MADV_HUGEPAGE
+            madvise(addr, bytes, MADV_HUGEPAGE);
+#endif
+        }
+    } else {
+        addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (addr == MAP_FAILED) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return NULL;
+    }
+
+    PageBuffer* buf = (PageBuffer*)malloc(sizeof(PageBuffer));
+    buf->addr = addr;
+    buf->bytes = bytes;
+    PyObject* capsule = PyCapsule_New(buf, "binding.PageBuffer", free_page_buffer);
+    if (!capsule) {
+        munmap(addr, bytes);
+        free(buf);
+        return NULL;
+    }
+    npy_intp dims[1] = {nbytes};
+    PyObject* array = PyArray_SimpleNewFromData(1, dims, NPY_UINT8, addr);
+    if (!array) {
+        Py_DECREF(capsule);
+        return NULL;
+    }
+    // Steals the capsule, which unmaps the pages with the last view
+    if (PyArray_SetBaseObject((PyArrayObject*)array, capsule) != 0) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    return array;
+}
+
+// advise_buffer(array): madvise(MADV_HUGEPAGE) on the whole huge pages inside
+// an existing contiguous array, for buffers the caller allocated itself (e.g.
+// multiprocessing shared memory). Returns the number of bytes advised.
+static PyObject* advise_buffer(PyObject* self, PyObject* args) {
+    PyObject* obj;
+    if (!PyArg_ParseTuple(args, "O", &obj)) {
+        return NULL;
+    }
+    if (!PyArray_Check(obj) || !PyArray_IS_C_CONTIGUOUS((PyArrayObject*)obj)) {
+        PyErr_SetString(PyExc_TypeError, "advise_buffer needs a contiguous numpy array");
+        return NULL;
+    }
+    PyArrayObject* array = (PyArrayObject*)obj;
+    uintptr_t begin = (uintptr_t)PyArray_DATA(array);
+    uintptr_t end = begin + (uintptr_t)PyArray_NBYTES(array);
+    begin = (begin + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    end &= ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    size_t advised = 0;
+#ifdef MADV_HUGEPAGE
+    if (end > begin && madvise((void*)begin, end - begin, MADV_HUGEPAGE) == 0) {
+        advised = end - begin;
+    }
+#endif
+    return PyLong_FromSize_t(advised);
+}
+
 // Method table
 static PyMethodDef methods[] = {
     {"env_init", (PyCFunction)env_init, METH_VARARGS | METH_KEYWORDS, "Init environment with observation, action, reward, terminal, truncation arrays"},
@@ -676,14 +1527,20 @@ static PyMethodDef methods[] = {
     {"env_close", env_close, METH_VARARGS, "Close the environment"},
     {"env_get", env_get, METH_VARARGS, "Get the environment state"},
     {"env_put", (PyCFunction)env_put, METH_VARARGS | METH_KEYWORDS, "Put stuff into env"},
-    {"vectorize", vectorize, METH_VARARGS, "Make a vector of environment handles"},
+    {"vectorize", (PyCFunction)vectorize, METH_VARARGS | METH_KEYWORDS, "Make a vector of environment handles"},
     {"vec_init", (PyCFunction)vec_init, METH_VARARGS | METH_KEYWORDS, "Initialize a vector of environments"},
     {"vec_reset", vec_reset, METH_VARARGS, "Reset the vector of environments"},
     {"vec_step", vec_step, METH_VARARGS, "Step the vector of environments"},
+    {"vec_step_async", vec_step_async, METH_VARARGS, "Start stepping the vector into a buffer slot on a background thread"},
+    {"vec_wait", vec_wait, METH_VARARGS, "Wait for the step started by vec_step_async"},
+    {"vec_buffers", vec_buffers, METH_VARARGS, "Register the observation/action/reward/terminal/mask buffers of a slot"},
+    {"vec_slot", vec_slot, METH_VARARGS, "Point the vector at the buffers of a slot"},
     {"vec_log", vec_log, METH_VARARGS, "Log the vector of environments"},
     {"vec_render", vec_render, METH_VARARGS, "Render the vector of environments"},
     {"vec_close", vec_close, METH_VARARGS, "Close the vector of environments"},
     {"shared", (PyCFunction)my_shared, METH_VARARGS | METH_KEYWORDS, "Shared state"},
+    {"alloc_buffer", (PyCFunction)alloc_buffer, METH_VARARGS | METH_KEYWORDS, "Allocate an untouched buffer, optionally on huge pages"},
+    {"advise_buffer", advise_buffer, METH_VARARGS, "Ask for transparent huge pages under an existing buffer"},
     MY_METHODS,
     {NULL, NULL, 0, NULL}
 };
@@ -714,6 +1571,16 @@ typedef struct
     int use_goal_generation;
     int control_non_vehicles;
     int scenario_length;
+    int event_buffer_size;
+    int dynamics_model;
+    int action_repeat;
+    int async_episodes;
+    int reset_cache;
+    int obs_header;
+    int obs_dtype;
+    int obs_layout;
+    int max_partners;
+    int max_roads;
 } env_init_config;
 
 static int handler(
@@ -730,6 +1597,58 @@ static int handler(
         } else {
             env_config->action_type = 1;
         }
+    } else if (MATCH("env", "dynamics_model")) {
+        // Numbering matches the dynamics model defines in drive.h
+        if (strcmp(value, "\"classic\"") == 0) {
+            env_config->dynamics_model = 0;
+        } else if (strcmp(value, "\"invertible_bicycle\"") == 0) {
+            env_config->dynamics_model = 1;
+        } else if (strcmp(value, "\"delta_local\"") == 0) {
+            env_config->dynamics_model = 2;
+        } else if (strcmp(value, "\"state\"") == 0) {
+            env_config->dynamics_model = 3;
+        } else {
+            return 0;
+        }
+    } else if (MATCH("env", "async_episodes")) {
+        if (strcmp(value, "True") == 0) {
+            env_config->async_episodes = 1;
+        } else if (strcmp(value, "False") == 0) {
+            env_config->async_episodes = 0;
+        }
+    } else if (MATCH("env", "reset_cache")) {
+        if (strcmp(value, "True") == 0) {
+            env_config->reset_cache = 1;
+        } else if (strcmp(value, "False") == 0) {
+            env_config->reset_cache = 0;
+        }
+    } else if (MATCH("env", "obs_dtype")) {
+        // Numbering matches the OBS_* defines in drive.h
+        if (strcmp(value, "\"float32\"") == 0) {
+            env_config->obs_dtype = 0;
+        } else if (strcmp(value, "\"float16\"") == 0) {
+            env_config->obs_dtype = 1;
+        } else if (strcmp(value, "\"bfloat16\"") == 0) {
+            env_config->obs_dtype = 2;
+        } else if (strcmp(value, "\"int8\"") == 0) {
+            env_config->obs_dtype = 3;
+        } else {
+            return 0;
+        }
+    } else if (MATCH("env", "obs_layout")) {
+        if (strcmp(value, "\"flat\"") == 0) {
+            env_config->obs_layout = 0;
+        } else if (strcmp(value, "\"structured\"") == 0) {
+            env_config->obs_layout = 1;
+        } else {
+            return 0;
+        }
+    } else if (MATCH("env", "obs_header")) {
+        if (strcmp(value, "True") == 0) {
+            env_config->obs_header = 1;
+        } else if (strcmp(value, "False") == 0) {
+            env_config->obs_header = 0;
+        }
     } else if (MATCH("env", "use_goal_generation")) {
         if (strcmp(value, "True") == 0) {
             env_config->use_goal_generation = 1;
@@ -752,6 +1671,14 @@ static int handler(
         env_config->scenario_length = atoi(value);
     } else if (MATCH("env", "control_non_vehicles")) {
         env_config->control_non_vehicles = atoi(value);
+    } else if (MATCH("env", "event_buffer_size")) {
+        env_config->event_buffer_size = atoi(value);
+    } else if (MATCH("env", "max_partners")) {
+        env_config->max_partners = atoi(value);
+    } else if (MATCH("env", "max_roads")) {
+        env_config->max_roads = atoi(value);
+    } else if (MATCH("env", "action_repeat")) {
+        env_config->action_repeat = atoi(value);
     } else {
         return 0;
     }
@@ -41,6 +41,14 @@ class Drive(nn.Module):
             nn.GELU(),
             pufferlib.pytorch.layer_init(nn.Linear(3 * input_size, hidden_size)),
         )
+        self.obs_header_size = getattr(env, "obs_header_size", 0)
+        self.obs_dtype = getattr(env, "obs_dtype", "float32")
+        # Structured observations carry the road type one-hot already
+        self.road_features = getattr(env, "road_features", 7)
+        self.max_partners = getattr(env, "max_partners", 63)
+        self.max_roads = getattr(env, "max_roads", 200)
+        if self.obs_dtype == "int8":
+            self.register_buffer("obs_scales", torch.as_tensor(env.obs_scales))
         self.is_continuous = isinstance(env.single_action_space, pufferlib.spaces.Box)
 
         if self.is_continuous:
@@ -60,19 +68,26 @@ class Drive(nn.Module):
         return self.forward(x, state)
 
     def encode_observations(self, observations, state=None):
+        if self.obs_dtype == "bfloat16":
+            observations = observations.view(torch.bfloat16)
+        observations = observations.float()
+        if self.obs_dtype == "int8":
+            observations = observations * self.obs_scales
+        observations = observations[:, self.obs_header_size :]
         ego_dim = 7
-        partner_dim = 63 * 7
-        road_dim = 200 * 7
+        partner_dim = self.max_partners * 7
+        road_dim = self.max_roads * self.road_features
         ego_obs = observations[:, :ego_dim]
         partner_obs = observations[:, ego_dim : ego_dim + partner_dim]
         road_obs = observations[:, ego_dim + partner_dim : ego_dim + partner_dim + road_dim]
 
-        partner_objects = partner_obs.view(-1, 63, 7)
-        road_objects = road_obs.view(-1, 200, 7)
-        road_continuous = road_objects[:, :, :6]  # First 6 features
-        road_categorical = road_objects[:, :, 6]
-        road_onehot = F.one_hot(road_categorical.long(), num_classes=7)  # Shape: [batch, 200, 7]
-        road_objects = torch.cat([road_continuous, road_onehot], dim=2)
+        partner_objects = partner_obs.view(-1, self.max_partners, 7)
+        road_objects = road_obs.view(-1, self.max_roads, self.road_features)
+        if self.road_features == 7:
+            road_continuous = road_objects[:, :, :6]  # First 6 features
+            road_categorical = road_objects[:, :, 6]
+            road_onehot = F.one_hot(road_categorical.long(), num_classes=7)  # Shape: [batch, max_roads, 7]
+            road_objects = torch.cat([road_continuous, road_onehot], dim=2)
         ego_features = self.ego_encoder(ego_obs)
         partner_features, _ = self.partner_encoder(partner_objects).max(dim=1)
         road_features, _ = self.road_encoder(road_objects).max(dim=1)
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "pufferlib/ocean/drive/dynamics.h"
+
+#define NUM_AGENTS 13  // not a multiple of the SIMD width, exercises the scalar tail
+
+// Reference: the per-agent CLASSIC update from drive.h
+void reference_step(float* x, float* y, float* heading, float* vx, float* vy,
+        float acceleration, float steering, float length) {
+    const float dt = 0.1f;
+    float speed = sqrtf(*vx * *vx + *vy * *vy);
+    speed = speed + 0.5f*acceleration*dt;
+    speed = fminf(fmaxf(speed, -100.0f), 100.0f);
+    float beta = tanh(.5*tanf(steering));
+    float yaw_rate = (speed*cosf(beta)*tanf(steering)) / length;
+    float new_vx = speed*cosf(*heading + beta);
+    float new_vy = speed*sinf(*heading + beta);
+    *x = *x + new_vx*dt;
+    *y = *y + new_vy*dt;
+    *heading = *heading + yaw_rate*dt;
+    *vx = new_vx;
+    *vy = new_vy;
+}
+
+int test_sincos(void) {
+    float max_err = 0.0f;
+    for (int i = -200000; i <= 200000; i++) {
+        float v = i * 1e-3f;
+        float s, c;
+        sincos_approx(v, &s, &c);
+        max_err = fmaxf(max_err, fabsf(s - sinf(v)));
+        max_err = fmaxf(max_err, fabsf(c - cosf(v)));
+    }
+    printf("sincos_approx max abs error on [-200, 200]: %g\n", max_err);
+    return max_err < 1e-5f;
+}
+
+int test_batch_matches_reference(void) {
+    float x[NUM_AGENTS], y[NUM_AGENTS], heading[NUM_AGENTS], hx[NUM_AGENTS], hy[NUM_AGENTS];
+    float vx[NUM_AGENTS], vy[NUM_AGENTS];
+    float rx[NUM_AGENTS], ry[NUM_AGENTS], rheading[NUM_AGENTS], rvx[NUM_AGENTS], rvy[NUM_AGENTS];
+    float length[NUM_AGENTS];
+    BicycleBatch batch;
+    alloc_bicycle_batch(&batch, NUM_AGENTS);
+    srand(0);
+    for (int i = 0; i < NUM_AGENTS; i++) {
+        x[i] = rx[i] = 100.0f * rand() / RAND_MAX;
+        y[i] = ry[i] = 100.0f * rand() / RAND_MAX;
+        heading[i] = rheading[i] = 6.0f * rand() / RAND_MAX - 3.0f;
+        hx[i] = cosf(heading[i]);
+        hy[i] = sinf(heading[i]);
+        vx[i] = rvx[i] = 10.0f * hx[i];
+        vy[i] = rvy[i] = 10.0f * hy[i];
+        length[i] = 3.0f + 2.0f * rand() / RAND_MAX;
+        batch.inv_length[i] = 1.0f / length[i];
+    }
+    float max_err = 0.0f;
+    for (int t = 0; t < 90; t++) {
+        for (int i = 0; i < NUM_AGENTS; i++) {
+            float acceleration = 8.0f * rand() / RAND_MAX - 4.0f;
+            float steering = 2.0f * rand() / RAND_MAX - 1.0f;
+            batch.accel[i] = acceleration;
+            bicycle_steering_factors(steering, &batch.yaw_factor[i], &batch.cos_beta[i], &batch.sin_beta[i]);
+            reference_step(&rx[i], &ry[i], &rheading[i], &rvx[i], &rvy[i], acceleration, steering, length[i]);
+        }
+        bicycle_step_batch(&batch, NUM_AGENTS, x, y, heading, hx, hy, vx, vy, 0.1f, 100.0f);
+        for (int i = 0; i < NUM_AGENTS; i++) {
+            max_err = fmaxf(max_err, fabsf(x[i] - rx[i]));
+            max_err = fmaxf(max_err, fabsf(y[i] - ry[i]));
+            max_err = fmaxf(max_err, fabsf(heading[i] - rheading[i]));
+            max_err = fmaxf(max_err, fabsf(hx[i] - cosf(rheading[i])));
+        }
+    }
+    free_bicycle_batch(&batch);
+    printf("bicycle_step_batch max abs deviation over 90 steps: %g\n", max_err);
+    return max_err < 1e-3f;
+}
+
+// INVERTIBLE_BICYLE must be recoverable from consecutive states in closed form
+int test_invertible_bicycle_roundtrip(void) {
+    float x[NUM_AGENTS], y[NUM_AGENTS], heading[NUM_AGENTS], hx[NUM_AGENTS], hy[NUM_AGENTS];
+    float vx[NUM_AGENTS], vy[NUM_AGENTS];
+    float accel[NUM_AGENTS], steering[NUM_AGENTS], length[NUM_AGENTS];
+    float speed0[NUM_AGENTS], heading0[NUM_AGENTS];
+    BicycleBatch batch;
+    alloc_bicycle_batch(&batch, NUM_AGENTS);
+    srand(1);
+    for (int i = 0; i < NUM_AGENTS; i++) {
+        x[i] = y[i] = 0.0f;
+        heading[i] = heading0[i] = 6.0f * rand() / RAND_MAX - 3.0f;
+        hx[i] = cosf(heading[i]);
+        hy[i] = sinf(heading[i]);
+        speed0[i] = 2.0f + 10.0f * rand() / RAND_MAX;
+        vx[i] = speed0[i] * hx[i];
+        vy[i] = speed0[i] * hy[i];
+        length[i] = 3.0f + 2.0f * rand() / RAND_MAX;
+        accel[i] = 8.0f * rand() / RAND_MAX - 4.0f;
+        steering[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+        batch.accel[i] = accel[i];
+        batch.yaw_factor[i] = tanf(steering[i]);
+        batch.inv_length[i] = 1.0f / length[i];
+    }
+    invertible_bicycle_step_batch(&batch, NUM_AGENTS, x, y, heading, hx, hy, vx, vy, 0.1f, 100.0f);
+    float max_err = 0.0f;
+    for (int i = 0; i < NUM_AGENTS; i++) {
+        float speed1 = vx[i]*hx[i] + vy[i]*hy[i];
+        float avg_speed = 0.5f*(speed0[i] + speed1);
+        float accel_inv = (speed1 - speed0[i]) / 0.1f;
+        float steering_inv = atanf((heading[i] - heading0[i]) * length[i] / (avg_speed * 0.1f));
+        max_err = fmaxf(max_err, fabsf(accel_inv - accel[i]));
+        max_err = fmaxf(max_err, fabsf(steering_inv - steering[i]));
+    }
+    free_bicycle_batch(&batch);
+    printf("invertible bicycle round-trip max abs error: %g\n", max_err);
+    return max_err < 1e-3f;
+}
+
+int main(void) {
+    printf("\n=== Testing batched bicycle dynamics ===\n");
+    int passed = 0;
+    int num_tests = 3;
+    if (test_sincos()) passed++; else printf("FAIL: sincos_approx\n");
+    if (test_batch_matches_reference()) passed++; else printf("FAIL: bicycle_step_batch\n");
+    if (test_invertible_bicycle_roundtrip()) passed++; else printf("FAIL: invertible_bicycle_step_batch\n");
+    printf("Passed: %d/%d\n", passed, num_tests);
+    return passed == num_tests ? 0 : 1;
+}
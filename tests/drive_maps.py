@@ -0,0 +1,44 @@
+"""Synthetic Drive map binaries for the tests."""
+
+import os
+import struct
+
+import numpy as np
+import pytest
+
+REPO_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUNDLED_MAP = os.path.join(REPO_ROOT, "resources/drive/binaries/map_000.bin")
+VEHICLE, ROAD_EDGE = 1, 6
+STEPS = 91
+
+
+def skip_without_map_binaries():
+    if not os.path.exists(BUNDLED_MAP):
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+
+def map_root(root, monkeypatch):
+    # Makes root the working directory of Drive, with pufferlib linked in, and
+    # returns its empty resources/drive/binaries for the caller's maps
+    binaries = root / "resources" / "drive" / "binaries"
+    binaries.mkdir(parents=True)
+    os.symlink(os.path.join(REPO_ROOT, "pufferlib"), root / "pufferlib")
+    monkeypatch.chdir(root)
+    return binaries
+
+
+def write_vehicle(f, x, y, goal_x, length=4.5):
+    xs = x + 0.5 * np.arange(STEPS, dtype=np.float32)
+    f.write(struct.pack("ii", VEHICLE, STEPS))
+    for arr in (xs, np.full(STEPS, y), np.zeros(STEPS), np.full(STEPS, 5.0), np.zeros(STEPS), np.zeros(STEPS), np.zeros(STEPS)):
+        f.write(np.asarray(arr, dtype=np.float32).tobytes())
+    f.write(np.ones(STEPS, dtype=np.int32).tobytes())
+    f.write(struct.pack("ffffffi", 2.0, length, 1.5, goal_x, y, 0.0, 0))
+
+
+def write_edge(f, y):
+    xs = np.arange(-20.0, 200.0, 5.0, dtype=np.float32)
+    f.write(struct.pack("ii", ROAD_EDGE, len(xs)))
+    for arr in (xs, np.full(len(xs), y), np.zeros(len(xs))):
+        f.write(np.asarray(arr, dtype=np.float32).tobytes())
+    f.write(struct.pack("ffffffi", 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0))
@@ -0,0 +1,84 @@
+import struct
+
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+from tests.drive_maps import STEPS, map_root, skip_without_map_binaries, write_edge, write_vehicle
+
+
+def test_drive_async_episodes_mask_finished_agents():
+    """Agents that terminate are masked out with zeroed outputs until the scenario resets."""
+    try:
+        env = Drive(num_agents=64, num_maps=1, scenario_length=91, resample_frequency=0, async_episodes=True)
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+    env.reset(seed=0)
+    assert env.masks.all()
+    rng = np.random.default_rng(0)
+    finished = np.zeros(env.num_agents, dtype=bool)
+    saw_reset = False
+    for _ in range(120):
+        actions = np.stack([rng.integers(0, 7, env.num_agents), rng.integers(0, 13, env.num_agents)], axis=-1)
+        obs, rewards, terminals, _, _ = env.step(actions)
+        for cur, nxt in zip(env.agent_offsets[:-1], env.agent_offsets[1:]):
+            if env.masks[cur:nxt].all() and finished[cur:nxt].any():
+                # Scenario reset once all of this env's agents finished: slots are refilled
+                assert not terminals[cur:nxt].any()
+                saw_reset = True
+                finished[cur:nxt] = False
+        # Agents finished on an earlier step produce nothing
+        assert not env.masks[finished].any()
+        assert not obs[finished].any()
+        assert not rewards[finished].any()
+        assert not terminals[finished].any()
+        # Agents finishing now still report their last observation
+        assert env.masks[terminals].all()
+        finished |= terminals.astype(bool)
+
+    assert finished.any() or saw_reset
+    env.close()
+
+
+def write_lane(path, goal_x0):
+    # Four vehicles of different lengths on parallel lanes 20 m apart; vehicle 0
+    # has its goal at goal_x0
+    with open(path, "wb") as f:
+        f.write(struct.pack("ii", 4, 2))
+        for k, length in enumerate((3.0, 4.5, 6.0, 8.0)):
+            write_vehicle(f, 0.0, 20.0 * k, goal_x0 if k == 0 else 150.0, length=length)
+        write_edge(f, -10.0)
+        write_edge(f, 71.3)
+
+
+def lane_rollout(tmp_path, monkeypatch, goal_x0, dynamics_model):
+    binaries = map_root(tmp_path / str(goal_x0), monkeypatch)
+    write_lane(binaries / "map_000.bin", goal_x0)
+    env = Drive(
+        num_agents=4, num_maps=1, scenario_length=STEPS, resample_frequency=0, async_episodes=True, dynamics_model=dynamics_model,
+        deterministic_agent_selection=True,
+    )
+    env.reset(seed=0)
+    actions = np.tile([4, 9], (env.num_agents, 1))  # accelerate while steering left
+    ego, finished = [], []
+    for _ in range(10):
+        obs, _, _, _, _ = env.step(actions)
+        ego.append(obs[:, :7].copy())
+        finished.append(~env.masks.copy())
+    env.close()
+    return np.stack(ego), np.stack(finished)
+
+
+@pytest.mark.parametrize("dynamics_model", ["classic", "invertible_bicycle"])
+def test_drive_async_episodes_finished_agent_leaves_others_unchanged(tmp_path, monkeypatch, dynamics_model):
+    """Agents after a finished slot are integrated with their own vehicle length."""
+    skip_without_map_binaries()
+    early, early_done = lane_rollout(tmp_path, monkeypatch, 3.0, dynamics_model)
+    live, live_done = lane_rollout(tmp_path, monkeypatch, 150.0, dynamics_model)
+    # Only vehicle 0 finishes, and some agent sits in a later slot than it
+    finished = np.flatnonzero(early_done[-1])
+    assert len(finished) == 1 and finished[0] < early.shape[1] - 1
+    assert not live_done.any()
+    others = np.arange(early.shape[1]) != finished[0]
+    np.testing.assert_array_equal(early[:, others], live[:, others])
@@ -0,0 +1,48 @@
+import struct
+
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+from tests.drive_maps import STEPS, map_root, skip_without_map_binaries, write_edge, write_vehicle
+
+
+def dense_positions():
+    # 10 x 10 grid of vehicles, 12 m apart along x and 8 m apart along y
+    return [(12.0 * c, 8.0 * r) for r in range(10) for c in range(10)]
+
+
+@pytest.fixture
+def dense_map(tmp_path, monkeypatch):
+    """A scene with 100 vehicles, more than the old 64-agent cap."""
+    skip_without_map_binaries()
+    binaries = map_root(tmp_path, monkeypatch)
+    with open(binaries / "map_000.bin", "wb") as f:
+        positions = dense_positions()
+        f.write(struct.pack("ii", len(positions), 2))
+        for x, y in positions:
+            write_vehicle(f, x, y, x + 40.0)
+        write_edge(f, -10.0)
+        write_edge(f, 82.0)
+    return positions
+
+
+def test_drive_controls_every_vehicle_of_a_dense_scene(dense_map):
+    env = Drive(num_agents=100, num_maps=1, scenario_length=STEPS, resample_frequency=0, obs_header=True)
+    assert list(env.agent_offsets) == [0, 100]
+    env.reset(seed=0)
+
+    # Partner counts match a brute-force count of vehicles within 50 m, capped at 63
+    xy = np.array(dense_map)
+    dist = np.hypot(xy[:, None, 0] - xy[None, :, 0], xy[:, None, 1] - xy[None, :, 1])
+    expected = np.minimum((dist <= 50.0).sum(axis=1) - 1, 63)
+    assert expected.max() == 63
+    np.testing.assert_array_equal(np.sort(env.observations[:, 0]), np.sort(expected))
+
+    actions = np.tile([3, 6], (env.num_agents, 1))  # zero acceleration and steering
+    obs, _, _, _, _ = env.step(actions)
+    partners = obs[:, 2 + 7 : 2 + 7 + 63 * 7].reshape(-1, 63, 7)
+    for row, count in zip(partners, obs[:, 0].astype(int)):
+        d = np.hypot(row[:count, 0], row[:count, 1])
+        assert np.all(np.diff(d) >= -1e-5)
+    env.close()
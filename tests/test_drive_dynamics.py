@@ -0,0 +1,56 @@
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+
+
+def make_env(**kwargs):
+    try:
+        return Drive(num_agents=32, num_maps=1, scenario_length=91, resample_frequency=0, **kwargs)
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+
+@pytest.mark.parametrize(
+    "dynamics_model,action_type",
+    [
+        ("classic", "discrete"),
+        ("classic", "continuous"),
+        ("invertible_bicycle", "discrete"),
+        ("invertible_bicycle", "continuous"),
+        ("delta_local", "continuous"),
+        ("state", "continuous"),
+    ],
+)
+def test_drive_expert_actions_step(dynamics_model, action_type):
+    env = make_env(dynamics_model=dynamics_model, action_type=action_type)
+    env.reset(seed=0)
+    for _ in range(10):
+        actions, valid = env.expert_actions()
+        assert actions.shape == env.actions.shape
+        assert valid.shape == (env.num_agents,)
+        assert valid.any()
+        obs, _, _, _, _ = env.step(actions)
+        assert np.isfinite(obs).all()
+    env.close()
+
+
+def test_drive_delta_local_and_state_replay_logs():
+    """Replaying the inverse actions of the exact models must reproduce the same trajectories."""
+    delta = make_env(dynamics_model="delta_local", action_type="continuous")
+    state = make_env(dynamics_model="state", action_type="continuous")
+    delta.reset(seed=0)
+    state.reset(seed=0)
+    for _ in range(20):
+        obs_delta, rew_delta, _, _, _ = delta.step(delta.expert_actions()[0])
+        obs_state, rew_state, _, _, _ = state.step(state.expert_actions()[0])
+        if (rew_delta > 0).any() or (rew_state > 0).any():
+            break  # goal respawns move agents off their logs
+        np.testing.assert_allclose(obs_delta, obs_state, atol=1e-3)
+    delta.close()
+    state.close()
+
+
+def test_drive_exact_models_require_continuous_actions():
+    with pytest.raises(ValueError):
+        make_env(dynamics_model="delta_local", action_type="discrete")
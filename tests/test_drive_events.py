@@ -0,0 +1,40 @@
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+
+
+def test_drive_records_collision_and_offroad_events():
+    """Events in the ring buffer should mirror the per-step collision/offroad penalties."""
+
+    try:
+        env = Drive(
+            num_agents=32,
+            num_maps=1,
+            scenario_length=91,
+            resample_frequency=0,
+            event_buffer_size=4096,
+        )
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+    env.reset(seed=0)
+    rng = np.random.default_rng(0)
+    penalized = 0
+    for _ in range(30):
+        actions = np.stack([rng.integers(0, 7, env.num_agents), rng.integers(0, 13, env.num_agents)], axis=-1)
+        _, rewards, _, _, _ = env.step(actions)
+        penalized += int((rewards < 0).sum())
+
+    total = 0
+    for env_idx in range(env.num_envs):
+        events, count = env.events(env_idx)
+        assert count <= len(events)
+        recorded = events[:count]
+        assert np.all(np.isin(recorded["type"], [1, 2]))
+        assert np.all(recorded["timestep"] >= 1)
+        assert np.all(recorded["agent"] < env.agent_offsets[env_idx + 1] - env.agent_offsets[env_idx])
+        total += count
+
+    env.close()
+    assert total == penalized
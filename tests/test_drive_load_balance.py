@@ -0,0 +1,71 @@
+import struct
+from collections import Counter
+
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive import binding
+from pufferlib.ocean.drive.drive import Drive
+from tests.drive_maps import map_root, skip_without_map_binaries, write_edge, write_vehicle
+
+LIGHT, HEAVY = 0, 1
+
+
+@pytest.fixture
+def uneven_maps(tmp_path, monkeypatch):
+    """A 1-vehicle map and an 8-vehicle one, far apart in predicted step cost."""
+    skip_without_map_binaries()
+    binaries = map_root(tmp_path, monkeypatch)
+    for map_id, vehicles in ((LIGHT, 1), (HEAVY, 8)):
+        with open(binaries / f"map_{map_id:03d}.bin", "wb") as f:
+            f.write(struct.pack("ii", vehicles, 2))
+            for k in range(vehicles):
+                write_vehicle(f, 15.0 * k, 0.0, 15.0 * k + 30.0)
+            write_edge(f, -6.0)
+            write_edge(f, 6.0)
+
+
+def sample(seed, scenarios_per_env):
+    offsets, map_ids, num_envs = binding.shared(
+        num_agents=60,
+        num_maps=2,
+        num_policy_controlled_agents=-1,
+        control_all_agents=0,
+        deterministic_agent_selection=0,
+        scenarios_per_env=scenarios_per_env,
+        seed=seed,
+    )
+    counts = [offsets[i + 1] - offsets[i] for i in range(num_envs)]
+    return map_ids, counts
+
+
+def test_drive_shared_balances_packs_by_predicted_cost(uneven_maps):
+    k = 3
+    for seed in range(8):
+        sampled_ids, sampled_counts = sample(seed, 1)
+        map_ids, counts = sample(seed, k)
+        # Same scenarios and agent budgets, only reordered
+        assert Counter(zip(map_ids, counts)) == Counter(zip(sampled_ids, sampled_counts))
+        # Heavy maps are spread over the full packs
+        full = len(map_ids) // k
+        heavy = [map_ids[p * k : (p + 1) * k].count(HEAVY) for p in range(full)]
+        assert max(heavy) - min(heavy) <= 1
+
+
+def test_drive_logs_predicted_and_measured_imbalance(uneven_maps):
+    env = Drive(num_agents=60, num_maps=2, scenario_length=5, resample_frequency=0, seed=0, num_threads=2)
+    env.reset(seed=0)
+    actions = np.zeros_like(env.actions)
+    logs = []
+    for _ in range(6):
+        logs.extend(env.step(actions)[-1])
+    env.close()
+    assert logs
+    log = logs[-1]
+    for key in ("env_imbalance", "thread_imbalance"):
+        assert log[f"{key}_predicted"] >= 1.0
+        assert log[f"{key}_measured"] >= 1.0
+    # Envs hold 1 or 8 agents, so their predicted costs are far apart
+    assert log["env_imbalance_predicted"] > 1.5
+    # The worker's total, comparable across processes
+    assert log["predicted_step_cost"] > 0.0
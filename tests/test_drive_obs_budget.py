@@ -0,0 +1,74 @@
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+
+
+def make_env(max_partners=63, max_roads=200):
+    try:
+        return Drive(
+            num_agents=64,
+            num_maps=1,
+            scenario_length=91,
+            resample_frequency=0,
+            max_partners=max_partners,
+            max_roads=max_roads,
+        )
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+
+def partner_block(env, obs):
+    return obs[:, 7 : 7 + env.max_partners * 7].reshape(-1, env.max_partners, 7)
+
+
+def test_drive_partners_sorted_by_distance():
+    """Partner slots are filled nearest first, and a smaller K keeps the K nearest."""
+    full = make_env(63)
+    small = make_env(16)
+    assert small.num_obs == full.num_obs - (63 - 16) * 7
+    full.reset(seed=0)
+    small.reset(seed=0)
+    rng = np.random.default_rng(0)
+    for _ in range(20):
+        actions = np.stack([rng.integers(0, 7, full.num_agents), rng.integers(0, 13, full.num_agents)], axis=-1)
+        full.step(actions)
+        small.step(actions)
+        partners = partner_block(full, full.observations)
+        # rel_x and rel_y are scaled by the same constant, so their norm orders by distance
+        dist = np.hypot(partners[..., 0], partners[..., 1])
+        seen = partners.any(axis=-1)
+        for row_dist, row_seen in zip(dist, seen):
+            count = row_seen.sum()
+            assert row_seen[:count].all()
+            assert np.all(np.diff(row_dist[:count]) >= -1e-5)
+        np.testing.assert_array_equal(partner_block(small, small.observations), partners[:, :16])
+        np.testing.assert_array_equal(small.observations[:, 7 + 16 * 7 :], full.observations[:, 7 + 63 * 7 :])
+    full.close()
+    small.close()
+
+
+def test_drive_light_budget_is_a_prefix():
+    """16 partners and 64 roads give the leading slots of the default 63/200 rows."""
+    full = make_env()
+    light = make_env(16, 64)
+    assert light.num_obs == 7 + 16 * 7 + 64 * 7
+    full.reset(seed=0)
+    light.reset(seed=0)
+    rng = np.random.default_rng(1)
+    for _ in range(20):
+        actions = np.stack([rng.integers(0, 7, full.num_agents), rng.integers(0, 13, full.num_agents)], axis=-1)
+        full.step(actions)
+        light.step(actions)
+        expected = np.concatenate(
+            [full.observations[:, : 7 + 16 * 7], full.observations[:, 7 + 63 * 7 : 7 + 63 * 7 + 64 * 7]], axis=1
+        )
+        np.testing.assert_array_equal(light.observations, expected)
+    full.close()
+    light.close()
+
+
+@pytest.mark.parametrize("kwargs", [{"max_partners": 64}, {"max_partners": -1}, {"max_roads": 201}, {"max_roads": 0}])
+def test_drive_obs_budget_out_of_range(kwargs):
+    with pytest.raises(ValueError):
+        Drive(num_agents=8, num_maps=1, **kwargs)
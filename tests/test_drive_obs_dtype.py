@@ -0,0 +1,43 @@
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+
+
+def make_env(obs_dtype):
+    try:
+        return Drive(num_agents=64, num_maps=1, scenario_length=91, resample_frequency=0, obs_dtype=obs_dtype)
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+
+def to_bfloat16_bits(x):
+    bits = x.astype(np.float32).view(np.uint32).astype(np.uint64)
+    bits += 0x7FFF + ((bits >> 16) & 1)
+    return (bits >> 16).astype(np.uint16)
+
+
+@pytest.mark.parametrize("obs_dtype", ["float16", "bfloat16", "int8"])
+def test_drive_reduced_precision_obs_match_float32(obs_dtype):
+    reference = make_env("float32")
+    env = make_env(obs_dtype)
+    assert env.observations.dtype == env.single_observation_space.dtype
+    reference.reset(seed=0)
+    env.reset(seed=0)
+    rng = np.random.default_rng(0)
+    for _ in range(100):
+        actions = np.stack([rng.integers(0, 7, env.num_agents), rng.integers(0, 13, env.num_agents)], axis=-1)
+        reference.step(actions)
+        obs, _, _, _, _ = env.step(actions)
+        expected = reference.observations
+        if obs_dtype == "float16":
+            np.testing.assert_array_equal(obs, expected.astype(np.float16))
+        elif obs_dtype == "bfloat16":
+            np.testing.assert_array_equal(obs, to_bfloat16_bits(expected))
+        else:
+            quantized = np.clip(np.rint(expected / env.obs_scales), -127, 127)
+            # Scales are stored as floats, so allow off-by-one at exact rounding ties
+            assert np.abs(obs.astype(np.int32) - quantized).max() <= 1
+            np.testing.assert_allclose(obs * env.obs_scales, expected, atol=env.obs_scales.max() / 2 + 1e-6)
+    reference.close()
+    env.close()
@@ -0,0 +1,35 @@
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+
+
+def make_env(obs_header):
+    try:
+        return Drive(num_agents=64, num_maps=1, scenario_length=91, resample_frequency=0, obs_header=obs_header)
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+
+def test_drive_obs_header_counts_populated_slots():
+    plain = make_env(False)
+    headed = make_env(True)
+    assert headed.num_obs == plain.num_obs + 2
+    plain.reset(seed=0)
+    headed.reset(seed=0)
+    rng = np.random.default_rng(0)
+    for _ in range(100):
+        actions = np.stack([rng.integers(0, 7, plain.num_agents), rng.integers(0, 13, plain.num_agents)], axis=-1)
+        plain.step(actions)
+        obs, _, _, _, _ = headed.step(actions)
+        # Incremental clearing leaves exactly the same rows as a full rewrite
+        np.testing.assert_array_equal(obs[:, 2:], plain.observations)
+        partners = obs[:, 2 + 7 : 2 + 7 + 63 * 7].reshape(-1, 63, 7)
+        roads = obs[:, 2 + 7 + 63 * 7 :].reshape(-1, 200, 7)
+        np.testing.assert_array_equal(obs[:, 0], partners.any(axis=2).sum(axis=1))
+        np.testing.assert_array_equal(obs[:, 1], roads.any(axis=2).sum(axis=1))
+        # Populated slots are packed at the front of each block
+        assert not partners[np.arange(63)[None, :] >= obs[:, :1]].any()
+        assert not roads[np.arange(200)[None, :] >= obs[:, 1:2]].any()
+    plain.close()
+    headed.close()
@@ -0,0 +1,36 @@
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+
+
+def make_env(obs_layout, **kwargs):
+    try:
+        return Drive(num_agents=64, num_maps=1, scenario_length=91, resample_frequency=0, obs_layout=obs_layout, **kwargs)
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+
+@pytest.mark.parametrize("obs_header", [False, True])
+def test_drive_structured_obs_expands_road_types(obs_header):
+    flat = make_env("flat", obs_header=obs_header)
+    structured = make_env("structured", obs_header=obs_header)
+    header = 2 if obs_header else 0
+    assert structured.num_obs == flat.num_obs + 200 * 6
+    flat.reset(seed=0)
+    structured.reset(seed=0)
+    rng = np.random.default_rng(0)
+    for _ in range(50):
+        actions = np.stack([rng.integers(0, 7, flat.num_agents), rng.integers(0, 13, flat.num_agents)], axis=-1)
+        flat.step(actions)
+        obs, _, _, _, _ = structured.step(actions)
+        split = header + 7 + 63 * 7
+        np.testing.assert_array_equal(obs[:, :split], flat.observations[:, :split])
+
+        roads = flat.observations[:, split:].reshape(-1, 200, 7)
+        # Decoded like torch.py's F.one_hot, so empty slots are hot on type 0
+        onehot = np.eye(7, dtype=np.float32)[roads[:, :, 6].astype(int)]
+        expected = np.concatenate([roads[:, :, :6], onehot], axis=2)
+        np.testing.assert_array_equal(obs[:, split:].reshape(-1, 200, 13), expected)
+    flat.close()
+    structured.close()
@@ -0,0 +1,71 @@
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive import binding
+from pufferlib.ocean.drive.drive import Drive
+
+HUGE_PAGE = 2 << 20
+
+
+def test_alloc_buffer_returns_zeroed_aligned_pages():
+    for mode in (0, 1):
+        buf = binding.alloc_buffer(3 * HUGE_PAGE + 5, huge_pages=mode)
+        assert buf.dtype == np.uint8 and buf.shape == (3 * HUGE_PAGE + 5,)
+        assert not buf.any()
+        buf[:] = 7
+        if mode == 1:
+            assert buf.ctypes.data % HUGE_PAGE == 0
+    # Explicit pages only exist once reserved with vm.nr_hugepages
+    try:
+        buf = binding.alloc_buffer(HUGE_PAGE, huge_pages=2)
+    except OSError:
+        pass
+    else:
+        assert buf.ctypes.data % HUGE_PAGE == 0
+    with pytest.raises(ValueError):
+        binding.alloc_buffer(16, huge_pages=3)
+
+
+def rollout(steps=30, **kwargs):
+    env = Drive(num_agents=128, num_maps=1, scenario_length=20, resample_frequency=0, seed=0, num_threads=2, **kwargs)
+    env.reset(seed=0)
+    rng = np.random.default_rng(0)
+    out = []
+    for t in range(steps):
+        actions = np.stack([rng.integers(0, 7, env.num_agents), rng.integers(0, 13, env.num_agents)], axis=-1)
+        env.step_async(actions, slot=t % 2)
+        obs, rewards, terminals, _, _ = env.step_wait()
+        out.append((obs.copy(), rewards.copy(), terminals.copy(), env.masks.copy()))
+    env.close()
+    return out
+
+
+def test_drive_huge_page_numa_buffers_match_default():
+    """Buffers from alloc_buffer, bound per thread, give the same rollout as NumPy's."""
+    try:
+        default = rollout()
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+    paged = rollout(huge_pages="transparent", numa_bind=True, pin_threads=True)
+    for a, b in zip(default, paged):
+        for x, y in zip(a, b):
+            np.testing.assert_array_equal(x, y)
+    with pytest.raises(ValueError):
+        Drive(num_agents=16, num_maps=1, scenario_length=20, huge_pages="gigantic")
+
+
+def test_drive_advises_buffers_passed_in():
+    """Buffers passed with buf (multiprocessing shm) stay in place but get the THP hint."""
+    buf = binding.alloc_buffer(3 * HUGE_PAGE + 5)
+    assert binding.advise_buffer(buf) >= 2 * HUGE_PAGE
+    assert binding.advise_buffer(np.zeros(16)) == 0
+    try:
+        env = Drive(num_agents=16, num_maps=1, scenario_length=20, resample_frequency=0, seed=0)
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+    shared = {k: getattr(env, k) for k in ("observations", "actions", "rewards", "terminals", "truncations", "masks")}
+    with pytest.warns(UserWarning):
+        passed = Drive(num_agents=16, num_maps=1, scenario_length=20, resample_frequency=0, seed=0, buf=shared, huge_pages="explicit")
+    assert all(getattr(passed, k) is v for k, v in shared.items())
+    passed.close()
+    env.close()
@@ -0,0 +1,92 @@
+import os
+import struct
+
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+from tests.drive_maps import BUNDLED_MAP, map_root, skip_without_map_binaries, write_edge, write_vehicle
+
+
+@pytest.fixture
+def two_maps(tmp_path, monkeypatch):
+    """The bundled map plus a 5-vehicle one, so resampling changes the env count."""
+    skip_without_map_binaries()
+    binaries = map_root(tmp_path, monkeypatch)
+    os.symlink(BUNDLED_MAP, binaries / "map_000.bin")
+    with open(binaries / "map_001.bin", "wb") as f:
+        f.write(struct.pack("ii", 5, 2))
+        for k in range(5):
+            write_vehicle(f, 15.0 * k, 0.0, 15.0 * k + 30.0)
+        write_edge(f, -6.0)
+        write_edge(f, 6.0)
+
+
+def make_env(seed, resample_frequency, **kwargs):
+    return Drive(
+        num_agents=12,
+        num_maps=2,
+        scenario_length=91,
+        resample_frequency=resample_frequency,
+        seed=seed,
+        **kwargs,
+    )
+
+
+@pytest.mark.parametrize(
+    "kwargs", [{}, {"scenarios_per_env": 3, "obs_dtype": "float16"}, {"num_threads": 3}, {"num_threads": 2, "scenarios_per_env": 2}]
+)
+def test_drive_resample_reloads_in_place_like_fresh_envs(two_maps, kwargs):
+    """After an in-place resample, the env steps exactly like one built on the new maps."""
+    env = make_env(0, 5, **kwargs)
+    observations = env.observations
+    env.reset(seed=0)
+    rng = np.random.default_rng(0)
+
+    def random_actions():
+        return np.stack([rng.integers(0, 7, env.num_agents), rng.integers(0, 13, env.num_agents)], axis=-1)
+
+    for _ in range(4):
+        env.step(random_actions())
+    env_counts = set()
+    # Mirrors the env's resample seeds, drawn from its constructor seed
+    seeds = np.random.default_rng(0)
+    for cycle in range(6):
+        seed = int(seeds.integers(0, 2**31 - 1))
+        obs, _, terminals, _, _ = env.step(random_actions())
+        assert terminals.all()
+        fresh = make_env(seed, 0, **kwargs)
+        fresh_obs, _ = fresh.reset(seed=seed)
+        assert env.agent_offsets == fresh.agent_offsets
+        assert len(env.env_ids) == len(fresh.env_ids)
+        env_counts.add(len(env.env_ids))
+        np.testing.assert_array_equal(obs, fresh_obs)
+        for _ in range(4):
+            actions = random_actions()
+            obs, r0, d0, _, _ = env.step(actions)
+            fresh_obs, r1, d1, _, _ = fresh.step(actions)
+            np.testing.assert_array_equal(obs, fresh_obs)
+            np.testing.assert_array_equal(r0, r1)
+            np.testing.assert_array_equal(d0, d1)
+        fresh.close()
+    # Buffers are kept, and the resamples both grew and shrank the env list
+    assert env.observations is observations
+    assert len(env_counts) > 1
+    env.close()
+
+
+def test_drive_resample_seeds_follow_the_constructor_seed(two_maps):
+    """Drives built with different seeds (as vec workers are) resample different maps."""
+    envs = [make_env(seed, 1) for seed in (0, 1, 0)]
+    actions = np.zeros((12, 2), dtype=np.int32)
+    history = [[] for _ in envs]
+    for env in envs:
+        env.reset()
+    for _ in range(4):
+        for env, maps in zip(envs, history):
+            env.step(actions)
+            maps.append(list(env.map_ids))
+    assert history[0] == history[2]
+    assert history[0] != history[1]
+    for env in envs:
+        env.close()
@@ -0,0 +1,61 @@
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive.drive import Drive
+
+
+def make_env(scenarios_per_env, **kwargs):
+    try:
+        return Drive(
+            num_agents=24,
+            num_maps=1,
+            scenario_length=91,
+            resample_frequency=0,
+            scenarios_per_env=scenarios_per_env,
+            **kwargs,
+        )
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+
+def episode_stats(log):
+    return {key: value for key, value in log.items() if "_imbalance_" not in key}
+
+
+@pytest.mark.parametrize("kwargs", [{}, {"obs_dtype": "float16", "event_buffer_size": 64}])
+def test_drive_packed_scenarios_match_unpacked(kwargs):
+    """Packing 4 scenarios per C env changes nothing but the number of handles."""
+    unpacked = make_env(1, **kwargs)
+    packed = make_env(4, **kwargs)
+    assert packed.agent_offsets == unpacked.agent_offsets
+    assert len(packed.env_ids) == -(-unpacked.num_envs // 4)
+    unpacked.reset(seed=0)
+    packed.reset(seed=0)
+    np.testing.assert_array_equal(packed.observations, unpacked.observations)
+    rng = np.random.default_rng(0)
+    for _ in range(120):
+        actions = np.stack([rng.integers(0, 7, unpacked.num_agents), rng.integers(0, 13, unpacked.num_agents)], axis=-1)
+        _, r0, t0, _, i0 = unpacked.step(actions)
+        _, r1, t1, _, i1 = packed.step(actions)
+        # Logs are summed in a different order, so only up to rounding. The
+        # imbalance stats describe the handles, which packing changes.
+        assert len(i1) == len(i0)
+        for log0, log1 in zip(i0, i1):
+            assert episode_stats(log1) == pytest.approx(episode_stats(log0), rel=1e-5)
+        np.testing.assert_array_equal(packed.observations, unpacked.observations)
+        np.testing.assert_array_equal(r1, r0)
+        np.testing.assert_array_equal(t1, t0)
+    np.testing.assert_array_equal(packed.expert_actions()[0], unpacked.expert_actions()[0])
+    if kwargs.get("event_buffer_size"):
+        for env_idx in range(unpacked.num_envs):
+            ev0, n0 = unpacked.events(env_idx)
+            ev1, n1 = packed.events(env_idx)
+            assert n0 == n1
+            np.testing.assert_array_equal(ev0, ev1)
+    unpacked.close()
+    packed.close()
+
+
+def test_drive_scenarios_per_env_rejects_zero():
+    with pytest.raises(ValueError):
+        Drive(num_agents=8, num_maps=1, scenarios_per_env=0)
@@ -0,0 +1,94 @@
+import struct
+
+import numpy as np
+import pytest
+
+from pufferlib.ocean.drive import binding
+from pufferlib.ocean.drive.drive import Drive
+from tests.drive_maps import map_root, skip_without_map_binaries, write_edge, write_vehicle
+
+
+def make_env(**kwargs):
+    try:
+        return Drive(num_agents=24, num_maps=1, scenario_length=30, resample_frequency=0, **kwargs)
+    except FileNotFoundError:
+        pytest.skip("Drive map binaries are not available in this checkout")
+
+
+def rollout(env, actions):
+    out = []
+    for a in actions:
+        obs, rewards, terminals, _, info = env.step(a)
+        # Imbalance stats are wall-clock timings, leave them out
+        stats = [{k: v for k, v in log.items() if "_imbalance_" not in k} for log in info]
+        out.append((obs.copy(), rewards.copy(), terminals.copy(), stats))
+    return out
+
+
+@pytest.mark.parametrize(
+    "kwargs",
+    [{}, {"scenarios_per_env": 3, "event_buffer_size": 16}, {"action_type": "continuous", "async_episodes": True}],
+)
+def test_drive_restore_replays_the_same_rollout(kwargs):
+    """Stepping on from a restored snapshot repeats the steps taken after it, across resets."""
+    env = make_env(**kwargs)
+    env.reset(seed=0)
+    rng = np.random.default_rng(0)
+    if env._action_type_flag:
+        actions = [rng.uniform(-1, 1, env.actions.shape).astype(np.float32) for _ in range(50)]
+    else:
+        actions = [np.stack([rng.integers(0, 7, env.num_agents), rng.integers(0, 13, env.num_agents)], axis=-1) for _ in range(50)]
+    rollout(env, actions[:10])
+    snapshot = env.snapshot()
+    outputs = [buf.copy() for buf in (env.observations, env.terminals, env.masks)]
+    first = rollout(env, actions[10:])
+    env.restore(snapshot)
+    assert env.snapshot() == snapshot
+    # The buffers show the snapshot's step again, so actions can be picked from them
+    for saved, buf in zip(outputs, (env.observations, env.terminals, env.masks)):
+        np.testing.assert_array_equal(buf, saved)
+    second = rollout(env, actions[10:])
+    for (o0, r0, d0, i0), (o1, r1, d1, i1) in zip(first, second):
+        np.testing.assert_array_equal(o0, o1)
+        np.testing.assert_array_equal(r0, r1)
+        np.testing.assert_array_equal(d0, d1)
+        assert i0 == i1
+    env.close()
+
+
+def test_drive_restore_rejects_foreign_snapshots():
+    env = make_env()
+    other = make_env(num_policy_controlled_agents=1, scenarios_per_env=2)
+    env.reset(seed=0)
+    other.reset(seed=0)
+    with pytest.raises(ValueError):
+        binding.env_restore(env.env_ids[0], binding.env_snapshot(other.env_ids[0]))
+    with pytest.raises(ValueError):
+        binding.env_restore(env.env_ids[0], b"\0" * 8)
+    env.close()
+    other.close()
+
+
+def synthetic_env(tmp_path, monkeypatch, name, x0):
+    # Three vehicles starting at x0: same counts for every x0, other positions
+    binaries = map_root(tmp_path / name, monkeypatch)
+    with open(binaries / "map_000.bin", "wb") as f:
+        f.write(struct.pack("ii", 3, 2))
+        for k in range(3):
+            write_vehicle(f, x0 + 15.0 * k, 0.0, x0 + 15.0 * k + 30.0)
+        write_edge(f, -6.3)
+        write_edge(f, 6.3)
+    env = Drive(num_agents=3, num_maps=1, scenario_length=30, resample_frequency=0)
+    env.reset(seed=0)
+    return env
+
+
+def test_drive_restore_rejects_snapshots_of_another_map_with_the_same_counts(tmp_path, monkeypatch):
+    skip_without_map_binaries()
+    env = synthetic_env(tmp_path, monkeypatch, "a", 0.0)
+    other = synthetic_env(tmp_path, monkeypatch, "b", 7.0)
+    with pytest.raises(ValueError):
+        env.restore(other.snapshot())
+    env.restore(env.snapshot())
+    env.close()
+    other.close()